@@ -8,6 +8,48 @@
 #include "platform/platform.h"
 #include "scene/renderer.h"
 
+// Applies the headless mesh operations to every editable mesh in the scene
+static std::string process_meshes(Scene& scene, const App::Settings& set) {
+
+    bool remesh = set.remesh_iterations > 0;
+    bool simplify = set.simplify > 0.0f || set.simplify_error > 0.0f;
+    if(!remesh && !simplify) return {};
+
+    std::string err;
+    scene.for_items([&](Scene_Item& item) {
+        if(!err.empty() || !item.is<Scene_Object>()) return;
+        Scene_Object& obj = item.get<Scene_Object>();
+        if(!obj.is_editable()) return;
+
+        std::string name = obj.opt.name;
+        Halfedge_Mesh& mesh = obj.get_mesh();
+        size_t faces = mesh.n_faces();
+        if(remesh && !mesh.isotropic_remesh(set.remesh_length, set.remesh_iterations)) {
+            err = name + ": mesh could not be remeshed";
+            return;
+        }
+        if(simplify) {
+            size_t target = 0;
+            if(set.simplify > 0.0f) {
+                target = std::max((size_t)(set.simplify * mesh.n_faces()), size_t{1});
+            }
+            // Not an error: the mesh may already be within the target or error bound
+            if(!mesh.simplify(target, set.simplify_error)) {
+                warn("Could not simplify %s: no edge can be collapsed", name.c_str());
+            }
+        }
+
+        auto valid = mesh.validate();
+        if(valid.has_value()) {
+            err = name + ": " + valid.value().second;
+            return;
+        }
+        obj.set_mesh_dirty();
+        info("Processed %s from %zu to %zu faces", name.c_str(), faces, mesh.n_faces());
+    });
+    return err;
+}
+
 App::App(Settings set, Platform* plt)
     : window_dim(plt ? plt->window_draw() : Vec2{1.0f}),
       camera(plt ? plt->window_draw() : Vec2{1.0f}), plt(plt), scene(Gui::n_Widget_IDs),
@@ -41,18 +83,36 @@ App::App(Settings set, Platform* plt)
         GL::global_params();
         Renderer::setup(window_dim);
         apply_window_dim(plt->window_draw());
+    } else if(!set.render.merge_files.empty()) {
+
+        info("Merging partial renders...");
+        err = gui.get_render().headless_merge(set.render);
+        if(!err.empty()) warn("Error merging renders: %s", err.c_str());
+
     } else if(loaded_scene) {
 
-        info("Rendering scene...");
-        err = gui.get_render().headless_render(gui.get_animate(), scene, set.output_file,
-                                               set.animate, set.w, set.h, set.s, set.ls, set.d,
-                                               set.exp, set.w_from_ar);
+        err = process_meshes(scene, set);
+
+        if(!err.empty()) {
+            warn("Error processing meshes: %s", err.c_str());
+
+        } else if(!set.save_scene.empty()) {
 
-        if(!err.empty())
-            warn("Error rendering scene: %s", err.c_str());
-        else {
-            auto [build, render] = gui.get_render().completion_time();
-            info("Built scene in %.2fs, rendered in %.2fs", build, render);
+            info("Saving scene...");
+            err = scene.write(set.save_scene, gui.get_render().get_cam(), gui.get_animate());
+            if(!err.empty()) warn("Error saving scene: %s", err.c_str());
+
+        } else {
+
+            info("Rendering scene...");
+            err = gui.get_render().headless_render(gui.get_animate(), scene, set.render);
+
+            if(!err.empty())
+                warn("Error rendering scene: %s", err.c_str());
+            else {
+                auto [build, render] = gui.get_render().completion_time();
+                info("Built scene in %.2fs, rendered in %.2fs", build, render);
+            }
         }
     }
 }
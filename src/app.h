@@ -23,15 +23,21 @@ public:
         bool headless = false;
 
         // If headless is true, use all of these
-        std::string output_file = "out.png";
-        int w = 640;
-        int h = 360;
-        int s = 128;
-        int ls = 16;
-        int d = 4;
-        bool animate = false;
-        float exp = 1.0f;
-        bool w_from_ar = false;
+        Gui::Headless_Settings render;
+
+        // Headless mesh processing, applied to every editable mesh before rendering.
+        // simplify is the fraction of faces to keep; simplify_error bounds how far
+        // simplification may move the surface. Zero disables either limit.
+        float simplify = 0.0f;
+        float simplify_error = 0.0f;
+
+        // Isotropic remeshing runs first, for remesh_iterations iterations (zero disables
+        // it), towards edges of remesh_length (zero keeps the mean edge length)
+        float remesh_length = 0.0f;
+        unsigned int remesh_iterations = 0;
+
+        // If set, write the processed scene to this file instead of rendering it
+        std::string save_scene;
     };
 
     App(Settings set, Platform* plt = nullptr);
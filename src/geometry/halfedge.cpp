@@ -1,12 +1,15 @@
 
 #include "halfedge.h"
 
+#include <limits>
 #include <map>
 #include <set>
 #include <sstream>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "../gui/widgets.h"
+#include "../util/thread_pool.h"
 
 Halfedge_Mesh::Halfedge_Mesh() {
     next_id = Gui::n_Widget_IDs;
@@ -28,7 +31,11 @@ void Halfedge_Mesh::clear() {
     vertices.clear();
     edges.clear();
     faces.clear();
+    added.clear();
+    id_index.clear();
+    unchecked = true;
     render_dirty_flag = true;
+    normals_dirty = true;
     next_id = Gui::n_Widget_IDs;
 }
 
@@ -43,58 +50,74 @@ Halfedge_Mesh::ElementRef Halfedge_Mesh::copy_to(Halfedge_Mesh& mesh, unsigned i
 
     // Clear any existing elements.
     mesh.clear();
-    ElementRef ret = vertices_begin();
-
-    // These maps will be used to identify elements of the old mesh
-    // with elements of the new mesh.  (Note that we can use a single
-    // map for both interior and boundary faces, because the map
-    // doesn't care which list of faces these iterators come from.)
-    std::unordered_map<unsigned int, HalfedgeRef> halfedgeOldToNew(n_halfedges());
-    std::unordered_map<unsigned int, VertexRef> vertexOldToNew(n_vertices());
-    std::unordered_map<unsigned int, EdgeRef> edgeOldToNew(n_edges());
-    std::unordered_map<unsigned int, FaceRef> faceOldToNew(n_faces());
-
-    // Copy geometry from the original mesh and create a map from
-    // pointers in the original mesh to those in the new mesh.
-    for(HalfedgeCRef h = halfedges_begin(); h != halfedges_end(); h++) {
-        auto hn = mesh.halfedges.insert(mesh.halfedges.end(), *h);
-        if(h->id() == eid) ret = hn;
-        halfedgeOldToNew[h->id()] = hn;
-    }
-    for(VertexCRef v = vertices_begin(); v != vertices_end(); v++) {
-        auto vn = mesh.vertices.insert(mesh.vertices.end(), *v);
-        if(v->id() == eid) ret = vn;
-        vertexOldToNew[v->id()] = vn;
-    }
-    for(EdgeCRef e = edges_begin(); e != edges_end(); e++) {
-        auto en = mesh.edges.insert(mesh.edges.end(), *e);
-        if(e->id() == eid) ret = en;
-        edgeOldToNew[e->id()] = en;
-    }
-    for(FaceCRef f = faces_begin(); f != faces_end(); f++) {
-        auto fn = mesh.faces.insert(mesh.faces.end(), *f);
-        if(f->id() == eid) ret = fn;
-        faceOldToNew[f->id()] = fn;
-    }
-
-    // "Search and replace" old pointers with new ones.
-    for(HalfedgeRef he = mesh.halfedges_begin(); he != mesh.halfedges_end(); he++) {
-        he->next() = halfedgeOldToNew[he->next()->id()];
-        he->twin() = halfedgeOldToNew[he->twin()->id()];
-        he->vertex() = vertexOldToNew[he->vertex()->id()];
-        he->edge() = edgeOldToNew[he->edge()->id()];
-        he->face() = faceOldToNew[he->face()->id()];
-    }
-    for(VertexRef v = mesh.vertices_begin(); v != mesh.vertices_end(); v++)
-        v->halfedge() = halfedgeOldToNew[v->halfedge()->id()];
-    for(EdgeRef e = mesh.edges_begin(); e != mesh.edges_end(); e++)
-        e->halfedge() = halfedgeOldToNew[e->halfedge()->id()];
-    for(FaceRef f = mesh.faces_begin(); f != mesh.faces_end(); f++)
-        f->halfedge() = halfedgeOldToNew[f->halfedge()->id()];
+
+    // Copy the element storage slot-for-slot, so every reference in the new mesh
+    // has the same index as in the original; only the storage they point into changes.
+    mesh.halfedges.copy_from(halfedges);
+    mesh.vertices.copy_from(vertices);
+    mesh.edges.copy_from(edges);
+    mesh.faces.copy_from(faces);
+    mesh.relink(nullptr, nullptr, nullptr, nullptr);
+    mesh.id_index = id_index;
+    mesh.compact();
 
     mesh.render_dirty_flag = true;
     mesh.next_id = next_id;
-    return ret;
+
+    auto ret = mesh.find_id(eid);
+    if(ret.has_value()) return ret.value();
+    return mesh.vertices_begin();
+}
+
+template<typename T>
+static void relink_ref(Slot_List<T>& list, typename Slot_List<T>::iterator& ref,
+                       const std::vector<uint32_t>* remap) {
+    uint32_t idx = ref.index();
+    if(remap && idx != Slot_List<T>::npos) idx = (*remap)[idx];
+    ref = list.at(idx);
+}
+
+void Halfedge_Mesh::relink(const std::vector<uint32_t>* hmap, const std::vector<uint32_t>* vmap,
+                           const std::vector<uint32_t>* emap, const std::vector<uint32_t>* fmap) {
+
+    // Point every stored reference at this mesh's storage, optionally moving it
+    // to a new slot index.
+    for(HalfedgeRef h = halfedges_begin(); h != halfedges_end(); h++) {
+        relink_ref(halfedges, h->_next, hmap);
+        relink_ref(halfedges, h->_twin, hmap);
+        relink_ref(vertices, h->_vertex, vmap);
+        relink_ref(edges, h->_edge, emap);
+        relink_ref(faces, h->_face, fmap);
+    }
+    for(VertexRef v = vertices_begin(); v != vertices_end(); v++)
+        relink_ref(halfedges, v->_halfedge, hmap);
+    for(EdgeRef e = edges_begin(); e != edges_end(); e++)
+        relink_ref(halfedges, e->_halfedge, hmap);
+    for(FaceRef f = faces_begin(); f != faces_end(); f++)
+        relink_ref(halfedges, f->_halfedge, hmap);
+}
+
+void Halfedge_Mesh::compact() {
+
+    do_erase();
+
+    if(halfedges.n_slots() == halfedges.size() && vertices.n_slots() == vertices.size() &&
+       edges.n_slots() == edges.size() && faces.n_slots() == faces.size())
+        return;
+
+    std::vector<uint32_t> hmap, vmap, emap, fmap;
+    halfedges.compact(hmap);
+    vertices.compact(vmap);
+    edges.compact(emap);
+    faces.compact(fmap);
+    relink(&hmap, &vmap, &emap, &fmap);
+
+    // Ordered like ElementRef
+    const std::vector<uint32_t>* maps[] = {&vmap, &emap, &hmap, &fmap};
+    for(Id_Entry& entry : id_index) {
+        const std::vector<uint32_t>& map = *maps[entry.kind];
+        entry.slot = entry.slot < map.size() ? map[entry.slot] : Slot_List<Vertex>::npos;
+    }
 }
 
 Vec3 Halfedge_Mesh::Vertex::neighborhood_center() const {
@@ -237,6 +260,64 @@ unsigned int Halfedge_Mesh::id_of(ElementRef elem) {
     return id;
 }
 
+std::optional<Halfedge_Mesh::ElementRef> Halfedge_Mesh::find_id(unsigned int id) {
+    if(id >= id_index.size()) return std::nullopt;
+    Id_Entry entry = id_index[id];
+    auto find = [&](auto& list) -> std::optional<ElementRef> {
+        auto elem = list.at(entry.slot);
+        if(!list.contains(elem) || elem->id() != id) return std::nullopt;
+        return elem;
+    };
+    switch(entry.kind) {
+    case 0: return find(vertices);
+    case 1: return find(edges);
+    case 2: return find(halfedges);
+    case 3: return find(faces);
+    default: return std::nullopt;
+    }
+}
+
+void Halfedge_Mesh::index_element(ElementRef elem) {
+    unsigned int id = id_of(elem);
+    if(id >= id_index.size()) id_index.resize(id + 1);
+    uint32_t slot = std::visit([](auto ref) { return ref.index(); }, elem);
+    id_index[id] = {slot, (uint32_t)elem.index()};
+}
+
+void Halfedge_Mesh::index_elements() {
+    id_index.assign(next_id, {});
+    for(VertexRef v = vertices_begin(); v != vertices_end(); v++) index_element(v);
+    for(EdgeRef e = edges_begin(); e != edges_end(); e++) index_element(e);
+    for(HalfedgeRef h = halfedges_begin(); h != halfedges_end(); h++) index_element(h);
+    for(FaceRef f = faces_begin(); f != faces_end(); f++) index_element(f);
+}
+
+std::vector<Halfedge_Mesh::ElementRef>
+Halfedge_Mesh::apply_each(const std::vector<ElementRef>& elems,
+                          const std::function<std::optional<ElementRef>(ElementRef)>& op) {
+
+    // Go by id, since a step may erase or replace the elements later steps act on
+    std::vector<unsigned int> ids(elems.size());
+    for(size_t i = 0; i < elems.size(); i++) ids[i] = id_of(elems[i]);
+
+    auto erased = [&](ElementRef elem) {
+        return std::visit(overloaded{[&](VertexRef v) { return verased.count(v) > 0; },
+                                     [&](EdgeRef e) { return eerased.count(e) > 0; },
+                                     [&](FaceRef f) { return ferased.count(f) > 0; },
+                                     [&](HalfedgeRef h) { return herased.count(h) > 0; }},
+                          elem);
+    };
+
+    std::vector<ElementRef> results;
+    for(unsigned int id : ids) {
+        std::optional<ElementRef> elem = find_id(id);
+        if(!elem.has_value() || erased(*elem)) continue;
+        std::optional<ElementRef> result = op(*elem);
+        if(result.has_value()) results.push_back(*result);
+    }
+    return results;
+}
+
 Vec3 Halfedge_Mesh::normal_of(Halfedge_Mesh::ElementRef elem) {
     Vec3 n;
     std::visit(overloaded{[&](VertexRef vert) { n = vert->normal(); },
@@ -260,74 +341,120 @@ Vec3 Halfedge_Mesh::center_of(Halfedge_Mesh::ElementRef elem) {
     return pos;
 }
 
+void Halfedge_Mesh::update_normals() const {
+
+    if(!normals_dirty && vertex_normals.size() == vertices.n_slots()) return;
+
+    std::vector<VertexCRef> verts;
+    verts.reserve(n_vertices());
+    for(VertexCRef v = vertices_begin(); v != vertices_end(); v++) verts.push_back(v);
+
+    vertex_normals.resize(vertices.n_slots());
+    parallel_for(verts.size(), 4096, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            vertex_normals[verts[i].index()] = verts[i]->normal();
+        }
+    });
+    normals_dirty = false;
+}
+
 void Halfedge_Mesh::to_mesh(GL::Mesh& mesh, bool split_faces) const {
 
+    // Give each non-boundary face the offset of its first triangle, so faces
+    // can be triangulated independently of each other.
+    std::vector<FaceCRef> face_list;
+    std::vector<size_t> tri_offset;
+    face_list.reserve(n_faces());
+    tri_offset.reserve(n_faces() + 1);
+    size_t n_tris = 0;
+    for(FaceCRef f = faces_begin(); f != faces_end(); f++) {
+        if(f->is_boundary()) continue;
+        unsigned int d = f->degree();
+        assert(d >= 3);
+        face_list.push_back(f);
+        tri_offset.push_back(n_tris);
+        n_tris += d - 2;
+    }
+
     std::vector<GL::Mesh::Vert> verts;
-    std::vector<GL::Mesh::Index> idxs;
+    std::vector<GL::Mesh::Index> idxs(3 * n_tris);
 
     if(split_faces) {
 
-        std::vector<GL::Mesh::Vert> face_verts;
-        for(FaceCRef f = faces_begin(); f != faces_end(); f++) {
+        verts.resize(3 * n_tris);
+        parallel_for(face_list.size(), 1024, [&](size_t begin, size_t end) {
+            for(size_t fi = begin; fi < end; fi++) {
 
-            if(f->is_boundary()) continue;
+                FaceCRef f = face_list[fi];
+                size_t idx = 3 * tri_offset[fi];
 
-            HalfedgeCRef h = f->halfedge();
-            face_verts.clear();
-            do {
-                VertexCRef v = h->vertex();
-                Vec3 n = v->normal();
-                if(flip_orientation) n = -n;
-                face_verts.push_back({v->pos, n, f->id()});
+                HalfedgeCRef h = f->halfedge();
+                Vec3 v0 = h->vertex()->pos;
                 h = h->next();
-            } while(h != f->halfedge());
-
-            Vec3 v0 = face_verts[0].pos;
-            for(size_t i = 1; i <= face_verts.size() - 2; i++) {
-                Vec3 v1 = face_verts[i].pos;
-                Vec3 v2 = face_verts[i + 1].pos;
-                Vec3 n = cross(v1 - v0, v2 - v0).unit();
-                if(flip_orientation) n = -n;
-                GL::Mesh::Index idx = (GL::Mesh::Index)verts.size();
-                verts.push_back({v0, n, f->_id});
-                verts.push_back({v1, n, f->_id});
-                verts.push_back({v2, n, f->_id});
-                idxs.push_back(idx);
-                idxs.push_back(idx + 1);
-                idxs.push_back(idx + 2);
+                Vec3 v1 = h->vertex()->pos;
+                h = h->next();
+                do {
+                    Vec3 v2 = h->vertex()->pos;
+                    Vec3 n = cross(v1 - v0, v2 - v0).unit();
+                    if(flip_orientation) n = -n;
+                    verts[idx] = {v0, n, f->_id};
+                    verts[idx + 1] = {v1, n, f->_id};
+                    verts[idx + 2] = {v2, n, f->_id};
+                    idxs[idx] = (GL::Mesh::Index)idx;
+                    idxs[idx + 1] = (GL::Mesh::Index)(idx + 1);
+                    idxs[idx + 2] = (GL::Mesh::Index)(idx + 2);
+                    idx += 3;
+                    v1 = v2;
+                    h = h->next();
+                } while(h != f->halfedge());
             }
-        }
+        });
 
     } else {
 
-        // Need to build this map to get vertex's linear index in O(lg n)
-        std::map<VertexCRef, Index> vref_to_idx;
-        Index i = 0;
-        for(VertexCRef v = vertices_begin(); v != vertices_end(); v++, i++) {
-            vref_to_idx[v] = i;
-            Vec3 n = v->normal();
-            if(flip_orientation) n = -n;
-            verts.push_back({v->pos, n, v->_id});
+        update_normals();
+
+        // Dense vertex indices, looked up by slot index
+        std::vector<VertexCRef> vert_list;
+        std::vector<GL::Mesh::Index> slot_to_idx(vertices.n_slots());
+        vert_list.reserve(n_vertices());
+        for(VertexCRef v = vertices_begin(); v != vertices_end(); v++) {
+            slot_to_idx[v.index()] = (GL::Mesh::Index)vert_list.size();
+            vert_list.push_back(v);
         }
 
-        for(FaceCRef f = faces_begin(); f != faces_end(); f++) {
+        verts.resize(vert_list.size());
+        parallel_for(vert_list.size(), 4096, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) {
+                VertexCRef v = vert_list[i];
+                Vec3 n = vertex_normals[v.index()];
+                if(flip_orientation) n = -n;
+                verts[i] = {v->pos, n, v->_id};
+            }
+        });
 
-            if(f->is_boundary()) continue;
+        parallel_for(face_list.size(), 1024, [&](size_t begin, size_t end) {
+            for(size_t fi = begin; fi < end; fi++) {
 
-            std::vector<Index> face_verts;
-            HalfedgeCRef h = f->halfedge();
-            do {
-                face_verts.push_back(vref_to_idx[h->vertex()]);
-                h = h->next();
-            } while(h != f->halfedge());
+                FaceCRef f = face_list[fi];
+                size_t idx = 3 * tri_offset[fi];
 
-            assert(face_verts.size() >= 3);
-            for(size_t j = 1; j <= face_verts.size() - 2; j++) {
-                idxs.push_back((GL::Mesh::Index)face_verts[0]);
-                idxs.push_back((GL::Mesh::Index)face_verts[j]);
-                idxs.push_back((GL::Mesh::Index)face_verts[j + 1]);
+                HalfedgeCRef h = f->halfedge();
+                GL::Mesh::Index i0 = slot_to_idx[h->vertex().index()];
+                h = h->next();
+                GL::Mesh::Index i1 = slot_to_idx[h->vertex().index()];
+                h = h->next();
+                do {
+                    GL::Mesh::Index i2 = slot_to_idx[h->vertex().index()];
+                    idxs[idx] = i0;
+                    idxs[idx + 1] = i1;
+                    idxs[idx + 2] = i2;
+                    idx += 3;
+                    i1 = i2;
+                    h = h->next();
+                } while(h != f->halfedge());
             }
-        }
+        });
     }
 
     mesh = GL::Mesh(std::move(verts), std::move(idxs));
@@ -335,6 +462,7 @@ void Halfedge_Mesh::to_mesh(GL::Mesh& mesh, bool split_faces) const {
 
 void Halfedge_Mesh::mark_dirty() {
     render_dirty_flag = true;
+    normals_dirty = true;
 }
 
 std::optional<std::pair<Halfedge_Mesh::ElementRef, std::string>> Halfedge_Mesh::warnings() {
@@ -479,20 +607,463 @@ std::optional<std::pair<Halfedge_Mesh::ElementRef, std::string>> Halfedge_Mesh::
     }
 
     do_erase();
+    added.clear();
+    unchecked = false;
     return std::nullopt;
 }
 
+Halfedge_Mesh::Region Halfedge_Mesh::region_of(const std::vector<ElementRef>& seeds) {
+
+    // The stale links of erased elements may lead into a loop that never comes back to
+    // where the walk started, so every walk also stops once it revisits a halfedge.
+    // Walks around faces and around vertices nest, so each kind keeps its own marks.
+    struct Walks {
+        std::unordered_map<unsigned int, size_t> last;
+        size_t current = 0;
+        bool revisit(HalfedgeRef h) {
+            auto [entry, fresh] = last.insert({h->id(), current});
+            if(!fresh && entry->second == current) return true;
+            entry->second = current;
+            return false;
+        }
+    };
+    Walks face_walks, vertex_walks;
+
+    std::vector<VertexRef> centers;
+    for(const ElementRef& elem : seeds) {
+        std::visit(overloaded{[&](VertexRef v) { centers.push_back(v); },
+                              [&](EdgeRef e) {
+                                  centers.push_back(e->halfedge()->vertex());
+                                  centers.push_back(e->halfedge()->twin()->vertex());
+                              },
+                              [&](FaceRef f) {
+                                  HalfedgeRef h = f->halfedge();
+                                  face_walks.current++;
+                                  do {
+                                      centers.push_back(h->vertex());
+                                      h = h->next();
+                                  } while(h != f->halfedge() && !face_walks.revisit(h));
+                              },
+                              [&](HalfedgeRef h) {
+                                  centers.push_back(h->vertex());
+                                  centers.push_back(h->twin()->vertex());
+                              }},
+                   elem);
+    }
+
+    // The region is every face around the centers, plus the twins of their halfedges
+    Region region;
+    std::unordered_set<unsigned int> seen_v, seen_h, seen_e, seen_f, walked_v;
+    auto add_halfedge = [&](HalfedgeRef h) {
+        if(seen_h.insert(h->id()).second) region.halfedges.push_back(h);
+        if(seen_v.insert(h->vertex()->id()).second) region.vertices.push_back(h->vertex());
+        if(seen_e.insert(h->edge()->id()).second) region.edges.push_back(h->edge());
+    };
+
+    for(VertexRef v : centers) {
+        if(!walked_v.insert(v->id()).second) continue;
+        if(seen_v.insert(v->id()).second) region.vertices.push_back(v);
+
+        HalfedgeRef h = v->halfedge();
+        vertex_walks.current++;
+        do {
+            FaceRef f = h->face();
+            if(seen_f.insert(f->id()).second) {
+                region.faces.push_back(f);
+                HalfedgeRef i = f->halfedge();
+                face_walks.current++;
+                do {
+                    add_halfedge(i);
+                    add_halfedge(i->twin());
+                    i = i->next();
+                } while(i != f->halfedge() && !face_walks.revisit(i));
+            }
+            add_halfedge(h);
+            h = h->twin()->next();
+        } while(h != v->halfedge() && !vertex_walks.revisit(h));
+    }
+    return region;
+}
+
+std::optional<std::pair<Halfedge_Mesh::ElementRef, std::string>>
+Halfedge_Mesh::validate_local(const std::vector<ElementRef>& touched) {
+
+#ifdef SCOTTY3D_FULL_VALIDATION
+    return validate();
+#else
+    if(unchecked) return validate();
+
+    std::vector<ElementRef> seeds = touched;
+    seeds.insert(seeds.end(), added.begin(), added.end());
+    seeds.insert(seeds.end(), verased.begin(), verased.end());
+    seeds.insert(seeds.end(), eerased.begin(), eerased.end());
+    seeds.insert(seeds.end(), ferased.begin(), ferased.end());
+    seeds.insert(seeds.end(), herased.begin(), herased.end());
+
+    Region region = region_of(seeds);
+    size_t limit = n_halfedges();
+
+    for(VertexRef v : region.vertices) {
+        Vec3 p = v->pos;
+        bool finite = std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+        if(!finite) return {{v, "A vertex position was set to a non-finite value."}};
+    }
+
+    std::unordered_map<unsigned int, unsigned int> prev;
+
+    for(HalfedgeRef h : region.halfedges) {
+
+        if(herased.find(h) != herased.end()) continue;
+
+        if(herased.find(h->next()) != herased.end()) {
+            return {{h, "A live halfedge's next was erased!"}};
+        }
+        if(herased.find(h->twin()) != herased.end()) {
+            return {{h, "A live halfedge's twin was erased!"}};
+        }
+        if(verased.find(h->vertex()) != verased.end()) {
+            return {{h, "A live halfedge's vertex was erased!"}};
+        }
+        if(ferased.find(h->face()) != ferased.end()) {
+            return {{h, "A live halfedge's face was erased!"}};
+        }
+        if(eerased.find(h->edge()) != eerased.end()) {
+            return {{h, "A live halfedge's edge was erased!"}};
+        }
+
+        if(!prev.insert({h->next()->id(), h->id()}).second) {
+            return {{h->next(), "A halfedge is the next of multiple halfedges!"}};
+        }
+
+        if(h->twin() == h) {
+            return {{h, "A halfedge's twin is itself!"}};
+        }
+        if(h->twin()->twin() != h) {
+            return {{h, "A halfedge's twin's twin is not itself!"}};
+        }
+    }
+
+    // Every halfedge must lie on its own next loop. Outside the region we can't see
+    // all predecessors, so this stands in for the global "next of zero" check.
+    std::unordered_set<unsigned int> on_loop;
+    for(HalfedgeRef h : region.halfedges) {
+
+        if(herased.find(h) != herased.end() || on_loop.count(h->id())) continue;
+
+        std::vector<unsigned int> loop;
+        HalfedgeRef i = h;
+        do {
+            loop.push_back(i->id());
+            i = i->next();
+        } while(i != h && loop.size() <= limit);
+
+        if(i != h) {
+            return {{h, "A halfedge is the next of zero halfedges!"}};
+        }
+        on_loop.insert(loop.begin(), loop.end());
+    }
+
+    for(VertexRef v : region.vertices) {
+
+        if(verased.find(v) != verased.end()) continue;
+
+        HalfedgeRef h = v->halfedge();
+        if(herased.find(h) != herased.end()) {
+            return {{v, "A vertex's halfedge is erased!"}};
+        }
+
+        size_t n = 0;
+        do {
+            if(h->vertex() != v) {
+                return {{h, "A vertex's halfedge does not point to that vertex!"}};
+            }
+            h = h->twin()->next();
+        } while(h != v->halfedge() && ++n < limit);
+    }
+
+    for(EdgeRef e : region.edges) {
+
+        if(eerased.find(e) != eerased.end()) continue;
+
+        HalfedgeRef h = e->halfedge();
+        if(herased.find(h) != herased.end()) {
+            return {{e, "An edge's halfedge is erased!"}};
+        }
+        if(h->edge() != e || h->twin()->edge() != e) {
+            return {{h, "An edge's halfedge does not point to that edge!"}};
+        }
+    }
+
+    for(FaceRef f : region.faces) {
+
+        if(ferased.find(f) != ferased.end()) continue;
+
+        HalfedgeRef h = f->halfedge();
+        if(herased.find(h) != herased.end()) {
+            return {{f, "A face's halfedge is erased!"}};
+        }
+
+        size_t n = 0;
+        do {
+            if(h->face() != f) {
+                return {{h, "A face's halfedge does not point to that face!"}};
+            }
+            h = h->next();
+        } while(h != f->halfedge() && ++n < limit);
+    }
+
+    do_erase();
+    added.clear();
+    unchecked = false;
+    return std::nullopt;
+#endif
+}
+
+std::optional<std::pair<Halfedge_Mesh::ElementRef, std::string>>
+Halfedge_Mesh::warnings_local(const std::vector<ElementRef>& touched) {
+
+#ifdef SCOTTY3D_FULL_VALIDATION
+    return warnings();
+#else
+    // Skip references to elements that were erased by the operation
+    std::vector<ElementRef> seeds;
+    for(const ElementRef& elem : touched) {
+        bool live = std::visit(overloaded{[&](VertexRef v) { return vertices.contains(v); },
+                                          [&](EdgeRef e) { return edges.contains(e); },
+                                          [&](FaceRef f) { return faces.contains(f); },
+                                          [&](HalfedgeRef h) { return halfedges.contains(h); }},
+                               elem);
+        if(live) seeds.push_back(elem);
+    }
+    Region region = region_of(seeds);
+
+    std::set<Vec3> v_pos;
+    std::set<std::pair<unsigned int, unsigned int>> edge_ids;
+
+    for(VertexRef v : region.vertices) {
+        if(!v_pos.insert(v->pos).second) {
+            return {{v, "Vertices with identical positions."}};
+        }
+    }
+
+    for(EdgeRef e : region.edges) {
+        unsigned int l = e->halfedge()->vertex()->id();
+        unsigned int r = e->halfedge()->twin()->vertex()->id();
+        if(l == r) {
+            return {{e, "Edge wrapping single vertex."}};
+        }
+        if(!edge_ids.insert({l, r}).second) {
+            return {{e, "Multiple edges across same vertices."}};
+        }
+        edge_ids.insert({r, l});
+    }
+
+    return std::nullopt;
+#endif
+}
+
+void Halfedge_Mesh::begin_delta(Delta& delta, const std::vector<ElementRef>& touched) {
+
+    delta = Delta();
+    delta.first_id = next_id;
+
+    Region region = region_of(touched);
+    for(HalfedgeRef h : region.halfedges) delta.tracked.push_back({h, h->id()});
+    for(VertexRef v : region.vertices) delta.tracked.push_back({v, v->id()});
+    for(EdgeRef e : region.edges) delta.tracked.push_back({e, e->id()});
+    for(FaceRef f : region.faces) delta.tracked.push_back({f, f->id()});
+    for(auto& entry : delta.tracked) delta.tracked_ids.insert(entry.second);
+
+    record(delta, delta.before);
+}
+
+void Halfedge_Mesh::end_delta(Delta& delta) {
+
+    for(const ElementRef& elem : added) {
+        unsigned int id = id_of(elem);
+        if(id >= delta.first_id && delta.tracked_ids.insert(id).second) {
+            delta.tracked.push_back({elem, id});
+        }
+    }
+
+    delta.after = {};
+    record(delta, delta.after);
+}
+
+void Halfedge_Mesh::record(const Delta& delta, Delta::State& state) {
+
+    // A rejected edit may leave references to nothing; those are recorded as an id
+    // no element has, which is harmless since such a state is only ever undone.
+    auto id = [](const auto& list, auto ref) {
+        return list.contains(ref) ? ref->id() : std::numeric_limits<unsigned int>::max();
+    };
+
+    // Skip elements that are erased, or whose slot has since been reused
+    for(auto& [elem, elem_id] : delta.tracked) {
+        std::visit(
+            overloaded{
+                [&, eid = elem_id](VertexRef v) {
+                    if(!vertices.contains(v) || verased.count(v) || v->id() != eid) return;
+                    state.vertices.push_back({eid, id(halfedges, v->halfedge()), v->pos});
+                },
+                [&, eid = elem_id](EdgeRef e) {
+                    if(!edges.contains(e) || eerased.count(e) || e->id() != eid) return;
+                    state.edges.push_back({eid, id(halfedges, e->halfedge())});
+                },
+                [&, eid = elem_id](FaceRef f) {
+                    if(!faces.contains(f) || ferased.count(f) || f->id() != eid) return;
+                    state.faces.push_back({eid, id(halfedges, f->halfedge()), f->is_boundary()});
+                },
+                [&, eid = elem_id](HalfedgeRef h) {
+                    if(!halfedges.contains(h) || herased.count(h) || h->id() != eid) return;
+                    state.halfedges.push_back({eid, id(halfedges, h->next()),
+                                               id(halfedges, h->twin()), id(vertices, h->vertex()),
+                                               id(edges, h->edge()), id(faces, h->face())});
+                }},
+            elem);
+    }
+}
+
+void Halfedge_Mesh::undo(const Delta& delta) {
+    apply(delta.after, delta.before);
+}
+
+void Halfedge_Mesh::redo(const Delta& delta) {
+    apply(delta.before, delta.after);
+}
+
+void Halfedge_Mesh::apply(const Delta::State& from, const Delta::State& to) {
+
+    bool checked = !unchecked;
+
+    // Find every element the two states mention, including neighbors outside the delta
+    std::unordered_set<unsigned int> v_ids, e_ids, f_ids, h_ids;
+    for(const Delta::State* state : {&from, &to}) {
+        for(auto& v : state->vertices) {
+            v_ids.insert(v.id);
+            h_ids.insert(v.halfedge);
+        }
+        for(auto& e : state->edges) {
+            e_ids.insert(e.id);
+            h_ids.insert(e.halfedge);
+        }
+        for(auto& f : state->faces) {
+            f_ids.insert(f.id);
+            h_ids.insert(f.halfedge);
+        }
+        for(auto& h : state->halfedges) {
+            h_ids.insert(h.id);
+            h_ids.insert(h.next);
+            h_ids.insert(h.twin);
+            v_ids.insert(h.vertex);
+            e_ids.insert(h.edge);
+            f_ids.insert(h.face);
+        }
+    }
+
+    std::unordered_map<unsigned int, VertexRef> v_map;
+    std::unordered_map<unsigned int, EdgeRef> e_map;
+    std::unordered_map<unsigned int, FaceRef> f_map;
+    std::unordered_map<unsigned int, HalfedgeRef> h_map;
+    auto lookup = [&](const auto& ids, auto& map) {
+        using Ref = typename std::decay_t<decltype(map)>::mapped_type;
+        for(unsigned int id : ids) {
+            auto elem = find_id(id);
+            if(elem.has_value() && std::holds_alternative<Ref>(*elem)) {
+                map[id] = std::get<Ref>(*elem);
+            }
+        }
+    };
+    lookup(v_ids, v_map);
+    lookup(e_ids, e_map);
+    lookup(f_ids, f_map);
+    lookup(h_ids, h_map);
+
+    // Erase elements that only exist in the current state...
+    std::unordered_set<unsigned int> keep;
+    for(auto& v : to.vertices) keep.insert(v.id);
+    for(auto& e : to.edges) keep.insert(e.id);
+    for(auto& f : to.faces) keep.insert(f.id);
+    for(auto& h : to.halfedges) keep.insert(h.id);
+    for(auto& v : from.vertices)
+        if(!keep.count(v.id)) erase(v_map.at(v.id));
+    for(auto& e : from.edges)
+        if(!keep.count(e.id)) erase(e_map.at(e.id));
+    for(auto& f : from.faces)
+        if(!keep.count(f.id)) erase(f_map.at(f.id));
+    for(auto& h : from.halfedges)
+        if(!keep.count(h.id)) erase(h_map.at(h.id));
+
+    // ...re-create the ones that only exist in the target state, under their old ids...
+    for(auto& v : to.vertices) {
+        if(v_map.count(v.id)) continue;
+        index_element(v_map[v.id] = vertices.insert(Vertex(v.id)));
+    }
+    for(auto& e : to.edges) {
+        if(e_map.count(e.id)) continue;
+        index_element(e_map[e.id] = edges.insert(Edge(e.id)));
+    }
+    for(auto& f : to.faces) {
+        if(f_map.count(f.id)) continue;
+        index_element(f_map[f.id] = faces.insert(Face(f.id, f.boundary)));
+    }
+    for(auto& h : to.halfedges) {
+        if(h_map.count(h.id)) continue;
+        index_element(h_map[h.id] = halfedges.insert(Halfedge(h.id)));
+    }
+
+    // ...and restore the contents of everything in the target state. Elements an
+    // unvalidated edit marked for erasure are revived if the target state has them.
+    for(auto& v : to.vertices) {
+        VertexRef vert = v_map.at(v.id);
+        vert->pos = v.pos;
+        vert->_halfedge = h_map.at(v.halfedge);
+        verased.erase(vert);
+    }
+    for(auto& e : to.edges) {
+        EdgeRef edge = e_map.at(e.id);
+        edge->_halfedge = h_map.at(e.halfedge);
+        eerased.erase(edge);
+    }
+    for(auto& f : to.faces) {
+        FaceRef face = f_map.at(f.id);
+        face->_halfedge = h_map.at(f.halfedge);
+        ferased.erase(face);
+    }
+    for(auto& h : to.halfedges) {
+        HalfedgeRef he = h_map.at(h.id);
+        he->set_neighbors(h_map.at(h.next), h_map.at(h.twin), v_map.at(h.vertex),
+                          e_map.at(h.edge), f_map.at(h.face));
+        herased.erase(he);
+    }
+
+    do_erase();
+    added.clear();
+    unchecked = !checked;
+    mark_dirty();
+}
+
 void Halfedge_Mesh::do_erase() {
+    if(!verased.empty() || !eerased.empty() || !ferased.empty() || !herased.empty()) {
+        unchecked = true;
+    }
+    auto unindex = [&](unsigned int id) {
+        if(id < id_index.size()) id_index[id] = {};
+    };
     for(auto& v : verased) {
+        unindex(v->id());
         vertices.erase(v);
     }
     for(auto& e : eerased) {
+        unindex(e->id());
         edges.erase(e);
     }
     for(auto& f : ferased) {
+        unindex(f->id());
         faces.erase(f);
     }
     for(auto& h : herased) {
+        unindex(h->id());
         halfedges.erase(h);
     }
     verased.clear();
@@ -503,93 +1074,561 @@ void Halfedge_Mesh::do_erase() {
 
 std::string Halfedge_Mesh::from_mesh(const GL::Mesh& mesh) {
 
-    auto idx = mesh.indices();
-    auto v = mesh.verts();
+    const auto& idx = mesh.indices();
+    const auto& v = mesh.verts();
 
-    std::vector<std::vector<Index>> polys;
+    std::vector<GL::Mesh::Index> tris;
     std::vector<Vec3> verts(v.size());
 
-    for(size_t i = 0; i < idx.size(); i += 3) {
+    tris.reserve(idx.size());
+    for(size_t i = 0; i + 2 < idx.size(); i += 3) {
         if(idx[i] != idx[i + 1] && idx[i] != idx[i + 2] && idx[i + 1] != idx[i + 2])
-            polys.push_back({idx[i], idx[i + 1], idx[i + 2]});
+            tris.insert(tris.end(), {idx[i], idx[i + 1], idx[i + 2]});
     }
     for(size_t i = 0; i < v.size(); i++) {
         verts[i] = v[i].pos;
     }
 
-    std::string err = from_poly(polys, verts);
-    if(!err.empty()) return err;
+    return from_soup(tris, 3, verts);
+}
+
+/*
+    from_soup numbers interior halfedges by their position in the index buffer, so halfedge
+    h is corner h % degree of polygon h / degree and starts at indices[h]. Twins are found
+    by radix sorting the halfedges on their unordered vertex pair (plus a direction bit),
+    which leaves the halfedges of each edge next to each other. Halfedges left without a
+    twin get a boundary twin, numbered after all interior halfedges.
+*/
+struct Soup_Key {
+    uint64_t key;
+    uint32_t half;
+};
+
+static void radix_sort(std::vector<Soup_Key>& keys, unsigned int key_bits) {
+
+    // Split the key into as few digits of at most 12 bits as possible
+    unsigned int passes = (key_bits + 11) / 12;
+    unsigned int digit_bits = (key_bits + passes - 1) / passes;
+    size_t radix = size_t(1) << digit_bits;
+
+    size_t n = keys.size();
+    size_t grain = std::max(n / 64, size_t(1) << 16);
+    size_t chunks = (n + grain - 1) / grain;
+
+    std::vector<Soup_Key> sorted(n);
+    std::vector<uint32_t> offsets(chunks * radix);
+
+    for(unsigned int shift = 0; shift < key_bits; shift += digit_bits) {
+
+        std::fill(offsets.begin(), offsets.end(), 0);
+        parallel_for(n, grain, [&](size_t begin, size_t end) {
+            uint32_t* count = &offsets[begin / grain * radix];
+            for(size_t i = begin; i < end; i++) {
+                count[(keys[i].key >> shift) & (radix - 1)]++;
+            }
+        });
+
+        // A chunk's keys with some digit go after all keys with smaller digits and after
+        // the earlier chunks' keys with the same digit, which keeps each pass stable
+        uint32_t sum = 0;
+        for(size_t d = 0; d < radix; d++) {
+            for(size_t c = 0; c < chunks; c++) {
+                uint32_t count = offsets[c * radix + d];
+                offsets[c * radix + d] = sum;
+                sum += count;
+            }
+        }
+
+        parallel_for(n, grain, [&](size_t begin, size_t end) {
+            uint32_t* offset = &offsets[begin / grain * radix];
+            for(size_t i = begin; i < end; i++) {
+                sorted[offset[(keys[i].key >> shift) & (radix - 1)]++] = keys[i];
+            }
+        });
+        keys.swap(sorted);
+    }
+}
+
+std::string Halfedge_Mesh::from_soup(const std::vector<GL::Mesh::Index>& indices,
+                                     unsigned int degree, const std::vector<Vec3>& verts) {
 
-    auto valid = validate();
-    if(valid.has_value()) return valid.value().second;
+    clear();
+
+    if(degree < 3) return "Each polygon must have at least three vertices.";
+    if(indices.size() % degree) return "The index buffer does not hold whole polygons.";
+    if(indices.size() >= (size_t(1) << 31)) return "The mesh has too many polygons.";
+    // Twin keys pack two vertex indices and a direction bit into 64 bits
+    if(verts.size() > (size_t(1) << 31)) return "The mesh has too many vertices.";
+
+    const uint32_t npos = Slot_List<Halfedge>::npos;
+    const uint32_t H = (uint32_t)indices.size();
+    const uint32_t F = H / degree;
+    auto next_of = [degree](uint32_t h) {
+        return h % degree + 1 == degree ? h + 1 - degree : h + 1;
+    };
+
+    // Remember one outgoing halfedge per vertex; this also tells which vertices are used
+    std::vector<uint32_t> vhalf(verts.size(), npos);
+    for(uint32_t h = 0; h < H; h++) {
+        if(indices[h] >= verts.size()) return "A polygon refers to a missing vertex position.";
+        vhalf[indices[h]] = h;
+    }
 
+    std::atomic<bool> repeated{false};
+    parallel_for(F, 4096, [&](size_t begin, size_t end) {
+        for(size_t f = begin; f < end; f++) {
+            const GL::Mesh::Index* poly = &indices[f * degree];
+            for(unsigned int i = 0; i < degree; i++) {
+                for(unsigned int j = i + 1; j < degree; j++) {
+                    if(poly[i] == poly[j]) repeated = true;
+                }
+            }
+        }
+    });
+    if(repeated) return "One of the input polygons does not have distinct vertices!";
+
+    unsigned int bits = 1;
+    while(bits < 31 && (size_t(1) << bits) < verts.size()) bits++;
+
+    std::vector<Soup_Key> keys(H);
+    parallel_for(H, 1 << 16, [&](size_t begin, size_t end) {
+        for(size_t h = begin; h < end; h++) {
+            uint64_t a = indices[h], b = indices[next_of((uint32_t)h)];
+            keys[h].key = (std::min(a, b) << bits | std::max(a, b)) << 1 | (a > b);
+            keys[h].half = (uint32_t)h;
+        }
+    });
+    radix_sort(keys, 2 * bits + 1);
+
+    // Every run of halfedges with the same vertex pair becomes an edge. Runs belong to
+    // the chunk they start in, so each chunk first counts its edges and boundary
+    // halfedges and then numbers them from the prefix sums.
+    auto run_start = [&](size_t i) { return i == 0 || keys[i].key >> 1 != keys[i - 1].key >> 1; };
+
+    const size_t grain = 1 << 16;
+    const size_t chunks = (H + grain - 1) / grain;
+    std::vector<uint32_t> chunk_edges(chunks + 1), chunk_bound(chunks + 1);
+
+    std::atomic<bool> bad_edge{false};
+    parallel_for(H, grain, [&](size_t begin, size_t end) {
+        uint32_t n_edges = 0, n_bound = 0;
+        for(size_t i = begin; i < end; i++) {
+            if(!run_start(i)) continue;
+            size_t len = 1;
+            while(i + len < H && !run_start(i + len)) len++;
+            // More than two faces share the edge, or two faces disagree on orientation
+            if(len > 2 || (len == 2 && keys[i].key == keys[i + 1].key)) bad_edge = true;
+            n_edges++;
+            n_bound += len == 1;
+        }
+        chunk_edges[begin / grain + 1] = n_edges;
+        chunk_bound[begin / grain + 1] = n_bound;
+    });
+    if(bad_edge) return "The surface is nonmanifold or not consistently oriented at an edge.";
+
+    for(size_t c = 0; c < chunks; c++) {
+        chunk_edges[c + 1] += chunk_edges[c];
+        chunk_bound[c + 1] += chunk_bound[c];
+    }
+    const uint32_t E = chunk_edges[chunks];
+    const uint32_t B = chunk_bound[chunks];
+
+    std::vector<uint32_t> twin(H + B), edge(H + B), ehalf(E);
+    parallel_for(H, grain, [&](size_t begin, size_t end) {
+        uint32_t e = chunk_edges[begin / grain];
+        uint32_t b = H + chunk_bound[begin / grain];
+        for(size_t i = begin; i < end; i++) {
+            if(!run_start(i)) continue;
+            uint32_t h = keys[i].half;
+            uint32_t t = i + 1 < H && !run_start(i + 1) ? keys[i + 1].half : b++;
+            twin[h] = t;
+            twin[t] = h;
+            edge[h] = edge[t] = e;
+            ehalf[e++] = h;
+        }
+    });
+    keys = {};
+
+    // A boundary halfedge runs backwards along its twin, so it starts where the twin
+    // ends. Each vertex may start at most one boundary halfedge, which then becomes its
+    // halfedge and follows the boundary halfedge ending there.
+    auto source = [&](uint32_t h) { return h < H ? indices[h] : indices[next_of(twin[h])]; };
+
+    std::vector<uint32_t> bstart(B ? verts.size() : 0, npos), bnext(B);
+    for(uint32_t t = H; t < H + B; t++) {
+        uint32_t v = source(t);
+        if(bstart[v] != npos) return "At least one of the vertices is nonmanifold.";
+        bstart[v] = vhalf[v] = t;
+    }
+    for(uint32_t t = H; t < H + B; t++) {
+        bnext[t - H] = bstart[indices[twin[t]]];
+    }
+    bstart = {};
+
+    std::vector<uint32_t> fhalf(F), bface(B, npos);
+    for(uint32_t f = 0; f < F; f++) fhalf[f] = f * degree;
+    for(uint32_t b = 0; b < B; b++) {
+        if(bface[b] != npos) continue;
+        uint32_t f = (uint32_t)fhalf.size();
+        fhalf.push_back(H + b);
+        for(uint32_t i = b; bface[i] == npos; i = bnext[i] - H) bface[i] = f;
+    }
+
+    // Walking around each vertex must reach every polygon using it: otherwise the
+    // polygons form several fans, and the sum of the walks falls short of H.
+    auto next = [&](uint32_t h) { return h < H ? next_of(h) : bnext[h - H]; };
+
+    std::atomic<size_t> fans{0};
+    std::atomic<bool> non_finite{false};
+    parallel_for(verts.size(), 4096, [&](size_t begin, size_t end) {
+        size_t count = 0;
+        for(size_t v = begin; v < end; v++) {
+            if(vhalf[v] == npos) continue;
+            Vec3 p = verts[v];
+            if(!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) {
+                non_finite = true;
+            }
+            uint32_t h = vhalf[v];
+            do {
+                count += h < H;
+                h = next(twin[h]);
+            } while(h != vhalf[v]);
+        }
+        fans += count;
+    });
+    if(fans != H) return "At least one of the vertices is nonmanifold.";
+    if(non_finite) return "A vertex position was set to a non-finite value.";
+
+    std::vector<uint32_t> vmap(verts.size(), npos), vsource;
+    for(uint32_t v = 0; v < verts.size(); v++) {
+        if(vhalf[v] == npos) continue;
+        vmap[v] = (uint32_t)vsource.size();
+        vsource.push_back(v);
+    }
+
+    for(uint32_t h = 0; h < H + B; h++) halfedges.insert(Halfedge(next_id++));
+    for(size_t v = 0; v < vsource.size(); v++) vertices.insert(Vertex(next_id++));
+    for(uint32_t e = 0; e < E; e++) edges.insert(Edge(next_id++));
+    for(uint32_t f = 0; f < fhalf.size(); f++) faces.insert(Face(next_id++, f >= F));
+
+    parallel_for(H + B, 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            uint32_t h = (uint32_t)i;
+            HalfedgeRef he = halfedges.at(h);
+            he->next() = halfedges.at(next(h));
+            he->twin() = halfedges.at(twin[h]);
+            he->vertex() = vertices.at(vmap[source(h)]);
+            he->edge() = edges.at(edge[h]);
+            he->face() = faces.at(h < H ? h / degree : bface[h - H]);
+        }
+    });
+    parallel_for(vsource.size(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            VertexRef v = vertices.at((uint32_t)i);
+            v->halfedge() = halfedges.at(vhalf[vsource[i]]);
+            v->pos = verts[vsource[i]];
+        }
+    });
+    parallel_for(E, 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            edges.at((uint32_t)i)->halfedge() = halfedges.at(ehalf[i]);
+        }
+    });
+    parallel_for(fhalf.size(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            faces.at((uint32_t)i)->halfedge() = halfedges.at(fhalf[i]);
+        }
+    });
+    index_elements();
     return {};
 }
 
-bool Halfedge_Mesh::subdivide(SubD strategy) {
+/*
+    Subdivision works on the connectivity as flat index arrays, so that several levels
+    can be applied without building a Halfedge_Mesh for each one. Elements are numbered
+    by their slot in the compacted mesh.
+*/
+struct Subd_Mesh {
+    // Per halfedge
+    std::vector<uint32_t> next, twin, vert, edge, face;
+    // Per vertex, edge and face
+    std::vector<uint32_t> vhalf, ehalf, fhalf;
+    std::vector<unsigned char> boundary;
+    std::vector<Vec3> pos;
+};
+
+/*
+    Subdivides every face once. A vertex of the refined mesh is created for each vertex,
+    then each edge, then (for quad schemes) each inner face. Each old halfedge h becomes
+    two halves, 2h ending at its edge point and 2h + 1 starting there; each inner halfedge
+    also adds the pair 2H + 2k(h) and 2H + 2k(h) + 1 inside its face, where k numbers the
+    inner halfedges. The first new faces are the ones at the end of each inner halfedge,
+    followed by the center faces (Loop only) and the boundary loops.
+*/
+static Subd_Mesh subdivide_once(const Subd_Mesh& m, SubD strategy) {
+
+    const uint32_t npos = std::numeric_limits<uint32_t>::max();
+    uint32_t H = (uint32_t)m.next.size(), V = (uint32_t)m.vhalf.size();
+    uint32_t E = (uint32_t)m.ehalf.size(), F = (uint32_t)m.fhalf.size();
+    bool loop = strategy == SubD::loop;
+
+    std::vector<uint32_t> hk(H), fk(F);
+    uint32_t Hi = 0, Fi = 0, Fb = 0;
+    for(uint32_t f = 0; f < F; f++) fk[f] = m.boundary[f] ? Fb++ : Fi++;
+    for(uint32_t h = 0; h < H; h++) hk[h] = m.boundary[m.face[h]] ? npos : Hi++;
+
+    uint32_t centers = Hi, boundaries = Hi + (loop ? Fi : 0);
+    uint32_t face_points = V + E;
+
+    Subd_Mesh out;
+    out.pos.resize(V + E + (loop ? 0 : Fi));
+    out.next.resize(2 * H + 2 * Hi);
+    out.twin.resize(out.next.size());
+    out.vert.resize(out.next.size());
+    out.edge.resize(out.next.size());
+    out.face.resize(out.next.size());
+    out.vhalf.resize(out.pos.size());
+    out.ehalf.resize(2 * E + Hi);
+    out.fhalf.resize(boundaries + Fb);
+    out.boundary.assign(out.fhalf.size(), 0);
+
+    // Positions. Catmull-Clark and Loop are only applied to closed meshes, so the
+    // boundary cases only matter for linear subdivision.
+    if(!loop) {
+        parallel_for(F, 1024, [&](size_t begin, size_t end) {
+            for(size_t f = begin; f < end; f++) {
+                if(m.boundary[f]) continue;
+                Vec3 c;
+                uint32_t n = 0, h = m.fhalf[f];
+                do {
+                    c += m.pos[m.vert[h]];
+                    n++;
+                    h = m.next[h];
+                } while(h != m.fhalf[f]);
+                out.pos[face_points + fk[f]] = c / (float)n;
+            }
+        });
+    }
+    parallel_for(E, 1024, [&](size_t begin, size_t end) {
+        for(size_t e = begin; e < end; e++) {
+            uint32_t h = m.ehalf[e], t = m.twin[h];
+            Vec3 a = m.pos[m.vert[h]], b = m.pos[m.vert[t]];
+            uint32_t f0 = m.face[h], f1 = m.face[t];
+            Vec3 p = (a + b) / 2.0f;
+            if(strategy != SubD::linear && !m.boundary[f0] && !m.boundary[f1]) {
+                if(loop) {
+                    Vec3 c = m.pos[m.vert[m.next[m.next[h]]]];
+                    Vec3 d = m.pos[m.vert[m.next[m.next[t]]]];
+                    p = (a + b) * 3.0f / 8.0f + (c + d) / 8.0f;
+                } else {
+                    p = (a + b + out.pos[face_points + fk[f0]] + out.pos[face_points + fk[f1]]) /
+                        4.0f;
+                }
+            }
+            out.pos[V + e] = p;
+        }
+    });
+    parallel_for(V, 1024, [&](size_t begin, size_t end) {
+        for(size_t v = begin; v < end; v++) {
+            Vec3 p = m.pos[v];
+            out.pos[v] = p;
+            if(strategy == SubD::linear) continue;
+
+            Vec3 faces, neighbors;
+            uint32_t n = 0, h = m.vhalf[v];
+            bool border = false;
+            do {
+                uint32_t f = m.face[h];
+                border = border || m.boundary[f];
+                if(!loop && !m.boundary[f]) faces += out.pos[face_points + fk[f]];
+                neighbors += m.pos[m.vert[m.twin[h]]];
+                n++;
+                h = m.next[m.twin[h]];
+            } while(h != m.vhalf[v]);
+            if(border) continue;
+
+            float fn = (float)n;
+            if(loop) {
+                float u = n == 3 ? 3.0f / 16.0f : 3.0f / (8.0f * fn);
+                out.pos[v] = (1.0f - fn * u) * p + u * neighbors;
+            } else {
+                // Average of face points, twice the average of edge midpoints, and the rest
+                Vec3 q = faces / fn, r = (neighbors / fn + p) / 2.0f;
+                out.pos[v] = (q + 2.0f * r + (fn - 3.0f) * p) / fn;
+            }
+        }
+    });
+
+    // Connectivity
+    parallel_for(H, 1024, [&](size_t begin, size_t end) {
+        for(uint32_t h = (uint32_t)begin; h < end; h++) {
+            uint32_t t = m.twin[h], e = m.edge[h], n = m.next[h];
+            bool first = m.ehalf[e] == h;
+            uint32_t a = 2 * h, b = 2 * h + 1;
+            out.twin[a] = 2 * t + 1, out.twin[b] = 2 * t;
+            out.edge[a] = first ? 2 * e : 2 * e + 1;
+            out.edge[b] = first ? 2 * e + 1 : 2 * e;
+            out.vert[a] = m.vert[h], out.vert[b] = V + e;
+
+            if(hk[h] == npos) {
+                out.next[a] = b, out.next[b] = 2 * n;
+                out.face[a] = out.face[b] = boundaries + fk[m.face[h]];
+                continue;
+            }
+
+            // x runs from the next edge point back into the face, y from the face out to
+            // this edge point (quads), or between the two edge points (Loop)
+            uint32_t k = hk[h], kn = hk[n];
+            uint32_t x = 2 * H + 2 * k, y = x + 1, yn = 2 * H + 2 * kn + 1;
+            out.next[b] = 2 * n, out.next[2 * n] = x;
+            out.face[b] = out.face[2 * n] = out.face[x] = k;
+            out.vert[x] = V + m.edge[n];
+            out.edge[x] = 2 * E + k;
+            out.ehalf[2 * E + k] = x;
+            out.fhalf[k] = b;
+            if(loop) {
+                out.next[x] = b;
+                out.next[y] = yn;
+                out.face[y] = centers + fk[m.face[h]];
+                out.vert[y] = V + e;
+                out.twin[x] = y, out.twin[y] = x;
+                out.edge[y] = 2 * E + k;
+            } else {
+                out.next[x] = y, out.next[y] = b;
+                out.face[y] = k;
+                out.vert[y] = face_points + fk[m.face[h]];
+                out.twin[x] = yn, out.twin[yn] = x;
+                out.edge[yn] = 2 * E + k;
+            }
+        }
+    });
+
+    parallel_for(V, 1024, [&](size_t begin, size_t end) {
+        for(size_t v = begin; v < end; v++) out.vhalf[v] = 2 * m.vhalf[v];
+    });
+    parallel_for(E, 1024, [&](size_t begin, size_t end) {
+        for(size_t e = begin; e < end; e++) {
+            uint32_t h = m.ehalf[e];
+            out.ehalf[2 * e] = 2 * h, out.ehalf[2 * e + 1] = 2 * h + 1;
+            if(m.boundary[m.face[h]]) h = m.twin[h];
+            out.vhalf[V + e] = 2 * h + 1;
+        }
+    });
+    parallel_for(F, 1024, [&](size_t begin, size_t end) {
+        for(size_t f = begin; f < end; f++) {
+            uint32_t h = m.fhalf[f];
+            if(m.boundary[f]) {
+                out.fhalf[boundaries + fk[f]] = 2 * h;
+                out.boundary[boundaries + fk[f]] = 1;
+            } else if(loop) {
+                out.fhalf[centers + fk[f]] = 2 * H + 2 * hk[h] + 1;
+            } else {
+                out.vhalf[face_points + fk[f]] = 2 * H + 2 * hk[h] + 1;
+            }
+        }
+    });
+    return out;
+}
+
+bool Halfedge_Mesh::subdivide(SubD strategy, unsigned int levels) {
 
-    std::vector<std::vector<Index>> polys;
-    std::vector<Vec3> verts;
-    std::unordered_map<unsigned int, Index> layout;
+    compact();
 
     switch(strategy) {
-    case SubD::linear: {
-        linear_subdivide_positions();
-    } break;
-
+    case SubD::linear: break;
     case SubD::catmullclark: {
         if(has_boundary()) return false;
-        catmullclark_subdivide_positions();
     } break;
-
     case SubD::loop: {
         if(has_boundary()) return false;
         for(FaceRef f = faces_begin(); f != faces_end(); f++) {
             if(f->degree() != 3) return false;
         }
-        loop_subdivide();
-        return true;
     } break;
-
     default: assert(false);
     }
 
-    Index idx = 0;
-    size_t nV = vertices.size();
-    size_t nE = edges.size();
-    size_t nF = faces.size() - n_boundaries();
-    verts.resize(nV + nE + nF);
-
-    for(VertexRef v = vertices_begin(); v != vertices_end(); v++, idx++) {
-        verts[idx] = v->new_pos;
-        layout[v->id()] = idx;
-    }
-    for(EdgeRef e = edges_begin(); e != edges_end(); e++, idx++) {
-        verts[idx] = e->new_pos;
-        layout[e->id()] = idx;
-    }
-    for(FaceRef f = faces_begin(); f != faces_end(); f++) {
-        if(f->is_boundary()) continue;
-        verts[idx] = f->new_pos;
-        layout[f->id()] = idx;
-        idx++;
-    }
+    // After compacting, every slot holds an element
+    Subd_Mesh m;
+    m.next.resize(halfedges.size());
+    m.twin.resize(halfedges.size());
+    m.vert.resize(halfedges.size());
+    m.edge.resize(halfedges.size());
+    m.face.resize(halfedges.size());
+    m.vhalf.resize(vertices.size());
+    m.pos.resize(vertices.size());
+    m.ehalf.resize(edges.size());
+    m.fhalf.resize(faces.size());
+    m.boundary.resize(faces.size());
+    parallel_for(halfedges.size(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            HalfedgeRef h = halfedges.at((uint32_t)i);
+            m.next[i] = h->next().index();
+            m.twin[i] = h->twin().index();
+            m.vert[i] = h->vertex().index();
+            m.edge[i] = h->edge().index();
+            m.face[i] = h->face().index();
+        }
+    });
+    parallel_for(vertices.size(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            VertexRef v = vertices.at((uint32_t)i);
+            m.vhalf[i] = v->halfedge().index();
+            m.pos[i] = v->pos;
+        }
+    });
+    parallel_for(edges.size(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            m.ehalf[i] = edges.at((uint32_t)i)->halfedge().index();
+        }
+    });
+    parallel_for(faces.size(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            FaceRef f = faces.at((uint32_t)i);
+            m.fhalf[i] = f->halfedge().index();
+            m.boundary[i] = f->is_boundary();
+        }
+    });
 
-    for(auto f = faces_begin(); f != faces_end(); f++) {
-        if(f->is_boundary()) continue;
-        Index i = layout[f->id()];
-        HalfedgeRef h = f->halfedge();
-        do {
-            Index j = layout[h->edge()->id()];
-            Index k = layout[h->next()->vertex()->id()];
-            Index l = layout[h->next()->edge()->id()];
-            std::vector<Index> quad = {i, j, k, l};
-            polys.push_back(quad);
-            h = h->next();
-        } while(h != f->halfedge());
+    for(unsigned int l = 0; l < levels; l++) {
+        m = subdivide_once(m, strategy);
     }
 
-    from_poly(polys, verts);
+    // Rebuild the element lists in index order, then link them up
+    clear();
+    for(size_t i = 0; i < m.next.size(); i++) halfedges.insert(Halfedge(next_id++));
+    for(size_t i = 0; i < m.vhalf.size(); i++) vertices.insert(Vertex(next_id++));
+    for(size_t i = 0; i < m.ehalf.size(); i++) edges.insert(Edge(next_id++));
+    for(size_t i = 0; i < m.fhalf.size(); i++) faces.insert(Face(next_id++, m.boundary[i]));
+
+    parallel_for(m.next.size(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            HalfedgeRef h = halfedges.at((uint32_t)i);
+            h->next() = halfedges.at(m.next[i]);
+            h->twin() = halfedges.at(m.twin[i]);
+            h->vertex() = vertices.at(m.vert[i]);
+            h->edge() = edges.at(m.edge[i]);
+            h->face() = faces.at(m.face[i]);
+        }
+    });
+    parallel_for(m.vhalf.size(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            VertexRef v = vertices.at((uint32_t)i);
+            v->halfedge() = halfedges.at(m.vhalf[i]);
+            v->pos = m.pos[i];
+        }
+    });
+    parallel_for(m.ehalf.size(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            edges.at((uint32_t)i)->halfedge() = halfedges.at(m.ehalf[i]);
+        }
+    });
+    parallel_for(m.fhalf.size(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            faces.at((uint32_t)i)->halfedge() = halfedges.at(m.fhalf[i]);
+        }
+    });
+    index_elements();
     return true;
 }
 
@@ -606,7 +1645,7 @@ std::string Halfedge_Mesh::from_poly(const std::vector<std::vector<Index>>& poly
     // is designed to be robust but perhaps not incredibly fast (though of course
     // this does not affect the performance of the resulting data structure).  One
     // could also implement faster initializers that handle important special cases
-    // (e.g., all triangles, or data that is known to be manifold). Since there are
+    // (e.g., all triangles, as from_soup does for polygons of one degree). Since there are
     // no strong conditions on the indices of polygons, we assume that the list of
     // vertex positions is given in lexicographic order (i.e., that the lowest index
     // appearing in any polygon corresponds to the first entry of the list of
@@ -943,5 +1982,6 @@ std::string Halfedge_Mesh::from_poly(const std::vector<std::vector<Index>>& poly
         v->pos = verts[i];
         i++;
     }
+    added.clear();
     return {};
 }
@@ -67,7 +67,8 @@
     data structure.  But it's worth making a few comments about how this
     particular implementation works---especially how things like boundaries
     are handled.  First and foremost, the "pointers" used in this
-    implementation are actually STL iterators.  STL stands for the "standard
+    implementation are actually iterators into a Slot_List (see slot_list.h),
+    which behave just like STL iterators.  STL stands for the "standard
     template library," and is a basic part of C++ that provides some very
     convenient and powerful data structures and algorithms---if you've never
     looked at the STL before, now would be a great time to get familiar!  At
@@ -87,6 +88,9 @@
     without breaking any code that might have been written using the abstract
     interface.  (There are deeper reasons for this kind of encapsulation
     when working with polygon meshes, but that's a story for another time!)
+    This implementation stores each element type in blocks of contiguous slots
+    addressed by 32-bit indices, rather than in linked lists, so that large
+    meshes stay compact in memory and can be traversed quickly.
 
     Finally, some surfaces have "boundary loops," e.g., a pair of pants has
     three boundaries: one at the waist, and two at the ankles.  These boundaries
@@ -127,7 +131,7 @@
 
 #pragma once
 
-#include <list>
+#include <functional>
 #include <optional>
 #include <set>
 #include <string>
@@ -135,6 +139,7 @@
 #include <vector>
 
 #include "../platform/gl.h"
+#include "slot_list.h"
 
 // Types of sub-division
 enum class SubD { linear, catmullclark, loop };
@@ -160,13 +165,13 @@ public:
 
     /*
         Rather than using raw pointers to mesh elements, we store references
-        as STL::iterators---for convenience, we give shorter names to these
-        iterators (e.g., EdgeRef instead of list<Edge>::iterator).
+        as iterators---for convenience, we give shorter names to these
+        iterators (e.g., EdgeRef instead of Slot_List<Edge>::iterator).
     */
-    using VertexRef = std::list<Vertex>::iterator;
-    using EdgeRef = std::list<Edge>::iterator;
-    using FaceRef = std::list<Face>::iterator;
-    using HalfedgeRef = std::list<Halfedge>::iterator;
+    using VertexRef = Slot_List<Vertex>::iterator;
+    using EdgeRef = Slot_List<Edge>::iterator;
+    using FaceRef = Slot_List<Face>::iterator;
+    using HalfedgeRef = Slot_List<Halfedge>::iterator;
 
     /* This is a special kind of reference that can refer to any of the four
        element types. */
@@ -178,10 +183,10 @@ public:
         used so frequently, we will use "CIter" as a shorthand abbreviation for
         "constant iterator."
     */
-    using VertexCRef = std::list<Vertex>::const_iterator;
-    using EdgeCRef = std::list<Edge>::const_iterator;
-    using FaceCRef = std::list<Face>::const_iterator;
-    using HalfedgeCRef = std::list<Halfedge>::const_iterator;
+    using VertexCRef = Slot_List<Vertex>::const_iterator;
+    using EdgeCRef = Slot_List<Edge>::const_iterator;
+    using FaceCRef = Slot_List<Face>::const_iterator;
+    using HalfedgeCRef = Slot_List<Halfedge>::const_iterator;
     using ElementCRef = std::variant<VertexCRef, EdgeCRef, HalfedgeCRef, FaceCRef>;
 
     //////////////////////////////////////////////////////////////////////////////////////////
@@ -195,6 +200,8 @@ public:
     // but you may need to be aware of this when implementing global ops.
     // Specifically, when you need to collapse an edge in iostropic_remesh() or simplify(),
     // you should call collapse_edge_erase() instead of collapse_edge()
+    // Once erased, an element's storage may be reused by the next new element, which
+    // then shows up in the middle of the element lists rather than at the end.
 
     /*
         Merge all faces incident on a given vertex, returning a
@@ -286,40 +293,18 @@ public:
     void triangulate();
 
     /*
-        Compute new vertex positions for a mesh that splits each polygon
-        into quads (by inserting a vertex at the face midpoint and each
-        of the edge midpoints).  The new vertex positions will be stored
-        in the members Vertex::new_pos, Edge::new_pos, and
-        Face::new_pos.  The values of the positions are based on
-        simple linear interpolation, e.g., the edge midpoints and face
-        centroids.
+        Isotropic remeshing: makes the edges close to target_length (by default, the mean
+        edge length) and the triangles close to equilateral, keeping to the original
+        surface, over the given number of iterations.
     */
-    void linear_subdivide_positions();
+    bool isotropic_remesh(float target_length = 0.0f, unsigned int iterations = 6);
 
     /*
-        Compute new vertex positions for a mesh that splits each polygon
-        into quads (by inserting a vertex at the face midpoint and each
-        of the edge midpoints).  The new vertex positions will be stored
-        in the members Vertex::new_pos, Edge::new_pos, and
-        Face::new_pos.  The values of the positions are based on
-        the Catmull-Clark rules for subdivision.
+        Mesh simplification: collapses edges in order of quadric error until at most
+        target_faces faces remain, or until a collapse would move the surface by more
+        than max_error (if nonzero). With neither set, removes three quarters of the faces.
     */
-    void catmullclark_subdivide_positions();
-
-    /*
-        Sub-divide each face based on the Loop subdivision rule
-    */
-    void loop_subdivide();
-
-    /*
-        Isotropic remeshing
-    */
-    bool isotropic_remesh();
-
-    /*
-        Mesh simplification
-    */
-    bool simplify();
+    bool simplify(size_t target_faces = 0, float max_error = 0.0f);
 
     //////////////////////////////////////////////////////////////////////////////////////////
     // End student operations, begin methods students should use
@@ -356,8 +341,6 @@ public:
     private:
         Vertex(unsigned int id) : _id(id) {
         }
-        Vec3 new_pos;
-        bool is_new = false;
         unsigned int _id = 0;
         HalfedgeRef _halfedge;
         friend class Halfedge_Mesh;
@@ -389,8 +372,6 @@ public:
     private:
         Edge(unsigned int id) : _id(id) {
         }
-        Vec3 new_pos;
-        bool is_new = false;
         unsigned int _id = 0;
         HalfedgeRef _halfedge;
         friend class Halfedge_Mesh;
@@ -424,7 +405,6 @@ public:
     private:
         Face(unsigned int id, bool is_boundary) : _id(id), boundary(is_boundary) {
         }
-        Vec3 new_pos;
         unsigned int _id = 0;
         HalfedgeRef _halfedge;
         bool boundary = false;
@@ -534,16 +514,28 @@ public:
         new element. (These methods cannot have const versions, because they modify the mesh!)
     */
     HalfedgeRef new_halfedge() {
-        return halfedges.insert(halfedges.end(), Halfedge(next_id++));
+        HalfedgeRef h = halfedges.insert(Halfedge(next_id++));
+        added.push_back(h);
+        index_element(h);
+        return h;
     }
     VertexRef new_vertex() {
-        return vertices.insert(vertices.end(), Vertex(next_id++));
+        VertexRef v = vertices.insert(Vertex(next_id++));
+        added.push_back(v);
+        index_element(v);
+        return v;
     }
     EdgeRef new_edge() {
-        return edges.insert(edges.end(), Edge(next_id++));
+        EdgeRef e = edges.insert(Edge(next_id++));
+        added.push_back(e);
+        index_element(e);
+        return e;
     }
     FaceRef new_face(bool boundary = false) {
-        return faces.insert(faces.end(), Face(next_id++, boundary));
+        FaceRef f = faces.insert(Face(next_id++, boundary));
+        added.push_back(f);
+        index_element(f);
+        return f;
     }
 
     /*
@@ -635,6 +627,16 @@ public:
     std::optional<std::pair<ElementRef, std::string>> validate();
     std::optional<std::pair<ElementRef, std::string>> warnings();
 
+    /// Like validate(), but only checks the neighborhood of the given elements and of
+    /// every element created or erased since the last validation. Falls back to validate()
+    /// when that history is unknown (e.g. after copying, rebuilding, or do_erase()),
+    /// or always when built with SCOTTY3D_FULL_VALIDATION.
+    std::optional<std::pair<ElementRef, std::string>>
+    validate_local(const std::vector<ElementRef>& touched);
+    /// Like warnings(), but only considers the neighborhood of the given elements.
+    std::optional<std::pair<ElementRef, std::string>>
+    warnings_local(const std::vector<ElementRef>& touched);
+
     //////////////////////////////////////////////////////////////////////////////////////////
     // End methods students should use, begin internal methods - you don't need to use these
     //////////////////////////////////////////////////////////////////////////////////////////
@@ -655,13 +657,19 @@ public:
 
     /// Clear mesh of all elements.
     void clear();
-    /// Creates new sub-divided mesh with provided scheme
-    bool subdivide(SubD strategy);
+    /// Creates new sub-divided mesh with provided scheme, applied the given number of times
+    bool subdivide(SubD strategy, unsigned int levels = 1);
     /// Export to renderable vertex-index mesh. Indexes the mesh.
+    /// Smooth vertex normals are cached until mark_dirty() is called.
     void to_mesh(GL::Mesh& mesh, bool split_faces) const;
     /// Create mesh from polygon list
     std::string from_poly(const std::vector<std::vector<Index>>& polygons,
                           const std::vector<Vec3>& verts);
+    /// Create mesh from a flat index buffer of polygons that all have the given number of
+    /// vertices (e.g. a triangle or quad soup). Indices refer directly into verts, and
+    /// positions that no polygon uses are dropped. Much faster than from_poly on large input.
+    std::string from_soup(const std::vector<GL::Mesh::Index>& indices, unsigned int degree,
+                          const std::vector<Vec3>& verts);
     /// Create mesh from renderable triangle mesh (beware of connectivity, does not de-duplicate
     /// vertices)
     std::string from_mesh(const GL::Mesh& mesh);
@@ -669,7 +677,65 @@ public:
     /// WARNING: erased elements stay in the element lists until do_erase()
     /// or validate() are called
     void do_erase();
+    /// Erases pending elements and packs the element storage, releasing the slots
+    /// of erased elements. Invalidates all element references into this mesh.
+    void compact();
+
+    /// Applies a local operation to each of the given elements in turn, as a single edit:
+    /// elements erased by an earlier step are skipped, and erased elements stay in the
+    /// element lists until the whole batch is validated. Returns the element produced
+    /// by each step that succeeded.
+    std::vector<ElementRef>
+    apply_each(const std::vector<ElementRef>& elems,
+               const std::function<std::optional<ElementRef>(ElementRef)>& op);
 
+    /*
+        A Delta records the part of the mesh touched by an edit, as it was before and
+        after the edit, so that the edit can be undone and redone without copying the
+        whole mesh. Elements are recorded by id, so a delta stays usable after the
+        mesh is compacted or copied.
+    */
+    class Delta {
+        struct Vertex_State {
+            unsigned int id, halfedge;
+            Vec3 pos;
+        };
+        struct Edge_State {
+            unsigned int id, halfedge;
+        };
+        struct Face_State {
+            unsigned int id, halfedge;
+            bool boundary;
+        };
+        struct Halfedge_State {
+            unsigned int id, next, twin, vertex, edge, face;
+        };
+        struct State {
+            std::vector<Vertex_State> vertices;
+            std::vector<Edge_State> edges;
+            std::vector<Face_State> faces;
+            std::vector<Halfedge_State> halfedges;
+        };
+        State before, after;
+
+        // Elements being recorded (with their ids), and the first id the edit may create
+        std::vector<std::pair<ElementRef, unsigned int>> tracked;
+        std::set<unsigned int> tracked_ids;
+        unsigned int first_id = 0;
+        friend class Halfedge_Mesh;
+    };
+
+    /// Starts recording an edit that only changes the faces around the given elements
+    void begin_delta(Delta& delta, const std::vector<ElementRef>& touched);
+    /// Records the edited state, including any new elements. Must be called before the
+    /// edit is validated; may be called again later to pick up further vertex moves.
+    void end_delta(Delta& delta);
+    /// Puts the recorded elements back into their state before/after the edit
+    void undo(const Delta& delta);
+    void redo(const Delta& delta);
+
+    /// Flags the mesh for re-rendering and drops cached vertex normals.
+    /// Call after moving vertices or changing connectivity.
     void mark_dirty();
     bool flipped() const {
         return flip_orientation;
@@ -682,51 +748,67 @@ public:
     Vec3 normal_of(ElementRef elem);
     static Vec3 center_of(ElementRef elem);
     static unsigned int id_of(ElementRef elem);
+    /// The live element with the given id, if any, in constant time
+    std::optional<ElementRef> find_id(unsigned int id);
 
 private:
-    std::list<Vertex> vertices;
-    std::list<Edge> edges;
-    std::list<Face> faces;
-    std::list<Halfedge> halfedges;
+    Slot_List<Vertex> vertices;
+    Slot_List<Edge> edges;
+    Slot_List<Face> faces;
+    Slot_List<Halfedge> halfedges;
+
+    struct Region {
+        std::vector<HalfedgeRef> halfedges;
+        std::vector<VertexRef> vertices;
+        std::vector<EdgeRef> edges;
+        std::vector<FaceRef> faces;
+    };
+    Region region_of(const std::vector<ElementRef>& seeds);
+    void record(const Delta& delta, Delta::State& state);
+    void apply(const Delta::State& from, const Delta::State& to);
+    void update_normals() const;
+    void index_element(ElementRef elem);
+    void index_elements();
+    void relink(const std::vector<uint32_t>* hmap, const std::vector<uint32_t>* vmap,
+                const std::vector<uint32_t>* emap, const std::vector<uint32_t>* fmap);
+
+    // In-place edge collapses shared by simplify() and isotropic_remesh(), see
+    // student/meshedit.cpp
+    struct Collapse_Scratch {
+        std::vector<uint32_t> marks;
+        uint32_t stamp = 0;
+        std::vector<HalfedgeRef> ring;
+        std::vector<uint32_t> erased_edges;
+    };
+    bool can_collapse(EdgeRef e, Vec3 pos, Collapse_Scratch& scratch);
+    int collapse_in_place(EdgeRef e, Vec3 pos, Collapse_Scratch& scratch);
 
     unsigned int next_id;
     bool flip_orientation = false;
 
+    // Area-weighted vertex normals, indexed by vertex slot
+    mutable std::vector<Vec3> vertex_normals;
+    mutable bool normals_dirty = true;
+
+    // The slot of each element by id, and which ElementRef alternative it is. Elements
+    // are indexed as they are created; entries for elements erased without do_erase()
+    // are left behind, so find_id() checks that the slot still holds the element.
+    struct Id_Entry {
+        uint32_t slot = Slot_List<Vertex>::npos;
+        uint32_t kind = 0;
+    };
+    std::vector<Id_Entry> id_index;
+
     std::set<VertexRef> verased;
     std::set<EdgeRef> eerased;
     std::set<FaceRef> ferased;
     std::set<HalfedgeRef> herased;
-};
 
-/*
-    Some algorithms need to know how to compare two iterators (std::map)
-    Here we just say that one iterator comes before another if the address of the
-    object it points to is smaller. (You should not have to worry about this!)
-*/
-inline bool operator<(const Halfedge_Mesh::HalfedgeRef& i, const Halfedge_Mesh::HalfedgeRef& j) {
-    return &*i < &*j;
-}
-inline bool operator<(const Halfedge_Mesh::VertexRef& i, const Halfedge_Mesh::VertexRef& j) {
-    return &*i < &*j;
-}
-inline bool operator<(const Halfedge_Mesh::EdgeRef& i, const Halfedge_Mesh::EdgeRef& j) {
-    return &*i < &*j;
-}
-inline bool operator<(const Halfedge_Mesh::FaceRef& i, const Halfedge_Mesh::FaceRef& j) {
-    return &*i < &*j;
-}
-inline bool operator<(const Halfedge_Mesh::HalfedgeCRef& i, const Halfedge_Mesh::HalfedgeCRef& j) {
-    return &*i < &*j;
-}
-inline bool operator<(const Halfedge_Mesh::VertexCRef& i, const Halfedge_Mesh::VertexCRef& j) {
-    return &*i < &*j;
-}
-inline bool operator<(const Halfedge_Mesh::EdgeCRef& i, const Halfedge_Mesh::EdgeCRef& j) {
-    return &*i < &*j;
-}
-inline bool operator<(const Halfedge_Mesh::FaceCRef& i, const Halfedge_Mesh::FaceCRef& j) {
-    return &*i < &*j;
-}
+    // Elements created since the last validation. unchecked is set whenever local
+    // validation can't tell what changed.
+    std::vector<ElementRef> added;
+    bool unchecked = true;
+};
 
 /*
     Some algorithms need to know how to hash references (std::unordered_map)
@@ -0,0 +1,218 @@
+
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+/*
+    Slot_List is the element storage used by Halfedge_Mesh. It stands in for
+    std::list, but keeps elements in fixed-size blocks of contiguous slots that
+    are addressed by a 32-bit index.
+
+    - Elements never move once inserted: blocks are allocated whole and never
+      reallocated, so references and pointers to elements stay valid across
+      insertions, just like with std::list.
+    - Erasing marks a slot dead and pushes it on a free list; the next insert
+      reuses it. Iteration skips dead slots.
+    - compact() moves all live elements to the front and reports the new index
+      of each old slot, so the owner can patch up any stored iterators.
+    - The slots live in a separately allocated Storage object, so moving a
+      Slot_List (e.g. moving a whole mesh) does not invalidate iterators.
+*/
+template<typename T> class Slot_List {
+
+    static constexpr uint32_t block_bits = 8;
+    static constexpr uint32_t block_size = 1u << block_bits;
+
+    struct Storage {
+        T& get(uint32_t idx) {
+            return blocks[idx >> block_bits][idx & (block_size - 1)];
+        }
+        uint32_t next_live(uint32_t idx) const {
+            uint32_t n = (uint32_t)live.size();
+            while(idx < n && !live[idx]) idx++;
+            return idx < n ? idx : npos;
+        }
+        std::vector<std::vector<T>> blocks;
+        std::vector<unsigned char> live;
+        std::vector<uint32_t> free;
+        size_t n_live = 0;
+    };
+
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    template<bool Const> class Iter {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const T*, T*>;
+        using reference = std::conditional_t<Const, const T&, T&>;
+
+        Iter() = default;
+        template<bool C = Const, typename = std::enable_if_t<C>>
+        Iter(const Iter<false>& it) : store(it.store), idx(it.idx) {
+        }
+
+        reference operator*() const {
+            return store->get(idx);
+        }
+        pointer operator->() const {
+            return &store->get(idx);
+        }
+        Iter& operator++() {
+            idx = store->next_live(idx + 1);
+            return *this;
+        }
+        Iter operator++(int) {
+            Iter ret = *this;
+            ++*this;
+            return ret;
+        }
+
+        // Slot index of the referenced element; stable until the list is compacted
+        uint32_t index() const {
+            return idx;
+        }
+
+        friend bool operator==(const Iter& a, const Iter& b) {
+            return a.store == b.store && a.idx == b.idx;
+        }
+        friend bool operator!=(const Iter& a, const Iter& b) {
+            return !(a == b);
+        }
+        friend bool operator<(const Iter& a, const Iter& b) {
+            return a.idx < b.idx;
+        }
+
+    private:
+        Iter(Storage* store, uint32_t idx) : store(store), idx(idx) {
+        }
+        Storage* store = nullptr;
+        uint32_t idx = npos;
+        friend class Slot_List;
+        friend class Iter<!Const>;
+    };
+
+    using iterator = Iter<false>;
+    using const_iterator = Iter<true>;
+
+    Slot_List() : store(std::make_unique<Storage>()) {
+    }
+    Slot_List(Slot_List&& src) : store(std::move(src.store)) {
+        src.store = std::make_unique<Storage>();
+    }
+    Slot_List& operator=(Slot_List&& src) {
+        std::swap(store, src.store);
+        src.clear();
+        return *this;
+    }
+    Slot_List(const Slot_List& src) = delete;
+    Slot_List& operator=(const Slot_List& src) = delete;
+
+    iterator insert(T value) {
+        uint32_t idx;
+        if(!store->free.empty()) {
+            idx = store->free.back();
+            store->free.pop_back();
+            store->get(idx) = std::move(value);
+            store->live[idx] = 1;
+        } else {
+            idx = (uint32_t)store->live.size();
+            if((idx & (block_size - 1)) == 0) {
+                store->blocks.emplace_back();
+                store->blocks.back().reserve(block_size);
+            }
+            store->blocks.back().push_back(std::move(value));
+            store->live.push_back(1);
+        }
+        store->n_live++;
+        return iterator(store.get(), idx);
+    }
+    void erase(const_iterator it) {
+        if(!store->live[it.idx]) return;
+        store->live[it.idx] = 0;
+        store->free.push_back(it.idx);
+        store->n_live--;
+    }
+    void clear() {
+        *store = Storage();
+    }
+
+    // Moves live elements into the lowest slots, preserving their order, and
+    // fills remap[old index] with the new index (npos for dead slots).
+    void compact(std::vector<uint32_t>& remap) {
+        uint32_t n = (uint32_t)store->live.size();
+        remap.assign(n, npos);
+
+        Storage out;
+        out.live.assign(store->n_live, 1);
+        out.n_live = store->n_live;
+        uint32_t next = 0;
+        for(uint32_t i = 0; i < n; i++) {
+            if(!store->live[i]) continue;
+            if((next & (block_size - 1)) == 0) {
+                out.blocks.emplace_back();
+                out.blocks.back().reserve(block_size);
+            }
+            out.blocks.back().push_back(std::move(store->get(i)));
+            remap[i] = next++;
+        }
+        *store = std::move(out);
+    }
+
+    // Replaces the contents with a slot-for-slot copy of src, including dead
+    // slots and the free list, so indices are preserved.
+    void copy_from(const Slot_List& src) {
+        clear();
+        store->blocks.resize(src.store->blocks.size());
+        for(size_t i = 0; i < store->blocks.size(); i++) {
+            store->blocks[i].reserve(block_size);
+            store->blocks[i] = src.store->blocks[i];
+        }
+        store->live = src.store->live;
+        store->free = src.store->free;
+        store->n_live = src.store->n_live;
+    }
+
+    iterator at(uint32_t idx) {
+        return iterator(store.get(), idx);
+    }
+    const_iterator at(uint32_t idx) const {
+        return const_iterator(store.get(), idx);
+    }
+
+    iterator begin() {
+        return iterator(store.get(), store->next_live(0));
+    }
+    const_iterator begin() const {
+        return const_iterator(store.get(), store->next_live(0));
+    }
+    iterator end() {
+        return iterator(store.get(), npos);
+    }
+    const_iterator end() const {
+        return const_iterator(store.get(), npos);
+    }
+
+    bool contains(const_iterator it) const {
+        return it.store == store.get() && it.idx < store->live.size() && store->live[it.idx];
+    }
+
+    size_t size() const {
+        return store->n_live;
+    }
+    size_t n_slots() const {
+        return store->live.size();
+    }
+    bool empty() const {
+        return store->n_live == 0;
+    }
+
+private:
+    std::unique_ptr<Storage> store;
+};
@@ -4,12 +4,53 @@
 #include "../lib/mathlib.h"
 #include <map>
 #include <set>
+#include <vector>
+
+// Values of a spline at each integer frame, filled in by Spline::bake so that at() can
+// return them without searching the knots. The spline clears them when its knots change.
+template<typename T> class Spline_Frames {
+public:
+    bool get(float time, T& value) const {
+        if(!(time >= 0.0f && time < (float)values.size())) return false;
+        size_t frame = (size_t)time;
+        if((float)frame != time) return false;
+        value = values[frame];
+        return true;
+    }
+    template<typename F> void fill(size_t frames, F&& eval_many) {
+        if(values.size() == frames) return;
+        std::vector<float> times(frames);
+        for(size_t f = 0; f < frames; f++) times[f] = (float)f;
+        std::vector<T> next;
+        eval_many(times, next);
+        values = std::move(next);
+    }
+    void clear() {
+        values.clear();
+    }
+
+private:
+    std::vector<T> values;
+};
 
 template<typename T> class Spline {
 public:
     // Returns the interpolated value.
     T at(float time) const;
 
+    // Stores at(times[i]) in out[i] for every i. Ascending times are cheapest: they are
+    // matched to their knots in a single pass, and each segment's tangents are computed
+    // once for all the times that fall inside it.
+    void at_many(const std::vector<float>& times, std::vector<T>& out) const;
+
+    // Evaluates the spline at every integer frame in [0, frames), so that later calls to
+    // at() with those times are table lookups. Changing the knots discards the table.
+    void bake(size_t frames) const {
+        baked.fill(frames, [this](const std::vector<float>& t, std::vector<T>& v) {
+            at_many(t, v);
+        });
+    }
+
     // Purely for convenience, returns the exact same
     // value as at()---simply lets one evaluate a spline
     // f as though it were a function f(t) (which it is!)
@@ -21,11 +62,13 @@ public:
     // creating a new knot at this time if necessary.
     void set(float time, T value) {
         control_points[time] = value;
+        baked.clear();
     }
 
     // Removes the knot closest to the given time
     void erase(float time) {
         control_points.erase(time);
+        baked.clear();
     }
 
     // Checks if time t is a control point
@@ -41,12 +84,14 @@ public:
     // Removes all control points
     void clear() {
         control_points.clear();
+        baked.clear();
     }
 
     // Removes control points after t
     void crop(float t) {
         auto e = control_points.lower_bound(t);
         control_points.erase(e, control_points.end());
+        baked.clear();
     }
 
     // Returns set of keys
@@ -58,12 +103,25 @@ public:
 
 private:
     std::map<float, T> control_points;
+    mutable Spline_Frames<T> baked;
 
     // Given a time between 0 and 1, evaluates a cubic polynomial with
     // the given endpoint and tangent values at the beginning (0) and
     // end (1) of the interval
     static T cubic_unit_spline(float time, const T& position0, const T& position1,
                                const T& tangent0, const T& tangent1);
+
+    // The weights of position0, tangent0, position1 and tangent1 in cubic_unit_spline
+    static void hermite_basis(float time, float& h00, float& h10, float& h01, float& h11);
+
+    // The knots k1 and k2 bounding an interval, and the tangents there
+    struct Segment {
+        float start = 0.0f, length = 0.0f;
+        T position0, position1, tangent0, tangent1;
+    };
+
+    // Sets up the interval that ends at knot k2, which must not be the first knot
+    Segment segment(typename std::map<float, T>::const_iterator k2) const;
 };
 
 template<typename T, typename... Ts> class Splines {
@@ -90,6 +148,10 @@ public:
         head.crop(t);
         tail.crop(t);
     }
+    void bake(size_t frames) const {
+        head.bake(frames);
+        tail.bake(frames);
+    }
     std::set<float> keys() const {
         auto first = head.keys();
         auto rest = tail.keys();
@@ -99,6 +161,11 @@ public:
     std::tuple<T, Ts...> at(float t) const {
         return std::tuple_cat(std::make_tuple(head.at(t)), tail.at(t));
     }
+    void at_many(const std::vector<float>& times, std::vector<T>& out,
+                 std::vector<Ts>&... rest) const {
+        head.at_many(times, out);
+        tail.at_many(times, rest...);
+    }
 
 private:
     Spline<T> head;
@@ -122,6 +189,9 @@ public:
     void crop(float t) {
         head.crop(t);
     }
+    void bake(size_t frames) const {
+        head.bake(frames);
+    }
     void clear() {
         head.clear();
     }
@@ -131,6 +201,9 @@ public:
     std::tuple<T> at(float t) const {
         return std::make_tuple(head.at(t));
     }
+    void at_many(const std::vector<float>& times, std::vector<T>& out) const {
+        head.at_many(times, out);
+    }
 
 private:
     Spline<T> head;
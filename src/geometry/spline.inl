@@ -4,6 +4,8 @@
 template<> class Spline<Quat> {
 public:
     Quat at(float time) const {
+        Quat value;
+        if(baked.get(time, value)) return value;
         if(values.empty()) return Quat();
         if(values.size() == 1) return values.begin()->second;
         if(values.begin()->first > time) return values.begin()->second;
@@ -16,11 +18,41 @@ public:
     Quat operator()(float time) const {
         return at(time);
     }
+    void at_many(const std::vector<float>& times, std::vector<Quat>& out) const {
+        out.resize(times.size());
+        auto k2 = values.begin();
+        for(size_t i = 0; i < times.size(); i++) {
+            float time = times[i];
+            if(values.size() < 2 || time < values.begin()->first) {
+                out[i] = at(time);
+                continue;
+            }
+            // Keep prev(k2) <= time < k2, searching again only when times go backwards
+            if(k2 != values.begin() && std::prev(k2)->first > time) {
+                k2 = values.upper_bound(time);
+            }
+            while(k2 != values.end() && k2->first <= time) k2++;
+            if(k2 == values.end()) {
+                out[i] = std::prev(values.end())->second;
+                continue;
+            }
+            auto k1 = std::prev(k2);
+            float t = (time - k1->first) / (k2->first - k1->first);
+            out[i] = slerp(k1->second, k2->second, t);
+        }
+    }
+    void bake(size_t frames) const {
+        baked.fill(frames, [this](const std::vector<float>& t, std::vector<Quat>& v) {
+            at_many(t, v);
+        });
+    }
     void set(float time, Quat value) {
         values[time] = value;
+        baked.clear();
     }
     void erase(float time) {
         values.erase(time);
+        baked.clear();
     }
     std::set<float> keys() const {
         std::set<float> ret;
@@ -35,19 +67,24 @@ public:
     }
     void clear() {
         values.clear();
+        baked.clear();
     }
     void crop(float t) {
         auto e = values.lower_bound(t);
         values.erase(e, values.end());
+        baked.clear();
     }
 
 private:
     std::map<float, Quat> values;
+    mutable Spline_Frames<Quat> baked;
 };
 
 template<> class Spline<bool> {
 public:
     bool at(float time) const {
+        bool value = false;
+        if(baked.get(time, value)) return value;
         if(values.empty()) return false;
         if(values.size() == 1) return values.begin()->second;
         if(values.begin()->first > time) return values.begin()->second;
@@ -59,11 +96,39 @@ public:
     bool operator()(float time) const {
         return at(time);
     }
+    void at_many(const std::vector<float>& times, std::vector<bool>& out) const {
+        out.resize(times.size());
+        auto k2 = values.begin();
+        for(size_t i = 0; i < times.size(); i++) {
+            float time = times[i];
+            if(values.size() < 2 || time < values.begin()->first) {
+                out[i] = at(time);
+                continue;
+            }
+            // Keep prev(k2) <= time < k2, searching again only when times go backwards
+            if(k2 != values.begin() && std::prev(k2)->first > time) {
+                k2 = values.upper_bound(time);
+            }
+            while(k2 != values.end() && k2->first <= time) k2++;
+            if(k2 == values.end()) {
+                out[i] = std::prev(values.end())->second;
+                continue;
+            }
+            out[i] = std::prev(k2)->second;
+        }
+    }
+    void bake(size_t frames) const {
+        baked.fill(frames, [this](const std::vector<float>& t, std::vector<bool>& v) {
+            at_many(t, v);
+        });
+    }
     void set(float time, bool value) {
         values[time] = value;
+        baked.clear();
     }
     void erase(float time) {
         values.erase(time);
+        baked.clear();
     }
     std::set<float> keys() const {
         std::set<float> ret;
@@ -78,12 +143,15 @@ public:
     }
     void clear() {
         values.clear();
+        baked.clear();
     }
     void crop(float t) {
         auto e = values.lower_bound(t);
         values.erase(e, values.end());
+        baked.clear();
     }
 
 private:
     std::map<float, bool> values;
+    mutable Spline_Frames<bool> baked;
 };
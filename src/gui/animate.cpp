@@ -136,14 +136,16 @@ void Animate::make_spline(Scene_ID id, const Anim_Pose& pose) {
     GL::Lines& lines = entry->second;
     lines.clear();
 
-    Vec3 prev = pose.at(0.0f).pos;
-    for(int i = 1; i < max_frame; i++) {
+    std::vector<float> times(std::max(max_frame, 1));
+    for(size_t i = 0; i < times.size(); i++) times[i] = (float)i;
 
-        float f = (float)i;
+    std::vector<Vec3> pos, scale;
+    std::vector<Quat> rot;
+    pose.splines.at_many(times, pos, rot, scale);
+
+    for(size_t i = 1; i < times.size(); i++) {
         float c = (float)(i % 20) / 19.0f;
-        Vec3 cur = pose.at(f).pos;
-        lines.add(prev, cur, Vec3{c, c, 1.0f});
-        prev = cur;
+        lines.add(pos[i - 1], pos[i], Vec3{c, c, 1.0f});
     }
 }
 
@@ -157,13 +159,17 @@ void Animate::camera_spline() {
     GL::Lines& lines = entry->second;
     lines.clear();
 
-    Vec3 prev = anim_camera.at(0.0f).pos();
-    for(int i = 1; i < max_frame; i++) {
-        float f = (float)i;
+    std::vector<float> times(std::max(max_frame, 1));
+    for(size_t i = 0; i < times.size(); i++) times[i] = (float)i;
+
+    std::vector<Vec3> pos;
+    std::vector<Quat> rot;
+    std::vector<float> fov, ar, ap, dist;
+    anim_camera.splines.at_many(times, pos, rot, fov, ar, ap, dist);
+
+    for(size_t i = 1; i < times.size(); i++) {
         float c = (float)(i % 20) / 19.0f;
-        Vec3 cur = anim_camera.at(f).pos();
-        lines.add(prev, cur, Vec3{c, c, 1.0f});
-        prev = cur;
+        lines.add(pos[i - 1], pos[i], Vec3{c, c, 1.0f});
     }
 }
 
@@ -672,15 +678,62 @@ void Animate::timeline(Manager& manager, Undo& undo, Scene& scene, Scene_Maybe o
 }
 
 void Animate::step_sim(Scene& scene) {
-    simulate.step(scene, 1.0f / frame_rate);
+
+    if(!scene.has_particles()) return;
+
+    int frame = current_frame;
+    float dt = 1.0f / frame_rate;
+
+    std::string err = simulate.open_cache(scene, dt);
+    if(!err.empty()) warn("%s", err.c_str());
+
+    if(simulate.load_frame(scene, frame)) return;
+
+    // Resume from the previous frame if that's what the particles hold, else from the
+    // latest cached frame, else from scratch
+    int from = simulate.frame() == frame - 1 ? frame - 1 : simulate.cached_before(frame);
+    if(from < 0 || !simulate.load_frame(scene, from)) {
+        simulate.clear_particles(scene);
+        from = -1;
+    }
+
+    for(int f = from + 1; f <= frame; f++) {
+        if(f < frame || from + 1 < frame) set_time(scene, (float)f);
+        simulate.step(scene, dt);
+        err = simulate.save_frame(scene, f);
+        if(!err.empty()) warn("%s", err.c_str());
+    }
+}
+
+void Animate::bake_sim(Scene& scene) {
+    int frame = current_frame;
+    set_time(scene, (float)(max_frame - 1));
+    step_sim(scene);
+    set_time(scene, (float)frame);
+    step_sim(scene);
+}
+
+bool Animate::show_baked(Scene& scene) {
+    return simulate.load_frame(scene, current_frame);
+}
+
+void Animate::set_sim_cache(std::string file) {
+    simulate.set_cache_file(std::move(file));
 }
 
 Camera Animate::set_time(Scene& scene, float time) {
 
     current_frame = (int)time;
 
-    scene.for_items([time](Scene_Item& item) { item.set_time(time); });
+    // Baking only evaluates the channels whose keys changed since the last call; after
+    // that, every channel at a whole frame is a table lookup
+    size_t frames = (size_t)max_frame;
+    scene.for_items([time, frames](Scene_Item& item) {
+        item.bake(frames);
+        item.set_time(time);
+    });
 
+    anim_camera.splines.bake(frames);
     Camera cam = anim_camera.at(time);
     if(anim_camera.splines.any()) {
         ui_camera.load(cam);
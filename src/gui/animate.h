@@ -48,7 +48,14 @@ public:
     void update(Scene& scene);
     void refresh(Scene& scene);
     void load_cam(Vec3 pos, Vec3 front, float ar, float fov, float ap, float dist);
+
+    // Brings the particle simulation to the current frame, loading it from the bake cache
+    // if possible and otherwise simulating (and caching) forward from the latest earlier
+    // frame that is cached. bake_sim caches every frame of the animation.
     void step_sim(Scene& scene);
+    void bake_sim(Scene& scene);
+    bool show_baked(Scene& scene);
+    void set_sim_cache(std::string file);
 
     std::string pump_output(Scene& scene);
     Camera set_time(Scene& scene, float time);
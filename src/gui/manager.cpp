@@ -241,6 +241,10 @@ void Manager::particles_edit_gui(Undo& undo, Scene_Particles& particles) {
     activate();
     ImGui::Checkbox("Enabled", &opt.enabled);
     activate();
+    ImGui::Checkbox("Trace As Spheres", &opt.spheres);
+    activate();
+    ImGui::Checkbox("Collide Particles", &opt.collisions);
+    activate();
 
     if(ImGui::Button("Clear")) {
         particles.clear();
@@ -1206,7 +1210,14 @@ void Manager::render_3d(Scene& scene, Undo& undo, Camera& camera) {
     if(mode == Mode::layout || mode == Mode::render || mode == Mode::animate ||
        mode == Mode::simulate) {
 
-        simulate.update(scene, undo);
+        simulate.update_bvh(scene, undo);
+
+        // Animate mode holds the particles at the current frame when it has been baked
+        if(mode == Mode::animate && animate.show_baked(scene)) {
+            simulate.update_time();
+        } else {
+            simulate.update(scene, undo);
+        }
 
         scene.for_items([&, this](Scene_Item& item) {
             bool render = item.id() != layout.selected();
@@ -19,9 +19,9 @@ Model::Model()
 
 void Model::begin_transform() {
 
-    my_mesh->copy_to(old_mesh);
-
     auto elem = *selected_element();
+    my_mesh->begin_delta(edit, {elem});
+
     trans_begin = {};
     std::visit(overloaded{[&](Halfedge_Mesh::VertexRef vert) {
                               trans_begin.verts = {vert->pos};
@@ -206,9 +206,16 @@ std::optional<Halfedge_Mesh::ElementRef> Model::selected_element() {
     if(!my_mesh) return std::nullopt;
     if(my_mesh->render_dirty_flag) rebuild();
 
-    auto entry = id_to_info.find(selected_elem_id);
-    if(entry == id_to_info.end()) return std::nullopt;
-    return entry->second.ref;
+    // Boundary faces and halfedges are never drawn, so they can't stay selected
+    auto elem = my_mesh->find_id(selected_elem_id);
+    if(!elem.has_value()) return std::nullopt;
+    bool boundary = std::visit(
+        overloaded{[](Halfedge_Mesh::FaceRef face) { return face->is_boundary(); },
+                   [](Halfedge_Mesh::HalfedgeRef halfedge) { return halfedge->is_boundary(); },
+                   [](auto) { return false; }},
+        *elem);
+    if(boundary) return std::nullopt;
+    return elem;
 }
 
 void Model::unset_mesh() {
@@ -407,8 +414,6 @@ void Model::rebuild() {
         halfedge_viz(h, transform);
         id_to_info[h->id()] = {h, arrows.add(transform, h->id())};
     }
-
-    validate();
 }
 
 bool Model::begin_bevel(std::string& err) {
@@ -416,7 +421,7 @@ bool Model::begin_bevel(std::string& err) {
     auto sel = selected_element();
     if(!sel.has_value()) return false;
 
-    my_mesh->copy_to(old_mesh);
+    my_mesh->begin_delta(edit, {*sel});
 
     auto new_face = std::visit(overloaded{[&](Halfedge_Mesh::VertexRef vert) {
                               beveling = Bevel::vert;
@@ -435,11 +440,13 @@ bool Model::begin_bevel(std::string& err) {
 
     if(!new_face.has_value()) return false;
     Halfedge_Mesh::FaceRef face = new_face.value();
+    my_mesh->end_delta(edit);
 
-    err = validate();
+    std::vector<Halfedge_Mesh::ElementRef> touched = {*sel, face};
+    err = validate(&touched);
     if(!err.empty()) {
 
-        *my_mesh = std::move(old_mesh);
+        my_mesh->undo(edit);
         return false;
 
     } else {
@@ -506,21 +513,24 @@ bool Model::keydown(Widgets& widgets, SDL_Keysym key, Camera& cam) {
 }
 
 template<typename T>
-std::string Model::update_mesh(Undo& undo, Scene_Object& obj, Halfedge_Mesh&& before,
-                               Halfedge_Mesh::ElementRef ref, T&& op) {
+std::string Model::update_mesh(Undo& undo, Scene_Object& obj, Halfedge_Mesh::ElementRef ref,
+                               T&& op) {
 
-    unsigned int id = Halfedge_Mesh::id_of(ref);
+    my_mesh->begin_delta(edit, {ref});
     std::optional<Halfedge_Mesh::ElementRef> new_ref = op(*my_mesh, ref);
     if(!new_ref.has_value()) return {};
+    my_mesh->end_delta(edit);
 
-    auto err = validate();
+    std::vector<Halfedge_Mesh::ElementRef> touched = {ref, *new_ref};
+    auto err = validate(&touched);
     if(!err.empty()) {
-        obj.take_mesh(std::move(before));
+        my_mesh->undo(edit);
+        obj.set_mesh_dirty();
     } else {
         my_mesh->render_dirty_flag = true;
         obj.set_mesh_dirty();
         set_selected(*new_ref);
-        undo.update_mesh(obj.id(), std::move(before), id, std::move(op));
+        undo.update_mesh(obj.id(), std::move(edit));
     }
 
     return err;
@@ -530,6 +540,8 @@ template<typename T>
 std::string Model::update_mesh_global(Undo& undo, Scene_Object& obj, Halfedge_Mesh&& before,
                                       T&& op) {
 
+    // Start from packed storage so elements created by the op are appended in order
+    my_mesh->compact();
     bool suc = op(*my_mesh);
     if(!suc) return {};
 
@@ -546,9 +558,53 @@ std::string Model::update_mesh_global(Undo& undo, Scene_Object& obj, Halfedge_Me
     return err;
 }
 
-std::string Model::validate() {
+template<typename T>
+std::string Model::update_mesh_batch(Undo& undo, Scene_Object& obj,
+                                     const std::vector<Halfedge_Mesh::ElementRef>& refs, T&& op) {
+
+    if(refs.empty()) return {};
+
+    // The whole batch is one edit: one delta, one validation and one undo step
+    my_mesh->begin_delta(edit, refs);
+    std::vector<Halfedge_Mesh::ElementRef> touched = my_mesh->apply_each(
+        refs, [&](Halfedge_Mesh::ElementRef ref) -> std::optional<Halfedge_Mesh::ElementRef> {
+            return op(*my_mesh, ref);
+        });
+    if(touched.empty()) return {};
+    my_mesh->end_delta(edit);
+
+    auto err = validate(&touched);
+    if(!err.empty()) {
+        my_mesh->undo(edit);
+        obj.set_mesh_dirty();
+    } else {
+        my_mesh->render_dirty_flag = true;
+        obj.set_mesh_dirty();
+        undo.update_mesh(obj.id(), std::move(edit));
+    }
+
+    return err;
+}
+
+std::vector<Halfedge_Mesh::ElementRef> Model::edges_by_length(float ratio, bool longer) {
 
-    auto valid = my_mesh->validate();
+    float mean = 0.0f;
+    for(auto e = my_mesh->edges_begin(); e != my_mesh->edges_end(); e++) {
+        mean += e->length();
+    }
+    mean /= std::max(my_mesh->n_edges(), size_t{1});
+
+    std::vector<Halfedge_Mesh::ElementRef> edges;
+    for(auto e = my_mesh->edges_begin(); e != my_mesh->edges_end(); e++) {
+        float l = e->length();
+        if(longer ? l > ratio * mean : l < ratio * mean) edges.push_back(e);
+    }
+    return edges;
+}
+
+std::string Model::validate(const std::vector<Halfedge_Mesh::ElementRef>* touched) {
+
+    auto valid = touched ? my_mesh->validate_local(*touched) : my_mesh->validate();
     if(valid.has_value()) {
         auto& msg = valid.value();
         err_id = Halfedge_Mesh::id_of(msg.first);
@@ -556,7 +612,7 @@ std::string Model::validate() {
         return msg.second;
     }
 
-    auto warn = my_mesh->warnings();
+    auto warn = touched ? my_mesh->warnings_local(*touched) : my_mesh->warnings();
     if(warn.has_value()) {
         auto& msg = warn.value();
         warn_id = Halfedge_Mesh::id_of(msg.first);
@@ -610,6 +666,7 @@ std::optional<std::reference_wrapper<Scene_Object>> Model::set_my_obj(Scene_Mayb
         err_id = 0;
         warn_id = 0;
         rebuild();
+        validate();
     } else if(old->render_dirty_flag) {
         rebuild();
     }
@@ -636,19 +693,23 @@ std::string Model::UIsidebar(Undo& undo, Widgets& widgets, Scene_Maybe obj_opt,
     ImGui::Text("Global Operations");
     if(ImGui::Button("Linear")) {
         mesh.copy_to(before);
-        return update_mesh_global(undo, obj, std::move(before),
-                                  [](Halfedge_Mesh& m) { return m.subdivide(SubD::linear); });
+        return update_mesh_global(undo, obj, std::move(before), [&](Halfedge_Mesh& m) {
+            return m.subdivide(SubD::linear, (unsigned int)subdivide_levels);
+        });
     }
     if(Manager::wrap_button("Catmull-Clark")) {
         mesh.copy_to(before);
-        return update_mesh_global(undo, obj, std::move(before),
-                                  [](Halfedge_Mesh& m) { return m.subdivide(SubD::catmullclark); });
+        return update_mesh_global(undo, obj, std::move(before), [&](Halfedge_Mesh& m) {
+            return m.subdivide(SubD::catmullclark, (unsigned int)subdivide_levels);
+        });
     }
     if(Manager::wrap_button("Loop")) {
         mesh.copy_to(before);
-        return update_mesh_global(undo, obj, std::move(before),
-                                  [](Halfedge_Mesh& m) { return m.subdivide(SubD::loop); });
+        return update_mesh_global(undo, obj, std::move(before), [&](Halfedge_Mesh& m) {
+            return m.subdivide(SubD::loop, (unsigned int)subdivide_levels);
+        });
     }
+    ImGui::SliderInt("Levels", &subdivide_levels, 1, 6);
     if(ImGui::Button("Triangulate")) {
         mesh.copy_to(before);
         return update_mesh_global(undo, obj, std::move(before), [](Halfedge_Mesh& m) {
@@ -658,14 +719,45 @@ std::string Model::UIsidebar(Undo& undo, Widgets& widgets, Scene_Maybe obj_opt,
     }
     if(Manager::wrap_button("Remesh")) {
         mesh.copy_to(before);
-        return update_mesh_global(undo, obj, std::move(before),
-                                  [](Halfedge_Mesh& m) { return m.isotropic_remesh(); });
+        return update_mesh_global(undo, obj, std::move(before), [&](Halfedge_Mesh& m) {
+            return m.isotropic_remesh(remesh_length, (unsigned int)remesh_iterations);
+        });
     }
+    ImGui::DragFloat("Edge Length", &remesh_length, 0.001f, 0.0f,
+                     std::numeric_limits<float>::max(), "%.4f");
+    ImGui::SliderInt("Iterations", &remesh_iterations, 1, 20);
     if(Manager::wrap_button("Simplify")) {
         mesh.copy_to(before);
-        return update_mesh_global(undo, obj, std::move(before),
-                                  [](Halfedge_Mesh& m) { return m.simplify(); });
+        size_t target = std::max((size_t)(simplify_ratio * mesh.n_faces()), size_t{1});
+        return update_mesh_global(undo, obj, std::move(before), [&](Halfedge_Mesh& m) {
+            return m.simplify(target, simplify_error);
+        });
     }
+    ImGui::SliderFloat("Keep Faces", &simplify_ratio, 0.01f, 1.0f, "%.2f");
+    ImGui::DragFloat("Max Error", &simplify_error, 0.001f, 0.0f,
+                     std::numeric_limits<float>::max(), "%.4f");
+
+    ImGui::Text("Batch Operations");
+    if(ImGui::Button("Split Long")) {
+        return update_mesh_batch(undo, obj, edges_by_length(batch_length, true),
+                                 [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef edge) {
+                                     return m.split_edge(std::get<Halfedge_Mesh::EdgeRef>(edge));
+                                 });
+    }
+    if(Manager::wrap_button("Flip Long")) {
+        return update_mesh_batch(undo, obj, edges_by_length(batch_length, true),
+                                 [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef edge) {
+                                     return m.flip_edge(std::get<Halfedge_Mesh::EdgeRef>(edge));
+                                 });
+    }
+    if(Manager::wrap_button("Collapse Short")) {
+        return update_mesh_batch(
+            undo, obj, edges_by_length(1.0f / batch_length, false),
+            [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef edge) {
+                return m.collapse_edge(std::get<Halfedge_Mesh::EdgeRef>(edge));
+            });
+    }
+    ImGui::SliderFloat("Length Ratio", &batch_length, 1.0f, 4.0f, "%.2f");
 
     {
         auto sel = selected_element();
@@ -681,9 +773,8 @@ std::string Model::UIsidebar(Undo& undo, Widgets& widgets, Scene_Maybe obj_opt,
                 overloaded{
                     [&](Halfedge_Mesh::VertexRef vert) -> std::string {
                         if(ImGui::Button("Erase [del]")) {
-                            mesh.copy_to(before);
                             return update_mesh(
-                                undo, obj, std::move(before), vert,
+                                undo, obj, vert,
                                 [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef vert) {
                                     return m.erase_vertex(std::get<Halfedge_Mesh::VertexRef>(vert));
                                 });
@@ -692,33 +783,29 @@ std::string Model::UIsidebar(Undo& undo, Widgets& widgets, Scene_Maybe obj_opt,
                     },
                     [&](Halfedge_Mesh::EdgeRef edge) -> std::string {
                         if(ImGui::Button("Erase [del]")) {
-                            mesh.copy_to(before);
                             return update_mesh(
-                                undo, obj, std::move(before), edge,
+                                undo, obj, edge,
                                 [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef edge) {
                                     return m.erase_edge(std::get<Halfedge_Mesh::EdgeRef>(edge));
                                 });
                         }
                         if(Manager::wrap_button("Collapse")) {
-                            mesh.copy_to(before);
                             return update_mesh(
-                                undo, obj, std::move(before), edge,
+                                undo, obj, edge,
                                 [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef edge) {
                                     return m.collapse_edge(std::get<Halfedge_Mesh::EdgeRef>(edge));
                                 });
                         }
                         if(Manager::wrap_button("Flip")) {
-                            mesh.copy_to(before);
                             return update_mesh(
-                                undo, obj, std::move(before), edge,
+                                undo, obj, edge,
                                 [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef edge) {
                                     return m.flip_edge(std::get<Halfedge_Mesh::EdgeRef>(edge));
                                 });
                         }
                         if(Manager::wrap_button("Split")) {
-                            mesh.copy_to(before);
                             return update_mesh(
-                                undo, obj, std::move(before), edge,
+                                undo, obj, edge,
                                 [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef edge) {
                                     return m.split_edge(std::get<Halfedge_Mesh::EdgeRef>(edge));
                                 });
@@ -727,9 +814,8 @@ std::string Model::UIsidebar(Undo& undo, Widgets& widgets, Scene_Maybe obj_opt,
                     },
                     [&](Halfedge_Mesh::FaceRef face) -> std::string {
                         if(ImGui::Button("Collapse")) {
-                            mesh.copy_to(before);
                             return update_mesh(
-                                undo, obj, std::move(before), face,
+                                undo, obj, face,
                                 [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef face) {
                                     return m.collapse_face(std::get<Halfedge_Mesh::FaceRef>(face));
                                 });
@@ -854,14 +940,10 @@ void Model::erase_selected(Undo& undo, Scene_Maybe obj_opt) {
     if(!sel_.has_value()) return;
 
     Halfedge_Mesh::ElementRef sel = sel_.value();
-    Halfedge_Mesh& mesh = *my_mesh;
-
-    Halfedge_Mesh before;
-    mesh.copy_to(before);
 
     std::visit(overloaded{[&](Halfedge_Mesh::VertexRef vert) {
                               return update_mesh(
-                                  undo, obj, std::move(before), vert,
+                                  undo, obj, vert,
                                   [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef vert) {
                                       return m.erase_vertex(
                                           std::get<Halfedge_Mesh::VertexRef>(vert));
@@ -869,7 +951,7 @@ void Model::erase_selected(Undo& undo, Scene_Maybe obj_opt) {
                           },
                           [&](Halfedge_Mesh::EdgeRef edge) {
                               return update_mesh(
-                                  undo, obj, std::move(before), edge,
+                                  undo, obj, edge,
                                   [](Halfedge_Mesh& m, Halfedge_Mesh::ElementRef edge) {
                                       return m.erase_edge(std::get<Halfedge_Mesh::EdgeRef>(edge));
                                   });
@@ -912,14 +994,21 @@ void Model::render(Scene_Maybe obj_opt, Widgets& widgets, Camera& cam) {
 
 std::string Model::end_transform(Widgets& widgets, Undo& undo, Scene_Object& obj) {
 
+    // Transforms only move the vertices of the selected element
+    std::vector<Halfedge_Mesh::ElementRef> touched;
+    auto sel = selected_element();
+    if(sel.has_value()) touched.push_back(*sel);
+
+    my_mesh->end_delta(edit);
     obj.set_mesh_dirty();
     my_mesh->render_dirty_flag = true;
 
-    auto err = validate();
+    auto err = validate(sel.has_value() ? &touched : nullptr);
     if(!err.empty()) {
-        obj.take_mesh(std::move(old_mesh));
+        my_mesh->undo(edit);
+        obj.set_mesh_dirty();
     } else {
-        undo.update_mesh_full(obj.id(), std::move(old_mesh));
+        undo.update_mesh(obj.id(), std::move(edit));
     }
     return err;
 }
@@ -39,10 +39,12 @@ public:
 
 private:
     template<typename T>
-    std::string update_mesh(Undo& undo, Scene_Object& obj, Halfedge_Mesh&& before,
-                            Halfedge_Mesh::ElementRef ref, T&& op);
+    std::string update_mesh(Undo& undo, Scene_Object& obj, Halfedge_Mesh::ElementRef ref, T&& op);
     template<typename T>
     std::string update_mesh_global(Undo& undo, Scene_Object& obj, Halfedge_Mesh&& before, T&& op);
+    template<typename T>
+    std::string update_mesh_batch(Undo& undo, Scene_Object& obj,
+                                  const std::vector<Halfedge_Mesh::ElementRef>& refs, T&& op);
 
     void zoom_to(Halfedge_Mesh::ElementRef ref, Camera& cam);
     void begin_transform();
@@ -50,6 +52,7 @@ private:
     void set_selected(Halfedge_Mesh::ElementRef elem);
     std::optional<std::reference_wrapper<Scene_Object>> set_my_obj(Scene_Maybe obj_opt);
     std::optional<Halfedge_Mesh::ElementRef> selected_element();
+    std::vector<Halfedge_Mesh::ElementRef> edges_by_length(float ratio, bool longer);
     void rebuild();
 
     void update_vertex(Halfedge_Mesh::VertexRef vert);
@@ -59,7 +62,7 @@ private:
     void face_viz(Halfedge_Mesh::FaceRef face, std::vector<GL::Mesh::Vert>& verts,
                   std::vector<GL::Mesh::Index>& idxs, size_t insert_at);
 
-    std::string validate();
+    std::string validate(const std::vector<Halfedge_Mesh::ElementRef>* touched = nullptr);
     std::string warn_msg, err_msg;
 
     // This all needs to be updated when the mesh connectivity changes
@@ -67,7 +70,22 @@ private:
     unsigned int selected_elem_id = 0, hovered_elem_id = 0;
 
     Halfedge_Mesh* my_mesh = nullptr;
-    Halfedge_Mesh old_mesh;
+    Halfedge_Mesh::Delta edit;
+
+    // Subdivision applies its scheme this many times per click
+    int subdivide_levels = 1;
+
+    // Simplification keeps this fraction of the faces, stopping early if the surface
+    // would move by more than simplify_error (if nonzero)
+    float simplify_ratio = 0.25f, simplify_error = 0.0f;
+
+    // Remeshing aims for this edge length (zero keeps the mean edge length)
+    float remesh_length = 0.0f;
+    int remesh_iterations = 6;
+
+    // Batch operations pick the edges longer than this multiple of the mean edge length,
+    // or shorter than its inverse
+    float batch_length = 1.5f;
 
     enum class Bevel { face, edge, vert };
     Bevel beveling;
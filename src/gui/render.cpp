@@ -128,12 +128,15 @@ std::pair<float, float> Render::completion_time() const {
     return ui_render.completion_time();
 }
 
-std::string Render::headless_render(Animate& animate, Scene& scene, std::string output, bool a,
-                                    int w, int h, int s, int ls, int d, float exp, bool w_from_ar) {
-    if(w_from_ar) {
-        w = (int)std::ceil(ui_camera.get_ar() * h);
+std::string Render::headless_render(Animate& animate, Scene& scene, Headless_Settings set) {
+    if(set.w_from_ar) {
+        set.w = (int)std::ceil(ui_camera.get_ar() * set.h);
     }
-    return ui_render.headless(animate, scene, ui_camera.get(), output, a, w, h, s, ls, d, exp);
+    return ui_render.headless(animate, scene, ui_camera.get(), set);
+}
+
+std::string Render::headless_merge(const Headless_Settings& set) {
+    return ui_render.merge(set);
 }
 
 } // namespace Gui
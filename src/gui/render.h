@@ -20,8 +20,8 @@ class Render {
 public:
     Render(Scene& scene, Vec2 dim);
 
-    std::string headless_render(Animate& animate, Scene& scene, std::string output, bool a, int w,
-                                int h, int s, int ls, int d, float exp, bool w_from_ar);
+    std::string headless_render(Animate& animate, Scene& scene, Headless_Settings set);
+    std::string headless_merge(const Headless_Settings& set);
     std::pair<float, float> completion_time() const;
 
     bool keydown(Widgets& widgets, SDL_Keysym key);
@@ -271,6 +271,23 @@ Mode Rig::UIsidebar(Manager& manager, Undo& undo, Widgets& widgets, Scene_Maybe
         if(ImGui::IsItemDeactivated() && old_pos != selected->pose)
             undo.pose_bone(my_obj->id(), selected, old_pos);
 
+        // Dragging either limit past the other moves both, so they are undone together
+        ImGui::DragFloat3("IK Min", selected->pose_min.data, 1.0f, -180.0f, 180.0f, "%.0f");
+        bool limits_activated = ImGui::IsItemActivated();
+        bool limits_deactivated = ImGui::IsItemDeactivated();
+        ImGui::DragFloat3("IK Max", selected->pose_max.data, 1.0f, -180.0f, 180.0f, "%.0f");
+        limits_activated |= ImGui::IsItemActivated();
+        limits_deactivated |= ImGui::IsItemDeactivated();
+        selected->pose_max = hmax(selected->pose_min, selected->pose_max);
+
+        if(limits_activated) {
+            old_min = selected->pose_min;
+            old_max = selected->pose_max;
+        }
+        if(limits_deactivated &&
+           (old_min != selected->pose_min || old_max != selected->pose_max))
+            undo.limit_bone(my_obj->id(), selected, old_min, old_max);
+
         if(reskin) {
             my_obj->set_skel_dirty();
         }
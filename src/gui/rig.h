@@ -33,7 +33,7 @@ public:
 private:
     bool creating_bone = false;
     bool root_selected = false;
-    Vec3 old_pos, old_base, old_ext;
+    Vec3 old_pos, old_base, old_ext, old_min, old_max;
     float old_r;
 
     Scene_Object* my_obj = nullptr;
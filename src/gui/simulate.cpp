@@ -5,6 +5,9 @@
 #include "manager.h"
 #include "simulate.h"
 
+#include <chrono>
+#include <filesystem>
+
 namespace Gui {
 
 const char* Solid_Type_Names[(int)Solid_Type::count] = {"Sphere", "Cube", "Cylinder", "Torus",
@@ -12,11 +15,17 @@ const char* Solid_Type_Names[(int)Solid_Type::count] = {"Sphere", "Cube", "Cylin
 
 Simulate::Simulate() : thread_pool(std::thread::hardware_concurrency()) {
     last_update = SDL_GetPerformanceCounter();
+
+    std::error_code err;
+    std::filesystem::path dir = std::filesystem::temp_directory_path(err);
+    auto stamp = std::chrono::steady_clock::now().time_since_epoch().count();
+    cache_file = (dir / ("scotty3d_particles_" + std::to_string(stamp) + ".bake")).string();
 }
 
 Simulate::~Simulate() {
     thread_pool.wait();
     thread_pool.stop();
+    if(temp_cache) cache.remove();
 }
 
 bool Simulate::keydown(Widgets& widgets, Undo& undo, SDL_Keysym key) {
@@ -24,11 +33,63 @@ bool Simulate::keydown(Widgets& widgets, Undo& undo, SDL_Keysym key) {
 }
 
 void Simulate::step(Scene& scene, float dt) {
-    scene.for_items([this, dt](Scene_Item& item) {
+
+    int n = std::max((int)std::ceil(dt / max_step - 1e-3f), 1);
+    float h = dt / n;
+
+    scene.for_items([this, n, h](Scene_Item& item) {
         if(item.is<Scene_Particles>()) {
-            item.get<Scene_Particles>().step(scene_bvh, dt);
+            Scene_Particles& particles = item.get<Scene_Particles>();
+            for(int i = 0; i < n; i++) particles.step(scene_bvh, h);
         }
     });
+    cur_frame = -1;
+}
+
+void Simulate::set_cache_file(std::string file) {
+    if(temp_cache) cache.remove();
+    cache = Particle_Cache{};
+    cache_file = std::move(file);
+    temp_cache = false;
+}
+
+std::string Simulate::open_cache(Scene& scene, float dt) {
+    if(cache.is_open() && dt == frame_dt && !scene_changed) return {};
+    frame_dt = dt;
+    scene_changed = false;
+    return cache.open(cache_file, dt, Particle_Cache::scene_hash(scene));
+}
+
+void Simulate::clear_cache() {
+    std::string err = cache.clear();
+    if(!err.empty()) warn("%s", err.c_str());
+}
+
+std::string Simulate::save_frame(const Scene& scene, int frame) {
+    cur_frame = frame;
+    return cache.save(scene, frame);
+}
+
+bool Simulate::load_frame(Scene& scene, int frame) {
+    if(cur_frame == frame) return true;
+    if(!cache.has(frame)) return false;
+
+    std::string err = cache.load(scene, frame);
+    if(!err.empty()) {
+        warn("%s", err.c_str());
+        clear_cache();
+        return false;
+    }
+    cur_frame = frame;
+    return true;
+}
+
+int Simulate::cached_before(int frame) const {
+    return cache.cached_before(frame);
+}
+
+int Simulate::frame() const {
+    return cur_frame;
 }
 
 void Simulate::update_time() {
@@ -45,17 +106,22 @@ void Simulate::update(Scene& scene, Undo& undo) {
     Uint64 time = SDL_GetPerformanceCounter();
     Uint64 udt = time - last_update;
 
-    float dt = clamp((float)(udt / freq), 0.0f, 0.05f);
+    // Live stepping still uses fixed steps, carrying the remainder over to the next update
+    accumulated += clamp((float)(udt / freq), 0.0f, 0.05f);
     last_update = time;
 
-    scene.for_items([this, dt](Scene_Item& item) {
-        if(item.is<Scene_Particles>()) {
-            Scene_Particles& particles = item.get<Scene_Particles>();
-            if(particles.opt.enabled) {
-                particles.step(scene_bvh, dt);
+    while(accumulated >= max_step) {
+        scene.for_items([this](Scene_Item& item) {
+            if(item.is<Scene_Particles>()) {
+                Scene_Particles& particles = item.get<Scene_Particles>();
+                if(particles.opt.enabled) {
+                    particles.step(scene_bvh, max_step);
+                    cur_frame = -1;
+                }
             }
-        }
-    });
+        });
+        accumulated -= max_step;
+    }
 }
 
 void Simulate::render(Scene_Maybe obj_opt, Widgets& widgets, Camera& cam) {
@@ -122,11 +188,17 @@ void Simulate::clear_particles(Scene& scene) {
             item.get<Scene_Particles>().clear();
         }
     });
+    cur_frame = -1;
 }
 
 void Simulate::update_bvh(Scene& scene, Undo& undo) {
     if(cur_actions != undo.n_actions()) {
+        // Any edit may change how particles move, so the baked frames no longer apply, and
+        // the cache is reopened to record the new scene hash
         build_scene(scene);
+        clear_cache();
+        scene_changed = true;
+        cur_frame = -1;
         cur_actions = undo.n_actions();
     }
 }
@@ -158,6 +230,8 @@ Mode Simulate::UIsidebar(Manager& manager, Scene& scene, Undo& undo, Widgets& wi
         ImGui::DragFloat("Particles/Sec", &gui_opt.pps, 1.0f, 1.0f,
                          std::numeric_limits<float>::max(), "%.2f");
         ImGui::Checkbox("Enabled", &gui_opt.enabled);
+        ImGui::Checkbox("Trace As Spheres", &gui_opt.spheres);
+        ImGui::Checkbox("Collide Particles", &gui_opt.collisions);
 
         int n_types = (int)Solid_Type::count;
         if(!scene.has_obj()) {
@@ -208,6 +282,8 @@ Mode Simulate::UIsidebar(Manager& manager, Scene& scene, Undo& undo, Widgets& wi
             particles.opt.lifetime = gui_opt.lifetime;
             particles.opt.pps = gui_opt.pps;
             particles.opt.enabled = gui_opt.enabled;
+            particles.opt.spheres = gui_opt.spheres;
+            particles.opt.collisions = gui_opt.collisions;
             undo.add_particles(std::move(particles));
         }
 
@@ -219,6 +295,24 @@ Mode Simulate::UIsidebar(Manager& manager, Scene& scene, Undo& undo, Widgets& wi
         build_scene(scene);
     }
 
+    ImGui::Separator();
+    ImGui::Text("Bake Cache");
+
+    static char bake_file[256] = {};
+    ImGui::InputText("File", bake_file, sizeof(bake_file));
+    if(ImGui::Button("Use File") && bake_file[0]) {
+        set_cache_file(bake_file);
+    }
+    ImGui::SameLine();
+    if(ImGui::Button("Bake")) {
+        manager.get_animate().bake_sim(scene);
+    }
+    ImGui::SameLine();
+    if(ImGui::Button("Clear")) {
+        clear_cache();
+        cur_frame = -1;
+    }
+
     return mode;
 }
 
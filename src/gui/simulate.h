@@ -2,6 +2,7 @@
 #pragma once
 
 #include "../rays/pathtracer.h"
+#include "../scene/particle_cache.h"
 #include "../scene/particles.h"
 #include "../util/thread_pool.h"
 
@@ -25,8 +26,22 @@ public:
     void update(Scene& scene, Undo& undo);
     void update_time();
 
+    // Advances every emitter by dt in equal substeps no longer than max_step, so results
+    // depend only on dt and not on how often the caller steps
     void step(Scene& scene, float dt);
 
+    // Particle bake cache. Frames are simulated in order from a cleared scene, one frame
+    // time apart, and each is recorded so that it can later be loaded instead of simulated.
+    // Unless given a file, the cache lives in a temporary file removed on exit.
+    void set_cache_file(std::string file);
+    std::string open_cache(Scene& scene, float frame_dt);
+    void clear_cache();
+    std::string save_frame(const Scene& scene, int frame);
+    bool load_frame(Scene& scene, int frame);
+    int cached_before(int frame) const;
+    // The frame whose state the emitters hold, or -1 if they were stepped live
+    int frame() const;
+
     void clear_particles(Scene& scene);
     void update_bvh(Scene& scene, Undo& undo);
     void build_scene(Scene& scene);
@@ -34,8 +49,17 @@ public:
     void render(Scene_Maybe obj_opt, Widgets& widgets, Camera& cam);
     Mode UIsidebar(Manager& manager, Scene& scene, Undo& undo, Widgets& widgets, Scene_Maybe obj);
 
+    static const inline float max_step = 1.0f / 240.0f;
+
 private:
     PT::BVH<PT::Object> scene_bvh;
+    Particle_Cache cache;
+    std::string cache_file;
+    bool temp_cache = true;
+    bool scene_changed = false;
+    float frame_dt = 0.0f;
+    int cur_frame = -1;
+    float accumulated = 0.0f;
     Thread_Pool thread_pool;
     Pose old_pose;
     size_t cur_actions = 0;
@@ -1,10 +1,13 @@
 
 #include <imgui/imgui.h>
+#include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <nfd/nfd.h>
 #include <sf_libs/stb_image_write.h>
 #include <sstream>
+#include <thread>
 
 #include "animate.h"
 #include "manager.h"
@@ -13,6 +16,7 @@
 #include "../geometry/util.h"
 #include "../platform/platform.h"
 #include "../scene/renderer.h"
+#include "../util/png_stream.h"
 
 namespace Gui {
 
@@ -642,6 +646,9 @@ void Widget_Render::begin(Scene& scene, Widget_Camera& cam, Camera& user_cam) {
         ImGui::InputInt("Area Light Samples", &out_area_samples, 1, 100);
         ImGui::InputInt("Max Ray Depth", &out_depth, 1, 32);
         ImGui::SliderFloat("Exposure", &exposure, 0.01f, 10.0f, "%.2f", 2.5f);
+        if(ImGui::Checkbox("Denoise", &denoise)) {
+            pathtracer.set_denoise(denoise);
+        }
     } else {
         ImGui::Combo("Samples", (int*)&msaa.samples, GL::Sample_Count_Names, msaa.n_options());
         out_samples = msaa.n_samples();
@@ -662,6 +669,16 @@ void Widget_Render::begin(Scene& scene, Widget_Camera& cam, Camera& user_cam) {
     }
 }
 
+static std::string frame_path(const std::string& folder, int frame) {
+    std::stringstream str;
+    str << std::setfill('0') << std::setw(4) << frame;
+#ifdef _WIN32
+    return folder + "\\" + str.str() + ".png";
+#else
+    return folder + "/" + str.str() + ".png";
+#endif
+}
+
 std::string Widget_Render::step(Animate& animate, Scene& scene) {
 
     if(animating) {
@@ -684,13 +701,7 @@ std::string Widget_Render::step(Animate& animate, Scene& scene) {
             Renderer::get().save(scene, cam, out_w, out_h, out_samples);
             Renderer::get().saved(data);
 
-            std::stringstream str;
-            str << std::setfill('0') << std::setw(4) << next_frame;
-#ifdef _WIN32
-            std::string path = folder + "\\" + str.str() + ".png";
-#else
-            std::string path = folder + "/" + str.str() + ".png";
-#endif
+            std::string path = frame_path(folder, next_frame);
 
             stbi_flip_vertically_on_write(true);
             if(!stbi_write_png(path.c_str(), (int)out_w, (int)out_h, 4, data.data(),
@@ -711,13 +722,7 @@ std::string Widget_Render::step(Animate& animate, Scene& scene) {
                 std::vector<unsigned char> data;
 
                 pathtracer.get_output().tonemap_to(data, exposure);
-                std::stringstream str;
-                str << std::setfill('0') << std::setw(4) << next_frame;
-#ifdef _WIN32
-                std::string path = folder + "\\" + str.str() + ".png";
-#else
-                std::string path = folder + "/" + str.str() + ".png";
-#endif
+                std::string path = frame_path(folder, next_frame);
 
                 stbi_flip_vertically_on_write(false);
                 if(!stbi_write_png(path.c_str(), (int)out_w, (int)out_h, 4, data.data(),
@@ -897,21 +902,44 @@ bool Widget_Render::UI(Scene& scene, Widget_Camera& cam, Camera& user_cam, std::
 }
 
 std::string Widget_Render::headless(Animate& animate, Scene& scene, const Camera& cam,
-                                    std::string output, bool a, int w, int h, int s, int ls, int d,
-                                    float exp) {
+                                    const Headless_Settings& set) {
 
     info("Render settings:");
-    info("\twidth: %d", w);
-    info("\theight: %d", h);
-    info("\tsamples: %d", s);
-    info("\tlight samples: %d", ls);
-    info("\tmax depth: %d", d);
-    info("\texposure: %f", exp);
+    info("\twidth: %d", set.w);
+    info("\theight: %d", set.h);
+    info("\tsamples: %d", set.s);
+    info("\tlight samples: %d", set.ls);
+    info("\tmax depth: %d", set.d);
+    info("\texposure: %f", set.exp);
+    info("\tdenoise: %s", set.denoise ? "true" : "false");
     info("\trender threads: %u", std::thread::hardware_concurrency());
 
-    out_w = w;
-    out_h = h;
-    pathtracer.set_sizes(w, h, s, ls, d);
+    if(!set.particle_cache.empty()) animate.set_sim_cache(set.particle_cache);
+
+    bool checkpoints = !set.checkpoint_file.empty() || !set.resume_file.empty();
+    if(set.animate && checkpoints) {
+        return "Checkpoints are only supported for single-frame renders!";
+    }
+    if(set.partial && (set.animate || checkpoints)) {
+        return "Partial renders can't be combined with animation or checkpoints!";
+    }
+    if(set.partial && set.denoise) {
+        return "Partial renders don't keep the features the denoiser needs!";
+    }
+    if(set.band_rows > 0 && (set.animate || set.partial || checkpoints)) {
+        return "Band renders can't be combined with animation, partial renders or checkpoints!";
+    }
+    if(set.sample_offset < 0) {
+        return "Sample offset must not be negative!";
+    }
+
+    out_w = set.w;
+    out_h = set.h;
+    denoise = set.denoise;
+    banded = set.band_rows > 0;
+    band_time = {};
+    pathtracer.set_sizes(set.w, set.h, set.s, set.ls, set.d);
+    pathtracer.set_denoise(denoise);
 
     auto print_progress = [](float f) {
         std::cout << "Progress: [";
@@ -931,14 +959,79 @@ std::string Widget_Render::headless(Animate& animate, Scene& scene, const Camera
     };
 
     std::cout << std::fixed << std::setw(2) << std::setprecision(2) << std::setfill('0');
-    if(a) {
+    if(set.partial) {
+
+        size_t first = 0, last = pathtracer.n_tiles();
+        if(!set.tile_range.empty()) {
+            unsigned long long a, b;
+            if(std::sscanf(set.tile_range.c_str(), "%llu:%llu", &a, &b) != 2 || a > b) {
+                return "Tile range must be given as first:last!";
+            }
+            first = std::min((size_t)a, last);
+            last = std::min((size_t)b, last);
+        }
+        info("Rendering tiles [%zu, %zu) of %zu, samples [%d, %d).", first, last,
+             pathtracer.n_tiles(), set.sample_offset, set.sample_offset + set.s);
+
+        pathtracer.begin_partial(scene, cam, first, last, set.sample_offset, set.seed);
+        while(pathtracer.in_progress()) {
+            print_progress(pathtracer.progress());
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        }
+        std::cout << std::endl;
+
+        return pathtracer.save_checkpoint(set.output_file);
+
+    } else if(set.band_rows > 0) {
+
+        PNG_Stream png;
+        std::string err = png.open(set.output_file, set.w, set.h);
+        if(!err.empty()) return err;
+
+        // Denoised bands are rendered with a border of extra rows, which is thrown away, so
+        // that the filter sees the same neighborhood it would in a full-frame render.
+        size_t h = set.h, band = set.band_rows;
+        size_t border = set.denoise ? PT::denoise_radius() : 0;
+        size_t n_bands = (h + band - 1) / band;
+
+        for(size_t b = 0; b < n_bands; b++) {
+
+            // PNG rows go top to bottom, but image rows count up from the bottom
+            size_t y1 = h - b * band, y0 = y1 > band ? y1 - band : 0;
+            size_t r0 = y0 > border ? y0 - border : 0, r1 = std::min(h, y1 + border);
+
+            pathtracer.begin_band(scene, cam, r0, r1 - r0);
+            while(pathtracer.in_progress()) {
+                print_progress(((float)b + pathtracer.progress()) / n_bands);
+                std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            }
+            auto [build, render] = pathtracer.completion_time();
+            band_time.first += build;
+            band_time.second += render;
+
+            std::vector<unsigned char> data;
+            pathtracer.get_output().tonemap_to(data, set.exp);
+            err = png.write_rows(data.data() + (r1 - y1) * set.w * 4, y1 - y0);
+            if(!err.empty()) return err;
+        }
+        std::cout << std::endl;
+
+        return png.close();
+
+    } else if(set.animate && set.frames_in_flight > 1) {
+
+        std::string err = headless_frames(animate, scene, set, print_progress);
+        if(!err.empty()) return err;
+        std::cout << std::endl;
+
+    } else if(set.animate) {
 
         method = 1;
         init = true;
         animating = true;
         max_frame = animate.n_frames();
         next_frame = 0;
-        folder = output;
+        folder = set.output_file;
         while(next_frame < max_frame) {
             std::string err = step(animate, scene);
             if(!err.empty()) return err;
@@ -949,16 +1042,42 @@ std::string Widget_Render::headless(Animate& animate, Scene& scene, const Camera
 
     } else {
 
-        pathtracer.begin_render(scene, cam);
+        bool resumed = false;
+        if(!set.resume_file.empty()) {
+            std::string err = pathtracer.load_checkpoint(set.resume_file);
+            if(!err.empty()) return err;
+
+            size_t done = pathtracer.samples_taken();
+            info("Resuming from %s with %zu samples taken.", set.resume_file.c_str(), done);
+            pathtracer.set_samples((size_t)set.s > done ? set.s - done : 0);
+            resumed = true;
+        }
+
+        auto last_save = std::chrono::steady_clock::now();
+        auto interval = std::chrono::duration<float>(set.checkpoint_interval);
+
+        pathtracer.begin_render(scene, cam, resumed);
         while(pathtracer.in_progress()) {
             print_progress(pathtracer.progress());
             std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+            if(!set.checkpoint_file.empty() &&
+               std::chrono::steady_clock::now() - last_save >= interval) {
+                std::string err = pathtracer.save_checkpoint(set.checkpoint_file);
+                if(!err.empty()) warn("%s", err.c_str());
+                last_save = std::chrono::steady_clock::now();
+            }
         }
         std::cout << std::endl;
 
+        if(!set.checkpoint_file.empty()) {
+            std::string err = pathtracer.save_checkpoint(set.checkpoint_file);
+            if(!err.empty()) return err;
+        }
+
         std::vector<unsigned char> data;
-        pathtracer.get_output().tonemap_to(data, exp);
-        if(!stbi_write_png(output.c_str(), w, h, 4, data.data(), w * 4)) {
+        pathtracer.get_output().tonemap_to(data, set.exp);
+        if(!stbi_write_png(set.output_file.c_str(), set.w, set.h, 4, data.data(), set.w * 4)) {
             return "Failed to write output!";
         }
     }
@@ -966,6 +1085,92 @@ std::string Widget_Render::headless(Animate& animate, Scene& scene, const Camera
     return {};
 }
 
+std::string Widget_Render::headless_frames(Animate& animate, Scene& scene,
+                                           const Headless_Settings& set,
+                                           std::function<void(float)> print_progress) {
+
+    // Each frame in flight gets its own path tracer, which holds a snapshot of the scene
+    // (BVH, lights, materials, camera) at that frame, and an even share of the hardware
+    // threads. Scene time and the particle simulation are still advanced in frame order
+    // on this thread, so frames only overlap while they are being traced.
+    size_t n_slots = (size_t)set.frames_in_flight;
+    size_t threads = std::max(std::thread::hardware_concurrency() / n_slots, (size_t)1);
+    info("Rendering %zu frames at a time with %zu threads each.", n_slots, threads);
+
+    std::vector<std::unique_ptr<PT::Pathtracer>> tracers;
+    std::vector<int> slot_frame(n_slots, -1);
+    for(size_t i = 0; i < n_slots; i++) {
+        tracers.push_back(std::make_unique<PT::Pathtracer>(*this, Vec2{1.0f}, threads));
+        tracers.back()->set_sizes(set.w, set.h, set.s, set.ls, set.d);
+        tracers.back()->set_denoise(set.denoise);
+    }
+
+    int n_frames = animate.n_frames(), started = 0, written = 0;
+    while(written < n_frames) {
+
+        float in_flight = 0.0f;
+        for(size_t i = 0; i < n_slots; i++) {
+
+            PT::Pathtracer& tracer = *tracers[i];
+
+            if(slot_frame[i] >= 0 && !tracer.in_progress()) {
+                std::vector<unsigned char> data;
+                tracer.get_output().tonemap_to(data, set.exp);
+
+                std::string path = frame_path(set.output_file, slot_frame[i]);
+                stbi_flip_vertically_on_write(false);
+                if(!stbi_write_png(path.c_str(), set.w, set.h, 4, data.data(), set.w * 4)) {
+                    for(auto& t : tracers) t->cancel();
+                    return "Failed to write output!";
+                }
+                slot_frame[i] = -1;
+                written++;
+            }
+
+            if(slot_frame[i] < 0 && started < n_frames) {
+                Camera cam = animate.set_time(scene, (float)started);
+                animate.step_sim(scene);
+                tracer.begin_render(scene, cam);
+                slot_frame[i] = started++;
+            }
+
+            if(slot_frame[i] >= 0) in_flight += tracer.progress();
+        }
+
+        print_progress(((float)written + in_flight) / n_frames);
+        if(written < n_frames) std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return {};
+}
+
+std::string Widget_Render::merge(const Headless_Settings& set) {
+
+    if(set.denoise) return "Merged renders don't keep the features the denoiser needs!";
+
+    PT::Checkpoint merged;
+    std::string err = merged.merge(set.merge_files);
+    if(!err.empty()) return err;
+
+    info("Merged %zu partial renders into a %zux%zu image with %zu samples per pixel.",
+         set.merge_files.size(), merged.w, merged.h, merged.samples);
+
+    if(!set.checkpoint_file.empty()) {
+        err = merged.save(set.checkpoint_file);
+        if(!err.empty()) return err;
+    }
+
+    HDR_Image image(merged.w, merged.h);
+    for(size_t i = 0; i < merged.w * merged.h; i++) image.at(i) = merged.mean[i];
+
+    std::vector<unsigned char> data;
+    image.tonemap_to(data, set.exp);
+    if(!stbi_write_png(set.output_file.c_str(), (int)merged.w, (int)merged.h, 4, data.data(),
+                       (int)merged.w * 4)) {
+        return "Failed to write output!";
+    }
+    return {};
+}
+
 void Widget_Render::render_log(const Mat4& view) const {
     std::lock_guard<std::mutex> lock(log_mut);
     Renderer::get().lines(ray_log, view);
@@ -74,6 +74,48 @@ private:
     void generate_cage();
 };
 
+// Path tracer settings used when rendering without the GUI (filled in from the command line)
+struct Headless_Settings {
+
+    std::string output_file = "out.png";
+    int w = 640;
+    int h = 360;
+    int s = 128;
+    int ls = 16;
+    int d = 4;
+    bool animate = false;
+    float exp = 1.0f;
+    bool w_from_ar = false;
+    bool denoise = false;
+
+    // Progressive checkpointing: save every checkpoint_interval seconds and on completion
+    std::string checkpoint_file;
+    std::string resume_file;
+    float checkpoint_interval = 60.0f;
+
+    // Distributed rendering: render only tiles [first, last) and/or the samples starting at
+    // sample_offset, and write the partial accumulator to output_file instead of an image.
+    // Every process of a job must use the same seed.
+    bool partial = false;
+    std::string tile_range;
+    int sample_offset = 0;
+    unsigned int seed = 0;
+
+    // Combine these partial renders into output_file
+    std::vector<std::string> merge_files;
+
+    // Number of animation frames path traced at the same time
+    int frames_in_flight = 1;
+
+    // Particle bake cache to load simulated frames from and record new ones in, so later
+    // renders of the same scene skip the simulation
+    std::string particle_cache;
+
+    // If nonzero, render in horizontal bands of this many rows, streaming each band to the
+    // output PNG as it finishes so memory use doesn't grow with the image size
+    int band_rows = 0;
+};
+
 class Widget_Render {
 public:
     Widget_Render(Vec2 dim);
@@ -84,8 +126,9 @@ public:
     void animate(Scene& scene, Widget_Camera& cam, Camera& user_cam, int max_frame);
     std::string step(Animate& animate, Scene& scene);
 
-    std::string headless(Animate& animate, Scene& scene, const Camera& cam, std::string output,
-                         bool a, int w, int h, int s, int ls, int d, float exp);
+    std::string headless(Animate& animate, Scene& scene, const Camera& cam,
+                         const Headless_Settings& set);
+    std::string merge(const Headless_Settings& set);
 
     void log_ray(const Ray& ray, float t, Spectrum color = Spectrum{1.0f});
     void render_log(const Mat4& view) const;
@@ -97,7 +140,7 @@ public:
         return has_rendered;
     }
     std::pair<float, float> completion_time() const {
-        return pathtracer.completion_time();
+        return banded ? band_time : pathtracer.completion_time();
     }
     bool in_progress() const {
         return pathtracer.in_progress();
@@ -108,14 +151,20 @@ public:
 
 private:
     void begin(Scene& scene, Widget_Camera& cam, Camera& user_cam);
+    std::string headless_frames(Animate& animate, Scene& scene, const Headless_Settings& set,
+                                std::function<void(float)> print_progress);
 
     mutable std::mutex log_mut;
     GL::Lines ray_log;
 
     int out_w, out_h, out_samples = 32, out_area_samples = 8, out_depth = 4;
     float exposure = 1.0f;
+    bool denoise = false;
 
     bool has_rendered = false;
+    // The pathtracer times each band separately, so band renders sum them here
+    bool banded = false;
+    std::pair<float, float> band_time;
     bool render_window = false, render_window_focus = false;
 
     int method = 1;
@@ -13,18 +13,54 @@ int main(int argc, char** argv) {
     args.add_option("-s,--scene", settings.scene_file, "Scene file to load");
     args.add_option("--env_map", settings.env_map_file, "Override scene environment map");
     args.add_flag("--headless", settings.headless, "Path-trace scene without opening the GUI");
-    args.add_option("-o,--output", settings.output_file, "Image file to write (if headless)");
-    args.add_flag("--animate", settings.animate, "Output animation frames (if headless)");
-    args.add_option("--width", settings.w, "Output image width (if headless)");
-    args.add_option("--height", settings.h, "Output image height (if headless)");
-    args.add_flag("--use_ar", settings.w_from_ar,
+    args.add_option("-o,--output", settings.render.output_file,
+                    "Image file to write (if headless)");
+    args.add_flag("--animate", settings.render.animate, "Output animation frames (if headless)");
+    args.add_option("--width", settings.render.w, "Output image width (if headless)");
+    args.add_option("--height", settings.render.h, "Output image height (if headless)");
+    args.add_flag("--use_ar", settings.render.w_from_ar,
                   "Compute output image width based on camera AR (if headless)");
-    args.add_option("--depth", settings.d, "Maximum ray depth (if headless)");
-    args.add_option("--samples", settings.s, "Pixel samples (if headless)");
-    args.add_option("--exposure", settings.exp, "Output exposure (if headless)");
-    args.add_option("--area_samples", settings.ls, "Area light samples (if headless)");
+    args.add_option("--depth", settings.render.d, "Maximum ray depth (if headless)");
+    args.add_option("--samples", settings.render.s, "Pixel samples (if headless)");
+    args.add_option("--exposure", settings.render.exp, "Output exposure (if headless)");
+    args.add_option("--area_samples", settings.render.ls, "Area light samples (if headless)");
+    args.add_flag("--denoise", settings.render.denoise,
+                  "Denoise path-traced output (if headless, not for partial renders or merges)");
+    args.add_option("--checkpoint", settings.render.checkpoint_file,
+                    "Periodically save render progress to this file (if headless)");
+    args.add_option("--checkpoint_interval", settings.render.checkpoint_interval,
+                    "Seconds between checkpoint saves (if headless)");
+    args.add_option("--resume", settings.render.resume_file,
+                    "Continue a render from a checkpoint file (if headless)");
+    auto tile_range = args.add_option(
+        "--tile_range", settings.render.tile_range,
+        "Only render tiles first:last, writing a partial render to the output (if headless)");
+    auto sample_offset = args.add_option(
+        "--sample_offset", settings.render.sample_offset,
+        "Index of the first sample to render, writing a partial render (if headless)");
+    args.add_option("--seed", settings.render.seed,
+                    "Random seed shared by all partial renders of a frame (if headless)");
+    args.add_option("--merge", settings.render.merge_files,
+                    "Combine partial renders into the output image (if headless)");
+    args.add_option("--frames_in_flight", settings.render.frames_in_flight,
+                    "Number of animation frames to render at once (if headless)");
+    args.add_option("--particle_cache", settings.render.particle_cache,
+                    "Load and record simulated particle frames in this file (if headless)");
+    args.add_option("--band_rows", settings.render.band_rows,
+                    "Render and stream the image in bands of this many rows (if headless)");
+    args.add_option("--simplify", settings.simplify,
+                    "Simplify every mesh to this fraction of its faces (if headless)");
+    args.add_option("--simplify_error", settings.simplify_error,
+                    "Stop simplifying before the surface moves this far (if headless)");
+    args.add_option("--remesh_iterations", settings.remesh_iterations,
+                    "Isotropically remesh every mesh for this many iterations (if headless)");
+    args.add_option("--remesh_length", settings.remesh_length,
+                    "Target edge length for remeshing; defaults to the mean (if headless)");
+    args.add_option("--save_scene", settings.save_scene,
+                    "Write the processed scene to this file instead of rendering (if headless)");
 
     CLI11_PARSE(args, argc, argv);
+    settings.render.partial = tile_range->count() || sample_offset->count();
 
     if(!settings.headless) {
         Platform plt;
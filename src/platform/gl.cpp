@@ -382,6 +382,11 @@ Instances::Info& Instances::get(size_t idx) {
     return data[idx];
 }
 
+std::vector<Instances::Info>& Instances::edit_data() {
+    dirty = true;
+    return data;
+}
+
 size_t Instances::add(const Mat4& transform, GLuint id) {
     data.emplace_back(Info{id, transform});
     dirty = true;
@@ -121,6 +121,7 @@ public:
     void render();
     size_t add(const Mat4& transform, GLuint id = 0);
     Info& get(size_t idx);
+    std::vector<Info>& edit_data();
     void clear(size_t n = 0);
     const Mesh& mesh() const;
 
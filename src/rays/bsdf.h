@@ -132,6 +132,16 @@ public:
                           underlying);
     }
 
+    // Surface color reported to the denoiser's albedo buffer
+    Spectrum albedo() const {
+        return std::visit(overloaded{[](const BSDF_Lambertian& b) { return b.albedo; },
+                                     [](const BSDF_Mirror& b) { return b.reflectance; },
+                                     [](const BSDF_Glass& b) { return b.transmittance; },
+                                     [](const BSDF_Diffuse& b) { return b.radiance; },
+                                     [](const BSDF_Refract& b) { return b.transmittance; }},
+                          underlying);
+    }
+
 private:
     std::variant<BSDF_Lambertian, BSDF_Mirror, BSDF_Glass, BSDF_Diffuse, BSDF_Refract> underlying;
 };
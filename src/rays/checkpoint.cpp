@@ -0,0 +1,171 @@
+#include "checkpoint.h"
+#include "../lib/log.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+
+namespace PT {
+
+// The last character is the layout version: bump it whenever Checkpoint_Header changes
+static const char magic[8] = {'S', '3', 'D', 'C', 'K', 'P', 'T', '2'};
+
+struct Checkpoint_Header {
+    char magic[8];
+    uint64_t w, h;
+    uint64_t samples;
+    uint64_t next_epoch;
+    uint64_t tile_size, tile_begin, tile_end;
+    uint64_t sample_offset;
+    uint32_t seed;
+    uint32_t pad;
+};
+
+bool Checkpoint::covers(size_t x, size_t y) const {
+    if(!tile_size) return true;
+    size_t tiles_x = (w + tile_size - 1) / tile_size;
+    size_t tile = (y / tile_size) * tiles_x + x / tile_size;
+    return tile >= tile_begin && tile < tile_end;
+}
+
+std::string Checkpoint::save(std::string file) const {
+
+    assert(mean.size() == w * h && counts.size() == w * h);
+
+    Checkpoint_Header header = {};
+    std::copy(std::begin(magic), std::end(magic), header.magic);
+    header.w = w;
+    header.h = h;
+    header.samples = samples;
+    header.next_epoch = next_epoch;
+    header.tile_size = tile_size;
+    header.tile_begin = tile_begin;
+    header.tile_end = tile_end;
+    header.sample_offset = sample_offset;
+    header.seed = seed;
+
+    std::vector<Spectrum> m;
+    std::vector<uint32_t> n;
+    for(size_t y = 0; y < h; y++) {
+        for(size_t x = 0; x < w; x++) {
+            if(!covers(x, y)) continue;
+            m.push_back(mean[y * w + x]);
+            n.push_back(counts[y * w + x]);
+        }
+    }
+
+    // Write to a temporary file first so a crash mid-write never clobbers the last
+    // good checkpoint.
+    std::string tmp = file + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if(!out.is_open()) return "Failed to open checkpoint file " + tmp + " for writing!";
+
+        out.write((const char*)&header, sizeof(header));
+        out.write((const char*)m.data(), m.size() * sizeof(Spectrum));
+        out.write((const char*)n.data(), n.size() * sizeof(uint32_t));
+        if(!out.good()) return "Failed to write checkpoint file " + tmp + "!";
+    }
+
+    std::remove(file.c_str());
+    if(std::rename(tmp.c_str(), file.c_str())) {
+        return "Failed to move checkpoint into place at " + file + "!";
+    }
+    return {};
+}
+
+std::string Checkpoint::load(std::string file) {
+
+    std::ifstream in(file, std::ios::binary);
+    if(!in.is_open()) return "Failed to open checkpoint file " + file + "!";
+
+    Checkpoint_Header header;
+    in.read((char*)&header, sizeof(header));
+    if(!in.good() || !std::equal(std::begin(magic), std::end(magic), header.magic)) {
+        return "File " + file + " is not a render checkpoint!";
+    }
+
+    w = header.w;
+    h = header.h;
+    samples = header.samples;
+    next_epoch = header.next_epoch;
+    tile_size = header.tile_size;
+    tile_begin = header.tile_begin;
+    tile_end = header.tile_end;
+    sample_offset = header.sample_offset;
+    seed = header.seed;
+
+    size_t n = 0;
+    for(size_t y = 0; y < h; y++) {
+        for(size_t x = 0; x < w; x++) n += covers(x, y);
+    }
+
+    std::vector<Spectrum> m(n);
+    std::vector<uint32_t> c(n);
+    in.read((char*)m.data(), n * sizeof(Spectrum));
+    in.read((char*)c.data(), n * sizeof(uint32_t));
+    if(!in.good()) return "Checkpoint file " + file + " is truncated!";
+
+    mean.assign(w * h, Spectrum{});
+    counts.assign(w * h, 0);
+
+    size_t i = 0;
+    for(size_t y = 0; y < h; y++) {
+        for(size_t x = 0; x < w; x++) {
+            if(!covers(x, y)) continue;
+            mean[y * w + x] = m[i];
+            counts[y * w + x] = c[i];
+            i++;
+        }
+    }
+    return {};
+}
+
+std::string Checkpoint::merge(const std::vector<std::string>& files) {
+
+    *this = Checkpoint{};
+
+    // Pixel samples each pixel received across all partials
+    std::vector<size_t> pixel_samples;
+
+    for(const std::string& file : files) {
+
+        Checkpoint part;
+        std::string err = part.load(file);
+        if(!err.empty()) return err;
+
+        if(mean.empty()) {
+            w = part.w;
+            h = part.h;
+            seed = part.seed;
+            mean.assign(w * h, Spectrum{});
+            counts.assign(w * h, 0);
+            pixel_samples.assign(w * h, 0);
+        } else if(part.w != w || part.h != h) {
+            return "Partial render " + file + " does not match the size of the others!";
+        }
+
+        next_epoch = std::max(next_epoch, part.sample_offset + part.samples);
+
+        for(size_t y = 0; y < h; y++) {
+            for(size_t x = 0; x < w; x++) {
+                if(!part.covers(x, y)) continue;
+
+                size_t i = y * w + x;
+                pixel_samples[i] += part.samples;
+                if(!part.counts[i]) continue;
+
+                counts[i] += part.counts[i];
+                mean[i] += (part.mean[i] - mean[i]) * ((float)part.counts[i] / counts[i]);
+            }
+        }
+    }
+
+    if(mean.empty()) return "No partial renders to merge!";
+
+    samples = *std::min_element(pixel_samples.begin(), pixel_samples.end());
+    if(!samples) warn("Merged partial renders do not cover the whole image.");
+    return {};
+}
+
+} // namespace PT
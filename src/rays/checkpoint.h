@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "../lib/spectrum.h"
+
+namespace PT {
+
+// Snapshot of a progressive render: the running per-pixel mean, how many samples went into
+// each pixel, and where the per-epoch random streams left off. Stored as a compact binary
+// file so that a render can be resumed, or extended with more samples, by a later process.
+//
+// Partial renders (a range of tiles and/or samples rendered by one process of a distributed
+// job) use the same format, but only the pixels inside their tile range are written.
+// merge() combines any number of partials into a full-frame checkpoint, weighting each
+// pixel by its sample counts.
+struct Checkpoint {
+
+    std::string save(std::string file) const;
+    std::string load(std::string file);
+    std::string merge(const std::vector<std::string>& files);
+
+    // Whether pixel (x,y) is part of this (possibly partial) render
+    bool covers(size_t x, size_t y) const;
+
+    size_t w = 0, h = 0;
+    size_t samples = 0;
+    unsigned int seed = 0;
+    size_t next_epoch = 0;
+
+    // Tiles covered by a partial render; a tile_size of zero means the whole image
+    size_t tile_size = 0, tile_begin = 0, tile_end = 0;
+    size_t sample_offset = 0;
+
+    std::vector<Spectrum> mean;
+    std::vector<unsigned int> counts;
+};
+
+} // namespace PT
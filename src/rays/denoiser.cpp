@@ -0,0 +1,136 @@
+#include "denoiser.h"
+#include "../util/thread_pool.h"
+
+namespace PT {
+
+// Rows per parallel tile
+static const size_t tile_rows = 16;
+
+// Edge-stopping parameters
+static const float sigma_color = 0.25f;
+static const float sigma_normal = 64.0f;
+static const float sigma_depth = 0.02f;
+static const float sigma_albedo = 0.1f;
+
+// Minimum albedo used when (de)modulating, so black surfaces don't divide by zero
+static const float min_albedo = 0.01f;
+
+void Feature_Buffers::resize(size_t _w, size_t _h) {
+    w = _w;
+    h = _h;
+    albedo.assign(w * h, Spectrum{});
+    normal.assign(w * h, Vec3{});
+    depth.assign(w * h, 0.0f);
+}
+
+static Spectrum safe_albedo(Spectrum a) {
+    return Spectrum(std::max(a.r, min_albedo), std::max(a.g, min_albedo),
+                    std::max(a.b, min_albedo));
+}
+
+// Compresses HDR values into [0,1) so the color weight behaves the same at any exposure
+static Spectrum compress(Spectrum c) {
+    return Spectrum(c.r / (1.0f + c.r), c.g / (1.0f + c.g), c.b / (1.0f + c.b));
+}
+
+static float dist2(Spectrum a, Spectrum b) {
+    Spectrum d = a - b;
+    return d.r * d.r + d.g * d.g + d.b * d.b;
+}
+
+void denoise(const HDR_Image& color, const Feature_Buffers& features, HDR_Image& out,
+             int iterations) {
+
+    auto [w, h] = color.dimension();
+    assert(features.w == w && features.h == h);
+
+    size_t n = w * h;
+    if(n == 0) return;
+
+    std::vector<Spectrum> src(n), dst(n);
+
+    parallel_for(h, tile_rows, [&](size_t y0, size_t y1) {
+        for(size_t i = y0 * w; i < y1 * w; i++) {
+            Spectrum a = safe_albedo(features.albedo[i]);
+            Spectrum c = color.at(i);
+            src[i] = Spectrum(c.r / a.r, c.g / a.g, c.b / a.b);
+        }
+    });
+
+    static const float kernel[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+    for(int iter = 0; iter < iterations; iter++) {
+
+        long step = 1l << iter;
+        float sigma_c = sigma_color * std::pow(2.0f, -(float)iter);
+
+        parallel_for(h, tile_rows, [&](size_t y0, size_t y1) {
+            for(size_t y = y0; y < y1; y++) {
+                for(size_t x = 0; x < w; x++) {
+
+                    size_t p = y * w + x;
+                    Spectrum cp = compress(src[p]);
+                    Vec3 np = features.normal[p];
+                    float zp = features.depth[p];
+                    Spectrum ap = features.albedo[p];
+
+                    Spectrum sum;
+                    float total = 0.0f;
+
+                    for(int dy = -2; dy <= 2; dy++) {
+                        long qy = (long)y + dy * step;
+                        if(qy < 0 || qy >= (long)h) continue;
+
+                        for(int dx = -2; dx <= 2; dx++) {
+                            long qx = (long)x + dx * step;
+                            if(qx < 0 || qx >= (long)w) continue;
+
+                            size_t q = (size_t)qy * w + (size_t)qx;
+                            float zq = features.depth[q];
+
+                            // Never mix surface pixels with background pixels
+                            if((zp == 0.0f) != (zq == 0.0f)) continue;
+
+                            float weight = kernel[std::abs(dx)] * kernel[std::abs(dy)];
+                            weight *=
+                                std::exp(-dist2(cp, compress(src[q])) / (sigma_c * sigma_c));
+
+                            if(zp > 0.0f) {
+                                float offset = step * std::sqrt((float)(dx * dx + dy * dy));
+                                float n_dot = std::max(dot(np, features.normal[q]), 0.0f);
+                                weight *= std::pow(n_dot, sigma_normal);
+                                weight *= std::exp(-std::abs(zp - zq) /
+                                                   (sigma_depth * zp * offset + EPS_F));
+                                weight *= std::exp(-dist2(ap, features.albedo[q]) /
+                                                   (sigma_albedo * sigma_albedo));
+                            }
+
+                            sum += src[q] * weight;
+                            total += weight;
+                        }
+                    }
+
+                    // The center tap always has full weight, so total > 0
+                    dst[p] = sum * (1.0f / total);
+                }
+            }
+        });
+
+        std::swap(src, dst);
+    }
+
+    parallel_for(h, tile_rows, [&](size_t y0, size_t y1) {
+        for(size_t i = y0 * w; i < y1 * w; i++) {
+            dst[i] = src[i] * safe_albedo(features.albedo[i]);
+        }
+    });
+
+    if(out.dimension() != std::make_pair(w, h)) out.resize(w, h);
+    for(size_t i = 0; i < n; i++) out.at(i) = dst[i];
+}
+
+size_t denoise_radius(int iterations) {
+    return 2 * ((size_t(1) << iterations) - 1);
+}
+
+} // namespace PT
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+#include "../lib/mathlib.h"
+#include "../lib/spectrum.h"
+#include "../util/hdr_image.h"
+
+namespace PT {
+
+// First-hit surface attributes used to guide the denoiser.
+// Pixels whose camera ray escapes the scene are stored with zero depth.
+struct Feature_Buffers {
+
+    void resize(size_t w, size_t h);
+
+    size_t w = 0, h = 0;
+    std::vector<Spectrum> albedo;
+    std::vector<Vec3> normal;
+    std::vector<float> depth;
+};
+
+// Edge-avoiding A-Trous wavelet filter (Dammertz et al. 2010). The color is divided by
+// albedo before filtering so texture detail survives, and the normal/depth buffers stop
+// the kernel from spreading across geometric edges. Rows are filtered in parallel tiles.
+void denoise(const HDR_Image& color, const Feature_Buffers& features, HDR_Image& out,
+             int iterations = 5);
+
+// How many pixels away denoise() can pull color from, i.e. how much border a separately
+// denoised region of the image needs to match its neighbors.
+size_t denoise_radius(int iterations = 5);
+
+} // namespace PT
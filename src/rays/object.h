@@ -7,6 +7,7 @@
 
 #include "bvh.h"
 #include "list.h"
+#include "particle_cloud.h"
 #include "shapes.h"
 #include "trace.h"
 #include "tri_mesh.h"
@@ -23,6 +24,10 @@ public:
         : trans(T), itrans(T.inverse()), _id(id), material(m), underlying(std::move(tri_mesh)) {
         has_trans = trans != Mat4::I;
     }
+    Object(Particle_Cloud&& cloud, Scene_ID id, unsigned int m = 0, const Mat4& T = Mat4::I)
+        : trans(T), itrans(T.inverse()), _id(id), material(m), underlying(std::move(cloud)) {
+        has_trans = trans != Mat4::I;
+    }
     Object(List<Object>&& list, Scene_ID id, unsigned int m = 0, const Mat4& T = Mat4::I)
         : trans(T), itrans(T.inverse()), _id(id), material(m), underlying(std::move(list)) {
         has_trans = trans != Mat4::I;
@@ -60,6 +65,9 @@ public:
             overloaded{
                 [&](const BVH<Object>& bvh) { return bvh.visualize(lines, active, level, next); },
                 [&](const Tri_Mesh& mesh) { return mesh.visualize(lines, active, level, next); },
+                [&](const Particle_Cloud& cloud) {
+                    return cloud.visualize(lines, active, level, next);
+                },
                 [](const auto&) { return size_t(0); }},
             underlying);
     }
@@ -78,7 +86,7 @@ private:
     Mat4 trans, itrans;
     unsigned int material;
     Scene_ID _id;
-    std::variant<Tri_Mesh, Shape, BVH<Object>, List<Object>> underlying;
+    std::variant<Tri_Mesh, Particle_Cloud, Shape, BVH<Object>, List<Object>> underlying;
 };
 
 } // namespace PT
\ No newline at end of file
@@ -0,0 +1,48 @@
+
+#include "particle_cloud.h"
+#include "shapes.h"
+
+namespace PT {
+
+BBox Particle_Sphere::bbox() const {
+    return BBox(center - Vec3(radius), center + Vec3(radius));
+}
+
+Trace Particle_Sphere::hit(const Ray& ray) const {
+
+    Ray local = ray;
+    local.point -= center;
+
+    Trace ret = Sphere(radius).hit(local);
+    if(ret.hit) {
+        ret.origin = ray.point;
+        ret.position += center;
+        ray.dist_bounds.y = local.dist_bounds.y;
+    }
+    return ret;
+}
+
+Particle_Cloud::Particle_Cloud(const std::vector<Vec3>& centers, float radius) {
+
+    std::vector<Particle_Sphere> prims;
+    prims.reserve(centers.size());
+    for(Vec3 c : centers) {
+        prims.push_back(Particle_Sphere(c, radius));
+    }
+    spheres.build(std::move(prims), 4);
+}
+
+BBox Particle_Cloud::bbox() const {
+    return spheres.bbox();
+}
+
+Trace Particle_Cloud::hit(const Ray& ray) const {
+    return spheres.hit(ray);
+}
+
+size_t Particle_Cloud::visualize(GL::Lines& lines, GL::Lines& active, size_t level,
+                                 const Mat4& trans) const {
+    return spheres.visualize(lines, active, level, trans);
+}
+
+} // namespace PT
@@ -0,0 +1,51 @@
+
+#pragma once
+
+#include "../lib/mathlib.h"
+#include "../platform/gl.h"
+
+#include "bvh.h"
+#include "trace.h"
+
+namespace PT {
+
+class Particle_Sphere {
+public:
+    Particle_Sphere(Vec3 center, float radius) : center(center), radius(radius) {
+    }
+
+    BBox bbox() const;
+    Trace hit(const Ray& ray) const;
+
+    size_t visualize(GL::Lines&, GL::Lines&, size_t, const Mat4&) const {
+        return size_t(0);
+    }
+
+private:
+    Vec3 center;
+    float radius;
+};
+
+// The particles of an emitter traced as analytic spheres, with one BVH over all of their
+// centers. Much smaller and faster to build than an instanced mesh per particle, and
+// the intersections are exact.
+class Particle_Cloud {
+public:
+    Particle_Cloud() = default;
+    Particle_Cloud(const std::vector<Vec3>& centers, float radius);
+
+    Particle_Cloud(Particle_Cloud&& src) = default;
+    Particle_Cloud& operator=(Particle_Cloud&& src) = default;
+    Particle_Cloud(const Particle_Cloud& src) = delete;
+    Particle_Cloud& operator=(const Particle_Cloud& src) = delete;
+
+    BBox bbox() const;
+    Trace hit(const Ray& ray) const;
+
+    size_t visualize(GL::Lines& lines, GL::Lines& active, size_t level, const Mat4& trans) const;
+
+private:
+    BVH<Particle_Sphere> spheres;
+};
+
+} // namespace PT
@@ -2,14 +2,17 @@
 #include "pathtracer.h"
 #include "../geometry/util.h"
 #include "../gui/render.h"
+#include "../util/rand.h"
 
 #include <SDL2/SDL.h>
+#include <random>
 #include <thread>
 
 namespace PT {
 
-Pathtracer::Pathtracer(Gui::Widget_Render& gui, Vec2 screen_dim)
-    : thread_pool(std::thread::hardware_concurrency()), gui(gui), camera(screen_dim) {
+Pathtracer::Pathtracer(Gui::Widget_Render& gui, Vec2 screen_dim, size_t threads)
+    : n_threads(threads ? threads : std::thread::hardware_concurrency()), thread_pool(n_threads),
+      gui(gui), camera(screen_dim) {
     accumulator_samples = 0;
     total_epochs = 0;
     completed_epochs = 0;
@@ -145,13 +148,22 @@ void Pathtracer::build_scene(Scene& layout_scene) {
             unsigned int idx = (unsigned int)materials.size();
             materials.push_back(BSDF(BSDF_Diffuse(particles.opt.color)));
 
+            if(particles.opt.spheres) {
+                thread_pool.enqueue([&, idx]() {
+                    Particle_Cloud cloud(particles.get_particles().pos, particles.sphere_radius());
+                    std::lock_guard<std::mutex> lock(obj_mut);
+                    obj_list.push_back(Object(std::move(cloud), particles.id(), idx));
+                });
+                return;
+            }
+
             thread_pool.enqueue([&, idx]() {
                 Tri_Mesh mesh(particles.mesh());
 
-                const auto& parts = particles.get_particles();
-                for(const Particle& p : parts) {
+                const Particle_Store& parts = particles.get_particles();
+                for(Vec3 pos : parts.pos) {
                     Tri_Mesh copy = mesh.copy();
-                    Mat4 T = Mat4::translate(p.pos) * Mat4::scale(Vec3{particles.opt.scale});
+                    Mat4 T = Mat4::translate(pos) * Mat4::scale(Vec3{particles.opt.scale});
 
                     std::lock_guard<std::mutex> lock(obj_mut);
                     obj_list.push_back(Object(std::move(copy), particles.id(), idx, T));
@@ -172,48 +184,158 @@ void Pathtracer::set_sizes(size_t w, size_t h, size_t samples, size_t area_sampl
     n_samples = samples;
     n_area_samples = area_samples;
     max_depth = depth;
-    accumulator.resize(out_w, out_h);
+    reset_accumulator(0, out_h);
+}
+
+void Pathtracer::set_samples(size_t samples) {
+    n_samples = samples;
+}
+
+void Pathtracer::set_denoise(bool enable) {
+    if(enable != denoise_enabled) {
+        denoise_enabled = enable;
+        denoise_dirty = true;
+    }
 }
 
 void Pathtracer::log_ray(const Ray& ray, float t, Spectrum color) {
     gui.log_ray(ray, t, color);
 }
 
-void Pathtracer::accumulate(const HDR_Image& sample) {
+void Pathtracer::accumulate(const HDR_Image& sum, const std::vector<unsigned int>& counts,
+                            size_t samples) {
 
     std::lock_guard<std::mutex> lock(accumulator_mut);
 
     accumulator_samples++;
-    for(size_t j = 0; j < out_h; j++) {
-        for(size_t i = 0; i < out_w; i++) {
-            Spectrum& s = accumulator.at(i, j);
-            const Spectrum& n = sample.at(i, j);
-            s += (n - s) * (1.0f / accumulator_samples);
-        }
+    pixel_samples_taken += samples;
+    denoise_dirty = true;
+    for(size_t i = 0; i < out_w * band_h; i++) {
+        if(!counts[i]) continue;
+        unsigned int& total = sample_counts[i];
+        total += counts[i];
+        Spectrum& s = accumulator.at(i);
+        s += (sum.at(i) - s * (float)counts[i]) * (1.0f / total);
     }
 }
 
 void Pathtracer::do_trace(size_t samples) {
 
-    HDR_Image sample(out_w, out_h);
-    for(size_t j = 0; j < out_h; j++) {
+    HDR_Image sum(out_w, band_h);
+    std::vector<unsigned int> counts(out_w * band_h, 0);
+    for(size_t j = 0; j < band_h; j++) {
         for(size_t i = 0; i < out_w; i++) {
 
-            size_t sampled = 0;
+            size_t idx = j * out_w + i;
             for(size_t s = 0; s < samples; s++) {
 
-                Spectrum p = trace_pixel(i, j);
+                Spectrum p = trace_pixel(i, band_y0 + j);
                 if(p.valid()) {
-                    sample.at(i, j) += p;
-                    sampled++;
+                    sum.at(idx) += p;
+                    counts[idx]++;
                 }
 
                 if(cancel_flag) return;
             }
-            sample.at(i, j) *= (1.0f / sampled);
         }
     }
-    accumulate(sample);
+    accumulate(sum, counts, samples);
+}
+
+void Pathtracer::trace_features() {
+
+    // Average a 2x2 grid of sub-pixel camera rays so feature edges are anti-aliased
+    // roughly the same way as the path-traced color.
+    static const size_t grid = 2;
+
+    features.resize(out_w, band_h);
+    Vec2 wh((float)out_w, (float)out_h);
+
+    parallel_for(band_h, 8, [&, this](size_t y0, size_t y1) {
+        for(size_t j = y0; j < y1; j++) {
+            for(size_t i = 0; i < out_w; i++) {
+
+                Spectrum albedo;
+                Vec3 normal;
+                float depth = 0.0f;
+                size_t hits = 0;
+
+                for(size_t s = 0; s < grid * grid; s++) {
+                    Vec2 xy((float)i + ((s % grid) + 0.5f) / grid,
+                            (float)(band_y0 + j) + ((s / grid) + 0.5f) / grid);
+                    Ray ray = camera.generate_ray(xy / wh);
+                    Trace hit = scene.hit(ray);
+                    if(!hit.hit) continue;
+
+                    if(dot(hit.normal, ray.dir) > 0.0f) hit.normal = -hit.normal;
+                    albedo += materials[hit.material].albedo();
+                    normal += hit.normal;
+                    depth += hit.distance;
+                    hits++;
+                }
+
+                size_t idx = j * out_w + i;
+                if(hits) {
+                    features.albedo[idx] = albedo * (1.0f / hits);
+                    features.normal[idx] = normal.unit();
+                    features.depth[idx] = depth / hits;
+                } else {
+                    features.albedo[idx] = Spectrum(1.0f);
+                }
+            }
+        }
+    });
+    features_dirty = false;
+}
+
+void Pathtracer::update_denoised() {
+    if(!denoise_dirty) return;
+    if(features_dirty) trace_features();
+    denoise(accumulator, features, denoised);
+    denoise_dirty = false;
+}
+
+void Pathtracer::do_tile(size_t tile, size_t first_sample, size_t samples) {
+
+    size_t tiles_x = (out_w + tile_size - 1) / tile_size;
+    size_t x0 = (tile % tiles_x) * tile_size, y0 = (tile / tiles_x) * tile_size;
+    size_t x1 = std::min(x0 + tile_size, out_w), y1 = std::min(y0 + tile_size, out_h);
+    size_t tw = x1 - x0;
+
+    std::vector<Spectrum> sum(tw * (y1 - y0));
+    std::vector<unsigned int> counts(sum.size(), 0);
+
+    // Every (tile, sample index) pair gets its own random stream, so the result does not
+    // depend on how many threads or processes the job was spread across.
+    for(size_t s = 0; s < samples; s++) {
+        RNG::seed(render_seed, (unsigned int)(first_sample + s), (unsigned int)tile + 1);
+        for(size_t j = y0; j < y1; j++) {
+            for(size_t i = x0; i < x1; i++) {
+                Spectrum p = trace_pixel(i, j);
+                if(p.valid()) {
+                    size_t idx = (j - y0) * tw + (i - x0);
+                    sum[idx] += p;
+                    counts[idx]++;
+                }
+            }
+            if(cancel_flag) return;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(accumulator_mut);
+
+    accumulator_samples++;
+    denoise_dirty = true;
+    for(size_t j = y0; j < y1; j++) {
+        for(size_t i = x0; i < x1; i++) {
+            size_t idx = (j - y0) * tw + (i - x0);
+            if(!counts[idx]) continue;
+            unsigned int& total = sample_counts[j * out_w + i];
+            total += counts[idx];
+            Spectrum& s = accumulator.at(i, j);
+            s += (sum[idx] - s * (float)counts[idx]) * (1.0f / total);
+        }
+    }
 }
 
 bool Pathtracer::in_progress() const {
@@ -233,29 +355,119 @@ size_t Pathtracer::visualize_bvh(GL::Lines& lines, GL::Lines& active, size_t dep
     return scene.visualize(lines, active, depth, Mat4::I);
 }
 
-void Pathtracer::begin_render(Scene& layout_scene, const Camera& cam, bool add_samples) {
+void Pathtracer::reset_accumulator(size_t y0, size_t rows) {
+
+    band_y0 = y0;
+    band_h = rows;
+    if(accumulator.dimension() != std::make_pair(out_w, band_h)) {
+        accumulator.resize(out_w, band_h);
+    } else {
+        accumulator.clear({});
+    }
+    sample_counts.assign(out_w * band_h, 0);
+    accumulator_samples = 0;
+    pixel_samples_taken = 0;
+    features_dirty = true;
+    denoise_dirty = true;
+}
+
+void Pathtracer::enqueue_epochs() {
 
-    size_t n_threads = std::thread::hardware_concurrency();
     size_t samples_per_epoch = std::max(size_t(1), n_samples / (n_threads * 10));
 
-    cancel();
     total_epochs = n_samples / samples_per_epoch + !!(n_samples % samples_per_epoch);
+    render_time = total_epochs ? SDL_GetPerformanceCounter() : 0;
 
-    if(!add_samples) {
-        accumulator.clear({});
-        accumulator_samples = 0;
+    for(size_t s = 0; s < n_samples; s += samples_per_epoch) {
+        size_t samples = (s + samples_per_epoch) > n_samples ? n_samples - s : samples_per_epoch;
+        unsigned int epoch = (unsigned int)next_epoch++;
+        thread_pool.enqueue([samples, epoch, this]() {
+            RNG::seed(render_seed, epoch);
+            do_trace(samples);
+            size_t completed = completed_epochs.fetch_add(1);
+            if(completed + 1 == total_epochs) {
+                Uint64 done = SDL_GetPerformanceCounter();
+                render_time = done - render_time;
+            }
+        });
+    }
+}
+
+void Pathtracer::begin_render(Scene& layout_scene, const Camera& cam, bool add_samples) {
+
+    cancel();
+
+    if(!add_samples || partial || band_h != out_h) {
+        partial = false;
+        reset_accumulator(0, out_h);
+        render_seed = std::random_device()();
+        next_epoch = 0;
+    }
+    if(!add_samples || !scene_built) {
         build_time = SDL_GetPerformanceCounter();
         build_scene(layout_scene);
         build_time = SDL_GetPerformanceCounter() - build_time;
+        scene_built = true;
     }
-    render_time = SDL_GetPerformanceCounter();
-    
+
     camera = cam;
+    enqueue_epochs();
+}
 
-    for(size_t s = 0; s < n_samples; s += samples_per_epoch) {
-        size_t samples = (s + samples_per_epoch) > n_samples ? n_samples - s : samples_per_epoch;
-        thread_pool.enqueue([samples, this]() {
-            do_trace(samples);
+void Pathtracer::begin_band(Scene& layout_scene, const Camera& cam, size_t y0, size_t rows) {
+
+    cancel();
+
+    partial = false;
+    reset_accumulator(std::min(y0, out_h), std::min(rows, out_h - std::min(y0, out_h)));
+
+    // The first band builds the scene; the rest share it
+    if(!scene_built) {
+        render_seed = std::random_device()();
+        next_epoch = 0;
+        build_time = SDL_GetPerformanceCounter();
+        build_scene(layout_scene);
+        build_time = SDL_GetPerformanceCounter() - build_time;
+        scene_built = true;
+    }
+
+    camera = cam;
+    enqueue_epochs();
+}
+
+size_t Pathtracer::n_tiles() const {
+    return ((out_w + tile_size - 1) / tile_size) * ((out_h + tile_size - 1) / tile_size);
+}
+
+void Pathtracer::begin_partial(Scene& layout_scene, const Camera& cam, size_t tile_begin,
+                               size_t tile_end, size_t sample_offset, unsigned int seed) {
+
+    cancel();
+
+    tile_end = std::min(tile_end, n_tiles());
+    tile_begin = std::min(tile_begin, tile_end);
+    total_epochs = tile_end - tile_begin;
+
+    reset_accumulator(0, out_h);
+    render_seed = seed;
+    next_epoch = 0;
+
+    partial = true;
+    partial_tile_begin = tile_begin;
+    partial_tile_end = tile_end;
+    partial_sample_offset = sample_offset;
+
+    build_time = SDL_GetPerformanceCounter();
+    build_scene(layout_scene);
+    build_time = SDL_GetPerformanceCounter() - build_time;
+    scene_built = true;
+
+    render_time = total_epochs ? SDL_GetPerformanceCounter() : 0;
+    camera = cam;
+
+    for(size_t t = tile_begin; t < tile_end; t++) {
+        thread_pool.enqueue([t, sample_offset, this]() {
+            do_tile(t, sample_offset, n_samples);
             size_t completed = completed_epochs.fetch_add(1);
             if(completed + 1 == total_epochs) {
                 Uint64 done = SDL_GetPerformanceCounter();
@@ -275,13 +487,78 @@ void Pathtracer::cancel() {
     render_time = SDL_GetPerformanceCounter() - render_time;
 }
 
+size_t Pathtracer::samples_taken() const {
+    return pixel_samples_taken;
+}
+
+std::string Pathtracer::save_checkpoint(std::string file) {
+
+    if(band_h != out_h) return "Band renders can't be checkpointed!";
+
+    Checkpoint ckpt;
+    {
+        std::lock_guard<std::mutex> lock(accumulator_mut);
+        ckpt.w = out_w;
+        ckpt.h = out_h;
+        ckpt.samples = partial ? n_samples : pixel_samples_taken;
+        ckpt.seed = render_seed;
+        ckpt.next_epoch = next_epoch;
+        if(partial) {
+            ckpt.tile_size = tile_size;
+            ckpt.tile_begin = partial_tile_begin;
+            ckpt.tile_end = partial_tile_end;
+            ckpt.sample_offset = partial_sample_offset;
+        }
+        ckpt.mean.resize(out_w * out_h);
+        for(size_t i = 0; i < out_w * out_h; i++) ckpt.mean[i] = accumulator.at(i);
+        ckpt.counts = sample_counts;
+    }
+    return ckpt.save(file);
+}
+
+std::string Pathtracer::load_checkpoint(std::string file) {
+
+    Checkpoint ckpt;
+    std::string err = ckpt.load(file);
+    if(!err.empty()) return err;
+
+    if(ckpt.tile_size) {
+        return "File " + file + " is a partial render; merge it before resuming!";
+    }
+    if(ckpt.w != out_w || ckpt.h != out_h) {
+        return "Checkpoint is " + std::to_string(ckpt.w) + "x" + std::to_string(ckpt.h) +
+               ", but the render is " + std::to_string(out_w) + "x" + std::to_string(out_h) +
+               "!";
+    }
+
+    cancel();
+    partial = false;
+    reset_accumulator(0, out_h);
+
+    std::lock_guard<std::mutex> lock(accumulator_mut);
+    for(size_t i = 0; i < out_w * out_h; i++) accumulator.at(i) = ckpt.mean[i];
+    sample_counts = std::move(ckpt.counts);
+    pixel_samples_taken = ckpt.samples;
+    accumulator_samples = ckpt.samples ? 1 : 0;
+    render_seed = ckpt.seed;
+    next_epoch = ckpt.next_epoch;
+    return {};
+}
+
 const HDR_Image& Pathtracer::get_output() {
-    return accumulator;
+    if(!denoise_enabled || in_progress() || !accumulator_samples) return accumulator;
+    std::lock_guard<std::mutex> lock(accumulator_mut);
+    update_denoised();
+    return denoised;
 }
 
 const GL::Tex2D& Pathtracer::get_output_texture(float exposure) {
     std::lock_guard<std::mutex> lock(accumulator_mut);
-    return accumulator.get_texture(exposure);
+    if(!denoise_enabled || in_progress() || !accumulator_samples) {
+        return accumulator.get_texture(exposure);
+    }
+    update_denoised();
+    return denoised.get_texture(exposure);
 }
 
 } // namespace PT
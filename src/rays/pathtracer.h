@@ -11,6 +11,8 @@
 #include "../util/thread_pool.h"
 
 #include "bsdf.h"
+#include "checkpoint.h"
+#include "denoiser.h"
 #include "env_light.h"
 #include "light.h"
 #include "object.h"
@@ -23,39 +25,81 @@ namespace PT {
 
 class Pathtracer {
 public:
-    Pathtracer(Gui::Widget_Render& gui, Vec2 screen_dim);
+    // threads = 0 uses every hardware thread
+    Pathtracer(Gui::Widget_Render& gui, Vec2 screen_dim, size_t threads = 0);
     ~Pathtracer();
 
     void set_sizes(size_t w, size_t h, size_t pixel_samples, size_t area_samples, size_t depth);
+    void set_samples(size_t pixel_samples);
+    void set_denoise(bool enable);
 
     const HDR_Image& get_output();
     const GL::Tex2D& get_output_texture(float exposure);
     size_t visualize_bvh(GL::Lines& lines, GL::Lines& active, size_t level);
 
     void begin_render(Scene& scene, const Camera& camera, bool add_samples = false);
+    void begin_partial(Scene& scene, const Camera& camera, size_t tile_begin, size_t tile_end,
+                       size_t sample_offset, unsigned int seed);
+    void begin_band(Scene& scene, const Camera& camera, size_t y0, size_t rows);
+    size_t n_tiles() const;
     void cancel();
     bool in_progress() const;
     float progress() const;
     std::pair<float, float> completion_time() const;
 
+    std::string save_checkpoint(std::string file);
+    std::string load_checkpoint(std::string file);
+    size_t samples_taken() const;
+
+    // Partial renders split the image into square tiles of this size
+    static const inline size_t tile_size = 32;
+
 private:
     // Internal
     void build_scene(Scene& scene);
     void build_lights(Scene& scene, std::vector<Object>& objs);
+    void reset_accumulator(size_t y0, size_t rows);
+    void enqueue_epochs();
     void do_trace(size_t samples);
-    void accumulate(const HDR_Image& sample);
+    void do_tile(size_t tile, size_t first_sample, size_t samples);
+    void accumulate(const HDR_Image& sum, const std::vector<unsigned int>& counts, size_t samples);
+    void trace_features();
+    void update_denoised();
     bool tonemap();
 
     Gui::Widget_Render& gui;
     unsigned long long render_time, build_time;
+    size_t n_threads;
     Thread_Pool thread_pool;
     bool cancel_flag = false;
 
+    // Covers pixel rows [band_y0, band_y0 + band_h), which is the whole image except when
+    // rendering in bands to bound memory use
     HDR_Image accumulator;
+    size_t band_y0 = 0, band_h = 0;
     std::mutex accumulator_mut;
     size_t total_epochs, accumulator_samples;
     std::atomic<size_t> completed_epochs;
 
+    // Per-pixel valid sample counts and the pixel samples folded into the accumulator
+    std::vector<unsigned int> sample_counts;
+    size_t pixel_samples_taken = 0;
+
+    // Each epoch seeds its RNG from (render_seed, epoch index) so that a resumed render
+    // continues the same sample stream instead of repeating it.
+    unsigned int render_seed = 0;
+    size_t next_epoch = 0;
+    bool scene_built = false;
+
+    // Set while rendering a tile/sample subset for a distributed job
+    bool partial = false;
+    size_t partial_tile_begin = 0, partial_tile_end = 0, partial_sample_offset = 0;
+
+    // Denoised copy of the accumulator, rebuilt lazily once rendering is done
+    Feature_Buffers features;
+    HDR_Image denoised;
+    bool denoise_enabled = false, denoise_dirty = true, features_dirty = true;
+
     /// Relevant to student
     Spectrum trace_pixel(size_t x, size_t y);
     Spectrum trace_ray(const Ray& ray);
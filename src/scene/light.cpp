@@ -37,6 +37,11 @@ void Scene_Light::set_time(float time) {
     dirty();
 }
 
+void Scene_Light::bake(size_t frames) {
+    lanim.splines.bake(frames);
+    anim.splines.bake(frames);
+}
+
 void Scene_Light::emissive_clear() {
     opt.has_emissive_map = false;
 }
@@ -32,6 +32,7 @@ public:
 
     Spectrum radiance() const;
     void set_time(float time);
+    void bake(size_t frames);
 
     std::string emissive_load(std::string file);
     std::string emissive_loaded() const;
@@ -82,6 +82,12 @@ void Scene_Object::set_time(float time) {
     if(material.anim.splines.any()) material.anim.at(time, material.opt);
 }
 
+void Scene_Object::bake(size_t frames) {
+    anim.splines.bake(frames);
+    armature.bake(frames);
+    material.anim.splines.bake(frames);
+}
+
 bool Scene_Object::is_editable() const {
     return editable && opt.shape_type == PT::Shape_Type::none;
 }
@@ -117,11 +123,15 @@ const Halfedge_Mesh& Scene_Object::get_mesh() const {
 void Scene_Object::sync_anim_mesh() {
     sync_mesh();
     if(skel_dirty && armature.has_bones()) {
-        vertex_joints.clear();
-        armature.find_joints(_mesh, vertex_joints);
+        Skeleton::Influences influences;
+        armature.find_joints(_mesh, influences);
+        armature.bind_skin(_mesh, influences, skin_weights);
+        // Skinning reuses the posed mesh's buffers, so start them from the new mesh
+        _anim_mesh.recreate(std::vector<GL::Mesh::Vert>(_mesh.verts()),
+                            std::vector<GL::Mesh::Index>(_mesh.indices()));
     }
     if(pose_dirty && armature.has_bones()) {
-        armature.skin(_mesh, _anim_mesh, vertex_joints);
+        armature.skin(_mesh, _anim_mesh, skin_weights);
         if(!opt.smooth_normals) {
             auto& verts = _anim_mesh.edit_verts();
             auto& idxs = _anim_mesh.edit_indices();
@@ -155,15 +165,18 @@ void Scene_Object::sync_mesh() {
 }
 
 void Scene_Object::set_pose_dirty() {
+    armature.set_fk_dirty();
     pose_dirty = true;
 }
 
 void Scene_Object::set_skel_dirty() {
+    armature.set_fk_dirty();
     skel_dirty = true;
     pose_dirty = true;
 }
 
 void Scene_Object::set_mesh_dirty() {
+    halfedge.mark_dirty();
     rig_dirty = true;
     mesh_dirty = true;
     skel_dirty = true;
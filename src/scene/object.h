@@ -27,6 +27,7 @@ public:
     void sync_mesh();
     void sync_anim_mesh();
     void set_time(float time);
+    void bake(size_t frames);
 
     const GL::Mesh& mesh();
     const GL::Mesh& posed_mesh();
@@ -73,7 +74,7 @@ private:
     Halfedge_Mesh halfedge;
 
     mutable GL::Mesh _mesh, _anim_mesh;
-    mutable std::unordered_map<unsigned int, std::vector<Joint*>> vertex_joints;
+    mutable Skeleton::Skin_Weights skin_weights;
     mutable bool editable = true;
     mutable bool mesh_dirty = false;
     mutable bool skel_dirty = false, pose_dirty = false;
@@ -0,0 +1,328 @@
+
+#include "particle_cache.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <unordered_map>
+
+// The last character is the format version; files from other versions are stale caches
+static const char magic[8] = {'S', '3', 'D', 'P', 'A', 'R', 'T', '2'};
+
+struct Cache_Header {
+    char magic[8];
+    float frame_dt;
+    uint32_t pad;
+    uint64_t scene_hash;
+};
+
+struct Frame_Header {
+    int32_t frame;
+    uint32_t emitters;
+};
+
+struct Emitter_Header {
+    uint32_t id;
+    uint32_t steps;
+    double cooldown;
+    uint64_t count;
+};
+
+static uint64_t payload_size(uint64_t count) {
+    return count * (2 * sizeof(Vec3) + sizeof(float));
+}
+
+// FNV-1a over the bytes of every value mixed in
+struct Hasher {
+    uint64_t hash = 14695981039346656037ull;
+
+    void bytes(const void* data, size_t size) {
+        const unsigned char* b = (const unsigned char*)data;
+        for(size_t i = 0; i < size; i++) {
+            hash = (hash ^ b[i]) * 1099511628211ull;
+        }
+    }
+    template<typename T> void operator()(const T& value) {
+        bytes(&value, sizeof(T));
+    }
+};
+
+uint64_t Particle_Cache::scene_hash(Scene& scene) {
+
+    Hasher mix;
+
+    auto mix_pose = [&](const Pose& pose, const Anim_Pose& anim) {
+        if(!anim.splines.any()) mix(pose);
+        for(float t : anim.splines.keys()) {
+            mix(t);
+            mix(anim.at(t));
+        }
+    };
+
+    // Only the options that change how particles move; color and tracing don't
+    auto mix_emitter = [&](const Scene_Particles::Options& opt) {
+        mix(opt.velocity);
+        mix(opt.angle);
+        mix(opt.scale);
+        mix(opt.lifetime);
+        mix(opt.pps);
+        mix(opt.enabled);
+        mix(opt.collisions);
+    };
+
+    // Follows Simulate::build_scene: particles collide with objects and rectangle lights
+    scene.for_items([&](Scene_Item& item) {
+        if(item.is<Scene_Particles>()) {
+
+            Scene_Particles& emitter = item.get<Scene_Particles>();
+            mix(emitter.id());
+            mix_pose(emitter.pose, emitter.anim);
+            if(!emitter.panim.splines.any()) mix_emitter(emitter.opt);
+            for(float t : emitter.panim.splines.keys()) {
+                Scene_Particles::Options opt = emitter.opt;
+                emitter.panim.at(t, opt);
+                mix(t);
+                mix_emitter(opt);
+            }
+            mix(emitter.mesh().bbox());
+
+        } else if(item.is<Scene_Object>()) {
+
+            Scene_Object& obj = item.get<Scene_Object>();
+            mix(obj.id());
+            mix_pose(obj.pose, obj.anim);
+            if(obj.is_shape()) {
+                mix(obj.opt.shape.get<PT::Sphere>().radius);
+            } else {
+                const GL::Mesh& mesh = obj.mesh();
+                for(const GL::Mesh::Vert& v : mesh.verts()) mix(v.pos);
+                mix.bytes(mesh.indices().data(), mesh.indices().size() * sizeof(GL::Mesh::Index));
+            }
+
+            // The skeleton poses the mesh the particles collide with
+            mix(obj.armature.base());
+            obj.armature.for_joints([&](Joint* j) {
+                mix(j->extent);
+                mix(j->radius);
+                if(!j->anim.any()) mix(j->pose);
+                for(float t : j->anim.keys()) {
+                    mix(t);
+                    mix(j->anim.at(t));
+                }
+            });
+
+        } else if(item.is<Scene_Light>()) {
+
+            Scene_Light& light = item.get<Scene_Light>();
+            if(light.opt.type != Light_Type::rectangle) return;
+            mix(light.id());
+            mix_pose(light.pose, light.anim);
+            if(!light.lanim.splines.any()) mix(light.opt.size);
+            for(float t : light.lanim.splines.keys()) {
+                Scene_Light::Options opt = light.opt;
+                light.lanim.at(t, opt);
+                mix(t);
+                mix(opt.size);
+            }
+        }
+    });
+
+    return mix.hash;
+}
+
+std::string Particle_Cache::open(std::string f, float dt, uint64_t scene_hash) {
+
+    file = std::move(f);
+    frame_dt = dt;
+    hash = scene_hash;
+    frames.clear();
+
+    auto fail = [this](std::string msg) {
+        file.clear();
+        frames.clear();
+        return msg;
+    };
+
+    std::error_code err;
+    bool exists = std::filesystem::exists(file, err);
+    if(err) return fail("Failed to read particle cache " + file + "!");
+    uint64_t file_size = exists ? std::filesystem::file_size(file, err) : 0;
+    if(err) return fail("Failed to read particle cache " + file + "!");
+    if(file_size == 0) return clear();
+
+    std::ifstream in(file, std::ios::binary);
+    if(!in.is_open()) return fail("Failed to read particle cache " + file + "!");
+
+    // Anything but a cache of some version holds data that isn't ours to overwrite
+    Cache_Header header = {};
+    in.read((char*)&header, sizeof(header));
+    if(in.gcount() < (std::streamsize)sizeof(magic) ||
+       !std::equal(std::begin(magic), std::end(magic) - 1, header.magic)) {
+        return fail(file + " is not a particle cache; refusing to overwrite it!");
+    }
+
+    if(!in.good() || header.magic[7] != magic[7] || header.frame_dt != frame_dt ||
+       header.scene_hash != hash) {
+        in.close();
+        return clear();
+    }
+
+    // Index every complete frame; a record cut short by a crash ends the cache
+    end = sizeof(header);
+    while(end < file_size) {
+        Frame_Header frame;
+        in.read((char*)&frame, sizeof(frame));
+        if(!in.good()) break;
+
+        uint64_t size = sizeof(frame);
+        for(uint32_t i = 0; i < frame.emitters && in.good(); i++) {
+            Emitter_Header emitter;
+            in.read((char*)&emitter, sizeof(emitter));
+            in.seekg(payload_size(emitter.count), std::ios::cur);
+            size += sizeof(emitter) + payload_size(emitter.count);
+        }
+        if(!in.good() || end + size > file_size) break;
+
+        frames[frame.frame] = end;
+        end += size;
+    }
+
+    // Drop the partial record so that new frames can be appended after the last good one
+    in.close();
+    if(end < file_size) std::filesystem::resize_file(file, end, err);
+    if(err) return fail("Failed to truncate particle cache " + file + "!");
+    return {};
+}
+
+std::string Particle_Cache::clear() {
+
+    frames.clear();
+    if(file.empty()) return {};
+
+    Cache_Header header = {};
+    std::copy(std::begin(magic), std::end(magic), header.magic);
+    header.frame_dt = frame_dt;
+    header.scene_hash = hash;
+
+    std::ofstream out(file, std::ios::binary | std::ios::trunc);
+    if(!out.is_open()) {
+        std::string err = "Failed to open particle cache " + file + " for writing!";
+        file.clear();
+        return err;
+    }
+    out.write((const char*)&header, sizeof(header));
+    end = sizeof(header);
+    return {};
+}
+
+void Particle_Cache::remove() {
+    if(file.empty()) return;
+    std::remove(file.c_str());
+    file.clear();
+    frames.clear();
+}
+
+bool Particle_Cache::is_open() const {
+    return !file.empty();
+}
+
+bool Particle_Cache::has(int frame) const {
+    return frames.count(frame);
+}
+
+int Particle_Cache::cached_before(int frame) const {
+    auto entry = frames.lower_bound(frame);
+    if(entry == frames.begin()) return -1;
+    return std::prev(entry)->first;
+}
+
+std::string Particle_Cache::save(const Scene& scene, int frame) {
+
+    if(file.empty()) return {};
+
+    std::ofstream out(file, std::ios::binary | std::ios::in | std::ios::out);
+    if(!out.is_open()) return "Failed to open particle cache " + file + " for writing!";
+    out.seekp(end);
+
+    Frame_Header header = {};
+    header.frame = frame;
+    scene.for_items([&](const Scene_Item& item) {
+        if(item.is<Scene_Particles>()) header.emitters++;
+    });
+    out.write((const char*)&header, sizeof(header));
+
+    uint64_t size = sizeof(header);
+    scene.for_items([&](const Scene_Item& item) {
+        if(!item.is<Scene_Particles>()) return;
+
+        const Scene_Particles& emitter = item.get<Scene_Particles>();
+        const Particle_Store& particles = emitter.get_particles();
+        Scene_Particles::Sim_State state = emitter.get_state();
+
+        Emitter_Header e = {};
+        e.id = emitter.id();
+        e.steps = state.steps;
+        e.cooldown = state.cooldown;
+        e.count = particles.size();
+
+        out.write((const char*)&e, sizeof(e));
+        out.write((const char*)particles.pos.data(), e.count * sizeof(Vec3));
+        out.write((const char*)particles.velocity.data(), e.count * sizeof(Vec3));
+        out.write((const char*)particles.age.data(), e.count * sizeof(float));
+        size += sizeof(e) + payload_size(e.count);
+    });
+    if(!out.good()) return "Failed to write particle cache " + file + "!";
+
+    frames[frame] = end;
+    end += size;
+    return {};
+}
+
+std::string Particle_Cache::load(Scene& scene, int frame) const {
+
+    auto entry = frames.find(frame);
+    if(entry == frames.end()) return "Frame " + std::to_string(frame) + " is not cached!";
+
+    std::ifstream in(file, std::ios::binary);
+    if(!in.is_open()) return "Failed to open particle cache " + file + "!";
+    in.seekg(entry->second);
+
+    Frame_Header header;
+    in.read((char*)&header, sizeof(header));
+
+    std::unordered_map<Scene_ID, std::pair<Scene_Particles::Sim_State, Particle_Store>> states;
+    for(uint32_t i = 0; i < header.emitters && in.good(); i++) {
+
+        Emitter_Header e;
+        in.read((char*)&e, sizeof(e));
+
+        Particle_Store particles;
+        particles.pos.resize(e.count);
+        particles.velocity.resize(e.count);
+        particles.age.resize(e.count);
+        in.read((char*)particles.pos.data(), e.count * sizeof(Vec3));
+        in.read((char*)particles.velocity.data(), e.count * sizeof(Vec3));
+        in.read((char*)particles.age.data(), e.count * sizeof(float));
+
+        states[e.id] = {Scene_Particles::Sim_State{e.cooldown, e.steps}, std::move(particles)};
+    }
+    if(!in.good()) return "Particle cache " + file + " is truncated!";
+
+    bool stale = false;
+    scene.for_items([&](const Scene_Item& item) {
+        if(item.is<Scene_Particles>()) stale |= !states.count(item.id());
+    });
+    if(stale || states.size() != header.emitters) {
+        return "Particle cache " + file + " does not match the scene!";
+    }
+
+    scene.for_items([&](Scene_Item& item) {
+        if(!item.is<Scene_Particles>()) return;
+        auto& [state, particles] = states[item.id()];
+        item.get<Scene_Particles>().set_state(state, std::move(particles));
+    });
+    return {};
+}
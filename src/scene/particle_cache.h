@@ -0,0 +1,45 @@
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+class Scene;
+
+// Simulated particle state of every emitter in a scene, per animation frame. Frames are
+// appended to a compact binary file as they are simulated, and only their offsets are kept
+// in memory, so a re-render or scrub can load any cached frame instead of simulating up to
+// it. Opening an existing file picks up the frames it holds, which lets later processes
+// (e.g. a headless re-render) reuse the same bake, as long as their scene hashes the same.
+class Particle_Cache {
+public:
+    // Identifies what the simulation depends on besides the frame time: every emitter's
+    // options and the colliders its particles bounce off. Keyframed values are hashed at
+    // their keys, so the hash does not depend on the time the scene was last set to.
+    static uint64_t scene_hash(Scene& scene);
+
+    // Use this file, keeping the frames already in it if they were simulated at frame_dt
+    // from a scene with the same hash. Only a missing, empty or stale cache file is
+    // (re)created; any other file is left alone and reported as an error.
+    std::string open(std::string file, float frame_dt, uint64_t scene_hash);
+    // Forget every cached frame and truncate the file
+    std::string clear();
+    // Close the cache and delete its file
+    void remove();
+
+    bool is_open() const;
+    bool has(int frame) const;
+    // The latest cached frame before this one, or -1 if there is none
+    int cached_before(int frame) const;
+
+    std::string save(const Scene& scene, int frame);
+    std::string load(Scene& scene, int frame) const;
+
+private:
+    std::string file;
+    float frame_dt = 0.0f;
+    uint64_t hash = 0;
+    uint64_t end = 0;
+    std::map<int, uint64_t> frames;
+};
@@ -1,11 +1,129 @@
 
 #include "../geometry/util.h"
 #include "../rays/pathtracer.h"
-#include "../util/rand.h"
+#include "../util/thread_pool.h"
 
 #include "particles.h"
 #include "renderer.h"
 
+#include <random>
+
+size_t Particle_Store::size() const {
+    return pos.size();
+}
+
+void Particle_Store::add(const Particle& p) {
+    pos.push_back(p.pos);
+    velocity.push_back(p.velocity);
+    age.push_back(p.age);
+}
+
+void Particle_Store::swap_remove(size_t i) {
+    pos[i] = pos.back();
+    velocity[i] = velocity.back();
+    age[i] = age.back();
+    pos.pop_back();
+    velocity.pop_back();
+    age.pop_back();
+}
+
+void Particle_Store::clear() {
+    pos.clear();
+    velocity.clear();
+    age.clear();
+}
+
+void Particle_Grid::cell(Vec3 pos, int& x, int& y, int& z) const {
+    x = (int)std::floor(pos.x * inv_cell);
+    y = (int)std::floor(pos.y * inv_cell);
+    z = (int)std::floor(pos.z * inv_cell);
+}
+
+uint32_t Particle_Grid::bucket(int x, int y, int z) const {
+    // Hashing only x and y puts each column of cells in consecutive buckets, so the cells
+    // around a particle take 9 scattered reads of the table rather than 27
+    return (((uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u) + (uint32_t)z) & mask;
+}
+
+void Particle_Grid::build(Particle_Store& particles, float cell_size) {
+
+    size_t n = particles.size();
+    inv_cell = 1.0f / cell_size;
+
+    int bits = 1;
+    while(((size_t)1 << bits) < 2 * n) bits++;
+    mask = (1u << bits) - 1;
+
+    keys.resize(n);
+    order.resize(n);
+    sorted_keys.resize(n);
+    sorted_order.resize(n);
+
+    parallel_for(n, 4096, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            int x, y, z;
+            cell(particles.pos[i], x, y, z);
+            keys[i] = bucket(x, y, z);
+            order[i] = (uint32_t)i;
+        }
+    });
+
+    // Least significant digit first radix sort, eight bits per pass. Each chunk counts its
+    // digits, then scatters them from its own offsets, which keeps every pass stable.
+    const size_t grain = 16384;
+    size_t chunks = (n + grain - 1) / grain;
+    std::vector<uint32_t> counts(chunks * 256);
+
+    for(int shift = 0; shift < bits; shift += 8) {
+
+        std::fill(counts.begin(), counts.end(), 0);
+        parallel_for(n, grain, [&](size_t begin, size_t end) {
+            uint32_t* count = &counts[begin / grain * 256];
+            for(size_t i = begin; i < end; i++) count[(keys[i] >> shift) & 255]++;
+        });
+
+        uint32_t offset = 0;
+        for(size_t digit = 0; digit < 256; digit++) {
+            for(size_t c = 0; c < chunks; c++) {
+                uint32_t count = counts[c * 256 + digit];
+                counts[c * 256 + digit] = offset;
+                offset += count;
+            }
+        }
+
+        parallel_for(n, grain, [&](size_t begin, size_t end) {
+            uint32_t* next = &counts[begin / grain * 256];
+            for(size_t i = begin; i < end; i++) {
+                uint32_t j = next[(keys[i] >> shift) & 255]++;
+                sorted_keys[j] = keys[i];
+                sorted_order[j] = order[i];
+            }
+        });
+        std::swap(keys, sorted_keys);
+        std::swap(order, sorted_order);
+    }
+
+    // Store the particles in bucket order so that neighbours sit close together in memory
+    sorted.pos.resize(n);
+    sorted.velocity.resize(n);
+    sorted.age.resize(n);
+    parallel_for(n, 4096, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            sorted.pos[i] = particles.pos[order[i]];
+            sorted.velocity[i] = particles.velocity[order[i]];
+            sorted.age[i] = particles.age[order[i]];
+        }
+    });
+    std::swap(particles, sorted);
+
+    start.assign((size_t)mask + 1, (uint32_t)n);
+    parallel_for(n, 4096, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            if(i == 0 || keys[i] != keys[i - 1]) start[keys[i]] = (uint32_t)i;
+        }
+    });
+}
+
 Scene_Particles::Scene_Particles(Scene_ID id)
     : arrow(Util::arrow_mesh(0.03f, 0.075f, 1.0f)), particle_instances(Util::sphere_mesh(1.0f, 1)) {
 
@@ -34,6 +152,12 @@ Scene_Particles::Scene_Particles(Scene_ID id, Pose p, std::string name)
 void Scene_Particles::get_r() {
     BBox box = particle_instances.mesh().bbox();
     radius = (box.max - box.min).norm() / 2.0f;
+
+    // Instances are placed by the mesh's origin, which need not be its center
+    bound_radius = 0.0f;
+    for(const GL::Mesh::Vert& v : particle_instances.mesh().verts()) {
+        bound_radius = std::max(bound_radius, v.pos.norm());
+    }
 }
 
 BBox Scene_Particles::bbox() const {
@@ -44,12 +168,18 @@ BBox Scene_Particles::bbox() const {
 
 void Scene_Particles::take_mesh(GL::Mesh&& mesh) {
     particle_instances = GL::Instances(std::move(mesh));
+    instances_dirty = true;
+    get_r();
 }
 
 const GL::Mesh& Scene_Particles::mesh() const {
     return particle_instances.mesh();
 }
 
+float Scene_Particles::sphere_radius() const {
+    return opt.scale * bound_radius;
+}
+
 void Scene_Particles::render(const Mat4& view, bool depth_only, bool posed, bool particles_only) {
 
     Renderer& renderer = Renderer::get();
@@ -68,6 +198,7 @@ void Scene_Particles::render(const Mat4& view, bool depth_only, bool posed, bool
     }
 
     if(opt.enabled && !depth_only) {
+        if(instances_dirty) update_instances();
         opts.modelview = view;
         opts.id = _id;
         opts.solid_color = false;
@@ -82,6 +213,9 @@ Scene_ID Scene_Particles::id() const {
 void Scene_Particles::clear() {
     particles.clear();
     particle_instances.clear();
+    particle_cooldown = 0.0;
+    n_steps = 0;
+    instances_dirty = false;
 }
 
 void Scene_Particles::set_time(float time) {
@@ -93,10 +227,26 @@ void Scene_Particles::set_time(float time) {
     }
 }
 
-const std::vector<Particle>& Scene_Particles::get_particles() const {
+void Scene_Particles::bake(size_t frames) {
+    panim.splines.bake(frames);
+    anim.splines.bake(frames);
+}
+
+const Particle_Store& Scene_Particles::get_particles() const {
     return particles;
 }
 
+Scene_Particles::Sim_State Scene_Particles::get_state() const {
+    return Sim_State{particle_cooldown, n_steps};
+}
+
+void Scene_Particles::set_state(Sim_State state, Particle_Store&& store) {
+    particles = std::move(store);
+    particle_cooldown = state.cooldown;
+    n_steps = state.steps;
+    instances_dirty = true;
+}
+
 void Scene_Particles::step(const PT::BVH<PT::Object>& scene, float dt) {
 
     if(!opt.enabled) {
@@ -105,45 +255,138 @@ void Scene_Particles::step(const PT::BVH<PT::Object>& scene, float dt) {
     }
     float S = opt.scale;
 
-    std::vector<Particle> next;
-    next.reserve(particles.size());
-    particle_instances.clear(particles.size());
-
-    for(size_t i = 0; i < particles.size(); i++) {
-        Particle& p = particles[i];
-        if(p.update(scene, dt, radius * S)) {
-            Mat4 T = Mat4{Vec4{S, 0.0f, 0.0f, 0.0f}, Vec4{0.0f, S, 0.0f, 0.0f},
-                          Vec4{0.0f, 0.0f, S, 0.0f}, Vec4{p.pos, 1.0f}};
-            particle_instances.add(T);
-            next.emplace_back(p);
+    // Particles only read the shared BVH, so chunks of them step independently
+    parallel_for(particles.size(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            Particle p{particles.pos[i], particles.velocity[i], particles.age[i]};
+            if(!p.update(scene, dt, radius * S)) p.age = 0.0f;
+            particles.pos[i] = p.pos;
+            particles.velocity[i] = p.velocity;
+            particles.age[i] = p.age;
+        }
+    });
+
+    for(size_t i = 0; i < particles.size();) {
+        if(particles.age[i] > 0.0f) {
+            i++;
+        } else {
+            particles.swap_remove(i);
         }
     }
 
-    float cos = std::cos(Radians(opt.angle) / 2.0f);
+    if(opt.collisions) collide_particles(sphere_radius());
 
-    double cooldown = 1.0 / opt.pps;
-    while(particle_cooldown <= 0.0f) {
+    // Emission draws from its own generator, seeded from the emitter and step number, so a
+    // simulation replays identically and the calling thread's generator is left alone
+    if(particle_cooldown <= 0.0f) {
+        float cos = std::cos(Radians(opt.angle) / 2.0f);
+        Mat4 rotation = pose.rotation_mat();
 
-        float z = lerp(cos, 1.0f, RNG::unit());
-        float t = 2 * PI_F * RNG::unit();
-        float r = std::sqrt(1 - z * z);
-        Vec3 dir = opt.velocity * Vec3(r * std::cos(t), z, r * std::sin(t));
+        std::seed_seq seq{(unsigned int)_id, n_steps, 0u};
+        std::mt19937 rng(seq);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
 
-        Particle p;
-        p.pos = pose.pos;
-        p.velocity = pose.rotation_mat().rotate(dir);
-        p.age = opt.lifetime;
-        next.push_back(p);
+        double cooldown = 1.0 / opt.pps;
+        while(particle_cooldown <= 0.0f) {
 
-        Mat4 T = Mat4{Vec4{S, 0.0f, 0.0f, 0.0f}, Vec4{0.0f, S, 0.0f, 0.0f},
-                      Vec4{0.0f, 0.0f, S, 0.0f}, Vec4{p.pos, 1.0f}};
-        particle_instances.add(T);
+            float z = lerp(cos, 1.0f, unit(rng));
+            float t = 2 * PI_F * unit(rng);
+            float r = std::sqrt(1 - z * z);
+            Vec3 dir = opt.velocity * Vec3(r * std::cos(t), z, r * std::sin(t));
 
-        particle_cooldown += cooldown;
+            Particle p;
+            p.pos = pose.pos;
+            p.velocity = rotation.rotate(dir);
+            p.age = opt.lifetime;
+            particles.add(p);
+
+            particle_cooldown += cooldown;
+        }
     }
 
     particle_cooldown -= dt;
-    particles = std::move(next);
+    n_steps++;
+    instances_dirty = true;
+}
+
+void Scene_Particles::collide_particles(float r) {
+
+    size_t n = particles.size();
+    if(n < 2 || r <= 0.0f) return;
+
+    // Cells as wide as a particle, so any particle touching another is in a neighbouring cell
+    grid.build(particles, 2.0f * r);
+
+    new_pos.resize(n);
+    new_velocity.resize(n);
+
+    // Each particle sums its own response to every overlapping neighbour from the state
+    // before this pass, so particles resolve independently and in a fixed order. Averaging
+    // over the contacts keeps dense clumps from blowing apart.
+    parallel_for(n, 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+
+            Vec3 p = particles.pos[i], v = particles.velocity[i];
+            Vec3 dp, dv;
+            int contacts = 0;
+
+            int x, y, z;
+            grid.cell(p, x, y, z);
+
+            for(int k = 0; k < 27; k++) {
+                int cx = x + k / 9 - 1, cy = y + k / 3 % 3 - 1, cz = z + k % 3 - 1;
+                uint32_t b = grid.bucket(cx, cy, cz);
+
+                for(size_t j = grid.start[b]; j < n && grid.keys[j] == b; j++) {
+                    if(j == i) continue;
+
+                    // Other cells may hash to the same bucket; they are visited on their own
+                    int jx, jy, jz;
+                    grid.cell(particles.pos[j], jx, jy, jz);
+                    if(jx != cx || jy != cy || jz != cz) continue;
+
+                    Vec3 d = p - particles.pos[j];
+                    float dist2 = d.norm_squared();
+                    if(dist2 >= 4.0f * r * r || dist2 == 0.0f) continue;
+
+                    // Equal masses: split the overlap, and swap the approaching normal velocity
+                    float dist = std::sqrt(dist2);
+                    Vec3 normal = d / dist;
+                    dp += 0.5f * (2.0f * r - dist) * normal;
+
+                    float approach = dot(v - particles.velocity[j], normal);
+                    if(approach < 0.0f) dv -= approach * normal;
+                    contacts++;
+                }
+            }
+
+            if(contacts) {
+                p += dp / (float)contacts;
+                v += dv / (float)contacts;
+            }
+            new_pos[i] = p;
+            new_velocity[i] = v;
+        }
+    });
+
+    std::swap(particles.pos, new_pos);
+    std::swap(particles.velocity, new_velocity);
+}
+
+void Scene_Particles::update_instances() {
+
+    float S = opt.scale;
+    std::vector<GL::Instances::Info>& instances = particle_instances.edit_data();
+    instances.resize(particles.size());
+    parallel_for(particles.size(), 4096, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            instances[i].id = 0;
+            instances[i].transform =
+                Mat4{Vec4{S, 0.0f, 0.0f, 0.0f}, Vec4{0.0f, S, 0.0f, 0.0f},
+                     Vec4{0.0f, 0.0f, S, 0.0f}, Vec4{particles.pos[i], 1.0f}};
+        }
+    });
+    instances_dirty = false;
 }
 
 void Scene_Particles::Anim_Particles::at(float t, Scene_Particles::Options& o) const {
@@ -164,5 +407,5 @@ void Scene_Particles::Anim_Particles::set(float t, Scene_Particles::Options o) {
 bool operator!=(const Scene_Particles::Options& l, const Scene_Particles::Options& r) {
     return l.color != r.color || l.velocity != r.velocity || l.angle != r.angle ||
            l.scale != r.scale || l.lifetime != r.lifetime || l.pps != r.pps ||
-           l.enabled != r.enabled;
+           l.enabled != r.enabled || l.spheres != r.spheres || l.collisions != r.collisions;
 }
@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <vector>
 
 #include "../lib/mathlib.h"
@@ -25,6 +26,44 @@ struct Particle {
     bool update(const PT::BVH<PT::Object>& scene, float dt, float radius);
 };
 
+// The particles of an emitter, stored as one array per attribute so that stepping streams
+// through each of them. Removing a particle moves the last one into its slot.
+struct Particle_Store {
+
+    std::vector<Vec3> pos;
+    std::vector<Vec3> velocity;
+    std::vector<float> age;
+
+    size_t size() const;
+    void add(const Particle& p);
+    void swap_remove(size_t i);
+    void clear();
+};
+
+// Particles sorted by the grid cell they lie in, with cells hashed into a table about twice
+// as large as the particle count. Finding the particles near one then only scans the
+// buckets of the 27 cells around it, so building and querying are both linear.
+struct Particle_Grid {
+
+    // Radix sorts the particles (reordering the store) by bucket and indexes the table
+    void build(Particle_Store& particles, float cell_size);
+
+    void cell(Vec3 pos, int& x, int& y, int& z) const;
+    uint32_t bucket(int x, int y, int z) const;
+
+    float inv_cell = 1.0f;
+    uint32_t mask = 0;
+
+    // Bucket of each particle in sorted order, and the first sorted particle of each bucket
+    // (or the particle count, if it is empty)
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> start;
+
+private:
+    std::vector<uint32_t> order, sorted_keys, sorted_order;
+    Particle_Store sorted;
+};
+
 class Scene_Particles {
 public:
     Scene_Particles(Scene_ID id);
@@ -39,15 +78,28 @@ public:
 
     void clear();
     void step(const PT::BVH<PT::Object>& scene, float dt);
-    const std::vector<Particle>& get_particles() const;
+    const Particle_Store& get_particles() const;
+
+    // What, besides the particles themselves, decides how the simulation continues. Emission
+    // is seeded by the emitter's id and step count, so restoring both resumes it exactly.
+    struct Sim_State {
+        double cooldown = 0.0;
+        unsigned int steps = 0;
+    };
+    Sim_State get_state() const;
+    void set_state(Sim_State state, Particle_Store&& store);
 
     BBox bbox() const;
     void render(const Mat4& view, bool depth_only = false, bool posed = true, bool particles_only = false);
     Scene_ID id() const;
     void set_time(float time);
+    void bake(size_t frames);
 
     const GL::Mesh& mesh() const;
     void take_mesh(GL::Mesh&& mesh);
+    // Radius of the sphere, centered on the particle, that bounds its scaled mesh. Particles
+    // are traced as and collide with each other as such spheres.
+    float sphere_radius() const;
 
     static const inline int max_name_len = 256;
     struct Options {
@@ -59,6 +111,10 @@ public:
         float lifetime = 15.0f;
         float pps = 5.0f;
         bool enabled = false;
+        // Path trace the particles as spheres bounding the mesh rather than as copies of it
+        bool spheres = false;
+        // Collide particles with each other (as spheres) as well as with the scene
+        bool collisions = false;
     };
 
     struct Anim_Particles {
@@ -74,13 +130,20 @@ public:
 
 private:
     void get_r();
+    void update_instances();
+    void collide_particles(float r);
     Scene_ID _id;
-    std::vector<Particle> particles;
+    Particle_Store particles;
+    Particle_Grid grid;
+    std::vector<Vec3> new_pos, new_velocity;
     GL::Instances particle_instances;
     GL::Mesh arrow;
 
     float radius = 0.0f;
+    float bound_radius = 0.0f;
     double particle_cooldown = 0.0f;
+    unsigned int n_steps = 0;
+    bool instances_dirty = false;
 };
 
 bool operator!=(const Scene_Particles::Options& l, const Scene_Particles::Options& r);
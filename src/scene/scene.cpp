@@ -44,6 +44,10 @@ void Scene_Item::set_time(float time) {
     return std::visit([time](auto& obj) { obj.set_time(time); }, data);
 }
 
+void Scene_Item::bake(size_t frames) {
+    return std::visit([frames](auto& obj) { obj.bake(frames); }, data);
+}
+
 BBox Scene_Item::bbox() {
     return std::visit([](auto& obj) { return obj.bbox(); }, data);
 }
@@ -376,8 +380,7 @@ static GL::Mesh mesh_from(const aiMesh* mesh) {
     return GL::Mesh(std::move(mesh_verts), std::move(mesh_inds));
 }
 
-using vp_pair = std::pair<std::vector<Vec3>, std::vector<std::vector<Halfedge_Mesh::Index>>>;
-static vp_pair load_mesh(const aiMesh* mesh) {
+static std::string load_mesh(const aiMesh* mesh, Halfedge_Mesh& hemesh) {
 
     std::vector<Vec3> verts;
 
@@ -386,6 +389,28 @@ static vp_pair load_mesh(const aiMesh* mesh) {
         verts.push_back(Vec3(pos.x, pos.y, pos.z));
     }
 
+    // Meshes made of a single kind of polygon (e.g. all triangles or all quads) can be
+    // built straight from a flat index buffer
+    unsigned int degree = 0;
+    bool uniform = true;
+    for(unsigned int j = 0; j < mesh->mNumFaces && uniform; j++) {
+        unsigned int n = mesh->mFaces[j].mNumIndices;
+        if(n < 3) continue;
+        if(!degree) degree = n;
+        uniform = n == degree;
+    }
+
+    if(uniform && degree) {
+        std::vector<GL::Mesh::Index> indices;
+        indices.reserve((size_t)mesh->mNumFaces * degree);
+        for(unsigned int j = 0; j < mesh->mNumFaces; j++) {
+            const aiFace& face = mesh->mFaces[j];
+            if(face.mNumIndices < 3) continue;
+            indices.insert(indices.end(), face.mIndices, face.mIndices + face.mNumIndices);
+        }
+        return hemesh.from_soup(indices, degree, verts);
+    }
+
     std::vector<std::vector<Halfedge_Mesh::Index>> polys;
     for(unsigned int j = 0; j < mesh->mNumFaces; j++) {
         const aiFace& face = mesh->mFaces[j];
@@ -396,7 +421,7 @@ static vp_pair load_mesh(const aiMesh* mesh) {
         }
         polys.push_back(poly);
     }
-    return {verts, polys};
+    return hemesh.from_poly(polys, verts);
 }
 
 static Scene_Particles::Options load_particles(aiLight* ai_light, aiNode* anim_node) {
@@ -416,10 +441,21 @@ static Scene_Particles::Options load_particles(aiLight* ai_light, aiNode* anim_n
         anim_node->mTransformation.Decompose(ascale, arot, apos);
         Vec3 info = aiVec(apos);
         opt.lifetime = info.x;
+        opt.spheres = info.y > 0.0f;
+        opt.collisions = info.z > 0.0f;
     }
     return opt;
 }
 
+// Joint nodes carry no transform of their own, so theirs holds the IK limits: the translation
+// is pose_min + 180 and the scale is 181 - pose_max, which leaves older files unlimited
+static void load_joint_limits(Joint* j, const aiMatrix4x4& limits) {
+    aiVector3D ascale, arot, apos;
+    limits.Decompose(ascale, arot, apos);
+    j->pose_min = hmax(hmin(aiVec(apos) - Vec3(180.0f), Vec3(180.0f)), Vec3(-180.0f));
+    j->pose_max = hmax(hmin(Vec3(181.0f) - aiVec(ascale), Vec3(180.0f)), j->pose_min);
+}
+
 static Scene_Light::Options load_light(aiLight* ai_light, bool hemi, bool sphere, bool area) {
 
     Scene_Light::Options opt;
@@ -551,8 +587,6 @@ static void load_node(Scene& scobj, std::vector<std::string>& errors,
             }
         }
 
-        auto [verts, polys] = load_mesh(mesh);
-
         aiVector3D ascale, arot, apos;
         transform.Decompose(ascale, arot, apos);
         Vec3 pos = aiVec(apos);
@@ -576,7 +610,7 @@ static void load_node(Scene& scobj, std::vector<std::string>& errors,
         } else {
 
             Halfedge_Mesh hemesh;
-            std::string err = hemesh.from_poly(polys, verts);
+            std::string err = load_mesh(mesh, hemesh);
             if(!err.empty()) {
 
                 GL::Mesh gmesh = mesh_from(mesh);
@@ -627,6 +661,7 @@ static void load_node(Scene& scobj, std::vector<std::string>& errors,
                         node_to_bone[node] = c;
                         c->pose = aiVec(r);
                         c->radius = bone->mWeights[0].mWeight;
+                        load_joint_limits(c, node->mTransformation);
                         for(unsigned int j = 0; j < node->mNumChildren; j++)
                             build_tree(c, node->mChildren[j]);
                     }
@@ -640,6 +675,7 @@ static void load_node(Scene& scobj, std::vector<std::string>& errors,
                     node_to_bone[root_node] = root;
                     root->pose = aiVec(r);
                     root->radius = root_bone->mWeights[0].mWeight;
+                    load_joint_limits(root, root_node->mTransformation);
                     for(unsigned int k = 0; k < root_node->mNumChildren; k++)
                         build_tree(root, root_node->mChildren[k]);
                 }
@@ -1005,6 +1041,11 @@ static void write_particles(aiLight* ai_light, const Scene_Particles::Options& o
     ai_light->mAttenuationQuadratic = opt.enabled ? opt.angle : -opt.angle;
 }
 
+static aiMatrix4x4 joint_limits(const Joint* j) {
+    return matMat(Mat4::translate(j->pose_min + Vec3(180.0f)) *
+                  Mat4::scale(Vec3(181.0f) - j->pose_max));
+}
+
 static std::string write_light(aiLight* ai_light, const Scene_Light::Options& opt, std::string name,
                                Scene_ID id, std::string map) {
 
@@ -1441,6 +1482,7 @@ std::string Scene::write(std::string file, const Camera& render_cam,
                 joint_tree = [&](aiNode* node, Joint* j) {
                     std::string jname = jprefix + std::to_string(j->_id);
                     node->mName = aiString(jname);
+                    node->mTransformation = joint_limits(j);
                     j_to_node[j] = node;
                     size_t children = j->children.size();
                     for(Skeleton::IK_Handle* h : obj.armature.handles) {
@@ -1559,7 +1601,9 @@ std::string Scene::write(std::string file, const Camera& render_cam,
             ai_mesh_node->mNumMeshes = 1;
             ai_mesh_node->mMeshes = new unsigned int((unsigned int)m_idx);
             ai_mesh_node->mTransformation =
-                matMat(Mat4::translate(Vec3{particles.opt.lifetime, 0.0f, 0.0f}));
+                matMat(Mat4::translate(Vec3{particles.opt.lifetime,
+                                            particles.opt.spheres ? 1.0f : 0.0f,
+                                            particles.opt.collisions ? 1.0f : 0.0f}));
 
         } else if(entry.second.is<Scene_Light>()) {
 
@@ -43,6 +43,7 @@ public:
     Anim_Pose& animation();
     const Anim_Pose& animation() const;
     void set_time(float time);
+    void bake(size_t frames);
 
     std::string name() const;
     std::pair<char*, int> name();
@@ -59,13 +59,77 @@ bool Skeleton::set_time(float time) {
             h->enabled = e;
         }
     }
+    fk.dirty = true;
+    update_fk();
     return ret;
 }
 
+void Skeleton::set_fk_dirty() {
+    fk.dirty = true;
+}
+
+void Skeleton::bake(size_t frames) {
+    for_joints([frames](Joint* j) { j->anim.bake(frames); });
+    for(IK_Handle* h : handles) {
+        h->anim.bake(frames);
+    }
+}
+
 void Skeleton::for_joints(std::function<void(Joint*)> func) {
     for(Joint* r : roots) r->for_joints(func);
 }
 
+void Skeleton::update_fk() const {
+
+    if(fk.sorted && !fk.dirty) return;
+
+    bool resort = !fk.sorted;
+    if(resort) {
+        fk.joints.clear();
+        fk.parent.clear();
+        for(Joint* r : roots) {
+            r->for_joints([this](Joint* j) {
+                j->fk_index = (unsigned int)fk.joints.size();
+                fk.joints.push_back(j);
+                fk.parent.push_back(j->parent ? (int)j->parent->fk_index : -1);
+            });
+        }
+        size_t n = fk.joints.size();
+        fk.pose.resize(n);
+        fk.extent.resize(n);
+        fk.bind.resize(n);
+        fk.posed.resize(n);
+        fk.sorted = true;
+    }
+
+    // Parents come first, so whether a parent was redone is known by the time its
+    // children are reached
+    std::vector<bool> redo(fk.joints.size());
+    for(size_t i = 0; i < fk.joints.size(); i++) {
+        const Joint* j = fk.joints[i];
+        int p = fk.parent[i];
+        redo[i] = resort || fk.pose[i] != j->pose || fk.extent[i] != j->extent ||
+                  (p >= 0 && redo[p]);
+        if(!redo[i]) continue;
+
+        fk.pose[i] = j->pose;
+        fk.extent[i] = j->extent;
+        if(p >= 0) {
+            Mat4 to_parent = Mat4::translate(fk.extent[p]);
+            fk.bind[i] = fk.bind[p] * to_parent;
+            fk.posed[i] = fk.posed[p] * to_parent * Mat4::euler(j->pose);
+        } else {
+            fk.bind[i] = Mat4::I;
+            fk.posed[i] = Mat4::euler(j->pose);
+        }
+    }
+    fk.dirty = false;
+}
+
+bool Skeleton::in_fk(const Joint* j) const {
+    return j->fk_index < fk.joints.size() && fk.joints[j->fk_index] == j;
+}
+
 void Skeleton::for_handles(std::function<void(Skeleton::IK_Handle*)> func) {
     for(IK_Handle* h : handles) func(h);
 }
@@ -76,6 +140,7 @@ Joint* Skeleton::add_root(Vec3 extent) {
         j->anim.set(f, Quat{});
     }
     roots.insert(j);
+    fk.sorted = false;
     return j;
 }
 
@@ -106,23 +171,24 @@ void Skeleton::render(const Mat4& view, Joint* jselect, IK_Handle* hselect, bool
                       unsigned int offset) {
 
     Renderer& R = Renderer::get();
+    update_fk();
+    const std::vector<Mat4>& to_skeleton = posed ? fk.posed : fk.bind;
 
     Mat4 V = view * Mat4::translate(base_pos);
-    for_joints([&](Joint* j) {
+    for(size_t i = 0; i < fk.joints.size(); i++) {
+        Joint* j = fk.joints[i];
         Renderer::MeshOpt opt;
-        opt.modelview =
-            V * (posed ? j->joint_to_posed() : j->joint_to_bind()) * Mat4::rotate_to(j->extent);
+        opt.modelview = V * to_skeleton[i] * Mat4::rotate_to(j->extent);
         opt.id = j->_id + offset;
         opt.alpha = 0.8f;
         opt.color = Gui::Color::hover;
         R.capsule(opt, j->extent.norm(), j->radius);
-    });
+    }
 
     if(jselect) {
         R.begin_outline();
 
-        Mat4 model = Mat4::translate(base_pos) *
-                     (posed ? jselect->joint_to_posed() : jselect->joint_to_bind()) *
+        Mat4 model = (posed ? joint_to_posed(jselect) : joint_to_bind(jselect)) *
                      Mat4::rotate_to(jselect->extent);
 
         Renderer::MeshOpt opt;
@@ -144,14 +210,15 @@ void Skeleton::render(const Mat4& view, Joint* jselect, IK_Handle* hselect, bool
         R.sphere(opt);
     }
 
-    for_joints([&](Joint* j) {
+    for(size_t i = 0; i < fk.joints.size(); i++) {
+        Joint* j = fk.joints[i];
         Renderer::MeshOpt opt;
-        opt.modelview = V * (posed ? j->joint_to_posed() : j->joint_to_bind()) *
-                        Mat4::translate(j->extent) * Mat4::scale(Vec3{j->radius * 0.25f});
+        opt.modelview = V * to_skeleton[i] * Mat4::translate(j->extent) *
+                        Mat4::scale(Vec3{j->radius * 0.25f});
         opt.id = j->_id + offset;
         opt.color = jselect == j ? Gui::Color::outline : Gui::Color::hover;
         R.sphere(opt);
-    });
+    }
 
     GL::Lines ik_lines;
     for(IK_Handle* h : handles) {
@@ -172,17 +239,18 @@ void Skeleton::outline(const Mat4& view, const Mat4& model, bool root, bool pose
 
     Renderer& R = Renderer::get();
     Mat4 base_t = Mat4::translate(base_pos);
+    update_fk();
 
-    for_joints([&](Joint* j) {
-        Mat4 M = model * base_t * (posed ? j->joint_to_posed() : j->joint_to_bind()) *
-                 Mat4::rotate_to(j->extent);
+    for(size_t i = 0; i < fk.joints.size(); i++) {
+        Joint* j = fk.joints[i];
+        Mat4 M = model * base_t * (posed ? fk.posed[i] : fk.bind[i]) * Mat4::rotate_to(j->extent);
         Renderer::MeshOpt opt;
         opt.modelview = view;
         opt.id = j->_id + offset;
         opt.depth_only = true;
 
         R.capsule(opt, M, j->extent.norm(), j->radius, box);
-    });
+    }
 }
 
 bool Skeleton::is_root_id(unsigned int id) {
@@ -217,6 +285,7 @@ Joint* Skeleton::add_child(Joint* j, Vec3 e) {
         c->anim.set(f, Quat{});
     }
     j->children.insert(c);
+    fk.sorted = false;
     return c;
 }
 
@@ -226,6 +295,7 @@ void Skeleton::restore(Joint* j) {
     } else {
         roots.insert(j);
     }
+    fk.sorted = false;
 
     auto entry = erased.find(j);
     assert(entry != erased.end());
@@ -242,6 +312,7 @@ void Skeleton::erase(Joint* j) {
     } else {
         roots.erase(j);
     }
+    fk.sorted = false;
     std::vector<IK_Handle*> herase;
     for(IK_Handle* h : handles) {
         if(h->joint == j) {
@@ -39,6 +39,10 @@ public:
     // The distance at which the joint segment should stop effecting vertices
     float radius = 0.25f;
 
+    // Range of each pose angle that IK may reach, in degrees within [-180, 180]. The full
+    // range leaves that angle free.
+    Vec3 pose_min = Vec3(-180.0f), pose_max = Vec3(180.0f);
+
 private:
     // Builds the transformation matrix that takes a point in joint space to the skeleton
     // space (in bind position). "Bind" position implies that the rotation of all joints
@@ -57,20 +61,17 @@ private:
     // Set of child joints - owned by this joint (could be shared_ptr and everything else weak_ptr)
     std::unordered_set<Joint*> children;
 
-    // Current angle gradient for IK
-    Vec3 angle_gradient;
-
-    // Call this function recursively on your parent. At each call, compute the angle gradient for
-    // the joint corresponding to that call.
-    void compute_gradient(Vec3 target, Vec3 current);
-
     void for_joints(std::function<void(Joint*)> func);
 
+    // Position of this joint in its skeleton's forward kinematics cache
+    unsigned int fk_index = 0;
+
     unsigned int _id = 0;
     Spline<Quat> anim;
 
     friend class Skeleton;
     friend class Scene;
+    friend class Particle_Cache;
 };
 
 class Skeleton {
@@ -88,6 +89,32 @@ public:
         unsigned int _id = 0;
     };
 
+    /*
+        The joints within reach of each vertex of a mesh in bind position, in compressed
+        rows: vertex i is effected by joints[index[k]] for k in [offsets[i], offsets[i + 1]).
+        Joints appear parent-before-child, both in joints and within each row.
+    */
+    struct Influences {
+        std::vector<Joint*> joints;
+        std::vector<unsigned int> offsets;
+        std::vector<unsigned int> index;
+    };
+
+    /*
+        Skinning data for one mesh, computed from find_joints in bind position. Every
+        vertex keeps its max_influences strongest joints, sorted by decreasing weight,
+        with unused slots weighted zero. Slot k of all vertices is stored contiguously,
+        and joints are referred to by their index in the palette.
+    */
+    struct Skin_Weights {
+        static constexpr unsigned int max_influences = 4;
+
+        std::vector<Joint*> palette;
+        std::vector<Mat4> bind_to_joint;
+        std::vector<unsigned int> index[max_influences];
+        std::vector<float> weight[max_influences];
+    };
+
     Skeleton();
     Skeleton(unsigned int obj_id);
     ~Skeleton();
@@ -109,10 +136,9 @@ public:
     Mat4 joint_to_bind(const Joint* j) const;
     Mat4 joint_to_posed(const Joint* j) const;
 
-    void find_joints(const GL::Mesh& src,
-                     std::unordered_map<unsigned int, std::vector<Joint*>>& map);
-    void skin(const GL::Mesh& input, GL::Mesh& output,
-              const std::unordered_map<unsigned int, std::vector<Joint*>>& map);
+    void find_joints(const GL::Mesh& src, Influences& influences);
+    void bind_skin(const GL::Mesh& mesh, const Influences& influences, Skin_Weights& weights);
+    void skin(const GL::Mesh& input, GL::Mesh& output, const Skin_Weights& weights);
 
     ////////////////////////////////////////////
 
@@ -142,6 +168,9 @@ public:
     bool is_root_id(unsigned int id);
 
     bool set_time(float time);
+    // Must be called after changing a joint's pose or extent outside of set_time and IK
+    void set_fk_dirty();
+    void bake(size_t frames);
     void render(const Mat4& view, Joint* jselect, IK_Handle* hselect, bool root, bool posed,
                 unsigned int offset = 0);
     void outline(const Mat4& view, const Mat4& model, bool root, bool posed, BBox& box,
@@ -166,6 +195,27 @@ public:
     void restore_splines(const SSave& data);
 
 private:
+    /*
+        Forward kinematics cache. The joints are flattened parent-before-child, and a single
+        pass computes every bind and posed transform (not including base_pos) from the
+        parents' ones. The pass only runs once the cache is marked dirty (by set_time, IK,
+        or set_fk_dirty after editing a joint), so lookups between edits are constant time.
+        Each joint's pose and extent are remembered, so the pass only redoes the joints
+        whose inputs changed since it last ran, along with their descendants. Adding,
+        erasing or restoring joints re-sorts them.
+    */
+    struct FK_Cache {
+        bool sorted = false, dirty = true;
+        std::vector<Joint*> joints;
+        std::vector<int> parent;
+        std::vector<Vec3> pose, extent;
+        std::vector<Mat4> bind, posed;
+    };
+
+    void update_fk() const;
+    bool in_fk(const Joint* j) const;
+
+    mutable FK_Cache fk;
     Vec3 base_pos;
     unsigned int root_id, next_id;
     std::unordered_set<Joint*> roots;
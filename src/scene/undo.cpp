@@ -34,6 +34,23 @@ template<typename R, typename U> void Undo::action(R&& redo, U&& undo) {
     action(std::make_unique<Action<R, U>>(std::move(redo), std::move(undo)));
 }
 
+void Undo::update_mesh(Scene_ID id, Halfedge_Mesh::Delta&& delta) {
+
+    auto d = std::make_shared<Halfedge_Mesh::Delta>(std::move(delta));
+
+    action(
+        [id, this, d]() {
+            Scene_Object& obj = scene.get_obj(id);
+            obj.get_mesh().redo(*d);
+            obj.set_mesh_dirty();
+        },
+        [id, this, d]() {
+            Scene_Object& obj = scene.get_obj(id);
+            obj.get_mesh().undo(*d);
+            obj.set_mesh_dirty();
+        });
+}
+
 void Undo::update_mesh_full(Scene_ID id, Halfedge_Mesh&& old_mesh) {
 
     Scene_Object& obj = scene.get_obj(id);
@@ -143,6 +160,18 @@ void Undo::rad_bone(Scene_ID id, Joint* j, float old) {
         });
 }
 
+void Undo::limit_bone(Scene_ID id, Joint* j, Vec3 old_min, Vec3 old_max) {
+    action(
+        [j, nmin = j->pose_min, nmax = j->pose_max]() {
+            j->pose_min = nmin;
+            j->pose_max = nmax;
+        },
+        [j, old_min, old_max]() {
+            j->pose_min = old_min;
+            j->pose_max = old_max;
+        });
+}
+
 void Undo::move_handle(Scene_ID id, Skeleton::IK_Handle* j, Vec3 old) {
     action(
         [this, id, j, ne = j->target]() {
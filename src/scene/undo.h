@@ -38,30 +38,6 @@ public:
     ~Action_Bundle() = default;
 };
 
-template<typename T> class MeshOp : public Action_Base {
-    void undo() {
-        Scene_Object& obj = scene.get_obj(id);
-        obj.set_mesh(mesh);
-    }
-    void redo() {
-        Scene_Object& obj = scene.get_obj(id);
-        auto sel = obj.set_mesh(mesh, eid);
-        op(obj.get_mesh(), sel);
-        obj.get_mesh().do_erase();
-    }
-    Scene& scene;
-    Scene_ID id;
-    unsigned int eid;
-    T op;
-    Halfedge_Mesh mesh;
-
-public:
-    MeshOp(Scene& s, Scene_ID i, unsigned int e, Halfedge_Mesh&& m, T&& t)
-        : scene(s), id(i), eid(e), op(t), mesh(std::move(m)) {
-    }
-    ~MeshOp() = default;
-};
-
 class Undo {
 public:
     Undo(Scene& scene, Gui::Manager& man);
@@ -80,6 +56,7 @@ public:
     void move_bone(Scene_ID id, Joint* j, Vec3 old);
     void pose_bone(Scene_ID id, Joint* j, Vec3 old);
     void rad_bone(Scene_ID id, Joint* j, float old);
+    void limit_bone(Scene_ID id, Joint* j, Vec3 old_min, Vec3 old_max);
 
     void del_handle(Scene_ID id, Skeleton::IK_Handle* j);
     void add_handle(Scene_ID id, Skeleton::IK_Handle* j);
@@ -91,13 +68,7 @@ public:
     void update_camera(Gui::Widget_Camera& widget, Camera old);
     void update_particles(Scene_ID id, Scene_Particles::Options old);
 
-    template<typename T>
-    void update_mesh(Scene_ID id, Halfedge_Mesh&& old, unsigned int e_id, T&& op) {
-        std::stack<std::unique_ptr<Action_Base>> empty;
-        redos.swap(empty);
-        undos.push(std::make_unique<MeshOp<T>>(scene, id, e_id, std::move(old), std::move(op)));
-        total_actions++;
-    }
+    void update_mesh(Scene_ID id, Halfedge_Mesh::Delta&& delta);
     void update_mesh_full(Scene_ID id, Halfedge_Mesh&& old_mesh);
 
     void anim_clear_light(Scene_ID id, float t);
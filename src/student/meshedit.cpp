@@ -1,9 +1,10 @@
 
+#include <functional>
 #include <queue>
-#include <set>
-#include <unordered_map>
 
 #include "../geometry/halfedge.h"
+#include "../rays/tri_mesh.h"
+#include "../util/thread_pool.h"
 #include "debug.h"
 
 /* Note on local operation return types:
@@ -865,6 +866,10 @@ void Halfedge_Mesh::triangulate() {
 
     // For each face...
     for (FaceRef f = faces_begin(); f != faces_end(); f++) {
+        if (f->is_boundary()) {
+            continue;
+        }
+
         // before
 
         std::vector<HalfedgeRef> h;
@@ -934,416 +939,730 @@ void Halfedge_Mesh::triangulate() {
     }
 }
 
-/* Note on the quad subdivision process:
-
-        Unlike the local mesh operations (like bevel or edge flip), we will perform
-        subdivision by splitting *all* faces into quads "simultaneously."  Rather
-        than operating directly on the halfedge data structure (which as you've
-        seen is quite difficult to maintain!) we are going to do something a bit nicer:
-           1. Create a raw list of vertex positions and faces (rather than a full-
-              blown halfedge mesh).
-           2. Build a new halfedge mesh from these lists, replacing the old one.
-        Sometimes rebuilding a data structure from scratch is simpler (and even
-        more efficient) than incrementally modifying the existing one.  These steps are
-        detailed below.
-
-  Step I: Compute the vertex positions for the subdivided mesh.
-        Here we're going to do something a little bit strange: since we will
-        have one vertex in the subdivided mesh for each vertex, edge, and face in
-        the original mesh, we can nicely store the new vertex *positions* as
-        attributes on vertices, edges, and faces of the original mesh. These positions
-        can then be conveniently copied into the new, subdivided mesh.
-        This is what you will implement in linear_subdivide_positions() and
-        catmullclark_subdivide_positions().
-
-  Steps II-IV are provided (see Halfedge_Mesh::subdivide()), but are still detailed
-  here:
-
-  Step II: Assign a unique index (starting at 0) to each vertex, edge, and
-        face in the original mesh. These indices will be the indices of the
-        vertices in the new (subdivided mesh).  They do not have to be assigned
-        in any particular order, so long as no index is shared by more than one
-        mesh element, and the total number of indices is equal to V+E+F, i.e.,
-        the total number of vertices plus edges plus faces in the original mesh.
-        Basically we just need a one-to-one mapping between original mesh elements
-        and subdivided mesh vertices.
-
-  Step III: Build a list of quads in the new (subdivided) mesh, as tuples of
-        the element indices defined above. In other words, each new quad should be
-        of the form (i,j,k,l), where i,j,k and l are four of the indices stored on
-        our original mesh elements.  Note that it is essential to get the orientation
-        right here: (i,j,k,l) is not the same as (l,k,j,i).  Indices of new faces
-        should circulate in the same direction as old faces (think about the right-hand
-        rule).
-
-  Step IV: Pass the list of vertices and quads to a routine that clears
-        the internal data for this halfedge mesh, and builds new halfedge data from
-        scratch, using the two lists.
-*/
-
 /*
-    Compute new vertex positions for a mesh that splits each polygon
-    into quads (by inserting a vertex at the face midpoint and each
-    of the edge midpoints).  The new vertex positions will be stored
-    in the members Vertex::new_pos, Edge::new_pos, and
-    Face::new_pos.  The values of the positions are based on
-    simple linear interpolation, e.g., the edge midpoints and face
-    centroids.
-*/
-void Halfedge_Mesh::linear_subdivide_positions() {
-
-    // For each vertex, assign Vertex::new_pos to
-    // its original position, Vertex::pos.
-    for (VertexRef v = vertices_begin(); v != vertices_end(); v++) {
-        v->new_pos = v->pos;
-    }
-
-    // For each edge, assign the midpoint of the two original
-    // positions to Edge::new_pos.
-    for (EdgeRef e = edges_begin(); e != edges_end(); e++) {
-        HalfedgeRef h1 = e->halfedge();
-        VertexRef v1 = h1->vertex();
+    Isotropic remeshing. Note that this function returns success in a similar
+    manner to the local operations, except with only a boolean value.
+    (e.g. you may want to return false if this is not a triangle mesh)
 
-        HalfedgeRef h2 = h1->twin();
-        VertexRef v2 = h2->vertex();
+    Each iteration splits edges longer than 4/3 of the target length, collapses edges
+    shorter than 4/5 of it, flips edges to bring vertex degrees towards 6 (4 on the
+    boundary), and finally relaxes the interior vertices tangentially and projects them
+    back onto the original surface. A target length of zero uses the mean edge length.
+    Non-triangular faces are triangulated first.
+*/
+bool Halfedge_Mesh::isotropic_remesh(float target_length, unsigned int iterations) {
 
-        e->new_pos = (v1->pos + v2->pos) / 2;
+    for(FaceRef f = faces_begin(); f != faces_end(); f++) {
+        if(!f->is_boundary() && f->degree() != 3) {
+            triangulate();
+            break;
+        }
     }
 
-    // For each face, assign the centroid (i.e., arithmetic mean)
-    // of the original vertex positions to Face::new_pos. Note
-    // that in general, NOT all faces will be triangles!
-    for (FaceRef f = faces_begin(); f != faces_end(); f++) {
-        int count = 0;
-        HalfedgeRef h = f->halfedge();
-
-        f->new_pos = Vec3();
+    std::vector<EdgeRef> edge_list;
+    std::vector<VertexRef> vert_list;
+    auto gather = [&]() {
+        edge_list.clear();
+        vert_list.clear();
+        for(EdgeRef e = edges_begin(); e != edges_end(); e++) edge_list.push_back(e);
+        for(VertexRef v = vertices_begin(); v != vertices_end(); v++) vert_list.push_back(v);
+    };
+    gather();
+    if(edge_list.empty()) return false;
+
+    if(target_length <= 0.0f) {
+        double total = 0.0;
+        for(EdgeRef e : edge_list) total += e->length();
+        target_length = (float)(total / edge_list.size());
+    }
+    if(!(target_length > 0.0f)) return false;
+    float high = target_length * 4.0f / 3.0f, low = target_length * 4.0f / 5.0f;
+    float high2 = high * high, low2 = low * low;
+
+    // Relaxed vertices are projected back onto the original surface by casting rays
+    // along their normal into a BVH of the original triangles
+    GL::Mesh original;
+    to_mesh(original, false);
+    PT::Tri_Mesh surface(original);
+
+    // Splits and flips only change the faces on either side of their edge (and flips, the
+    // outgoing halfedges of its four vertices), so each round picks edges that share no
+    // faces (or vertices) with each other and applies them in parallel. Splits allocate
+    // their new elements up front, since the element lists can't grow concurrently.
+    struct Split {
+        EdgeRef e, e2;
+        VertexRef m;
+        HalfedgeRef far[2], in[2], out[2];
+        EdgeRef spoke[2];
+        FaceRef face[2];
+        bool inner[2];
+    };
+    std::vector<Split> splits;
+    std::vector<EdgeRef> candidates, next, flips;
+    std::vector<unsigned char> flags, claimed;
+
+    // Whether each vertex (by slot) is on the boundary, kept up to date by splits and collapses
+    std::vector<unsigned char> border(vertices.n_slots(), 0);
+    parallel_for(vert_list.size(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            border[vert_list[i].index()] = vert_list[i]->on_boundary();
+        }
+    });
+
+    // Splits the edge at its midpoint m. Its halfedges keep their origins and now end at
+    // m; far[i] is the other half of side i, which gets the face added on that side.
+    auto split = [&](Split& s) {
+        HalfedgeRef h = s.e->halfedge(), t = h->twin();
+        s.m->pos = (h->vertex()->pos + t->vertex()->pos) / 2.0f;
+        s.m->halfedge() = s.far[0];
+
+        h->twin() = s.far[1], s.far[1]->twin() = h;
+        t->twin() = s.far[0], s.far[0]->twin() = t;
+        s.far[0]->vertex() = s.m, s.far[1]->vertex() = s.m;
+        s.far[1]->edge() = s.e, s.e->halfedge() = h;
+        t->edge() = s.e2, s.far[0]->edge() = s.e2, s.e2->halfedge() = t;
+
+        HalfedgeRef sides[2] = {h, t};
+        for(int i = 0; i < 2; i++) {
+            HalfedgeRef side = sides[i], far = s.far[i], n = side->next();
+            FaceRef f = side->face();
+            if(!s.inner[i]) {
+                far->next() = n;
+                far->face() = f;
+                side->next() = far;
+                continue;
+            }
+            // f keeps side, out, p and the new face gets far, n, in
+            HalfedgeRef p = n->next(), out = s.out[i], in = s.in[i];
+            FaceRef g = s.face[i];
+            EdgeRef spoke = s.spoke[i];
+            side->next() = out, out->next() = p;
+            far->next() = n, n->next() = in, in->next() = far;
+            out->vertex() = s.m, in->vertex() = p->vertex();
+            out->twin() = in, in->twin() = out;
+            out->edge() = spoke, in->edge() = spoke, spoke->halfedge() = out;
+            out->face() = f, f->halfedge() = side;
+            far->face() = g, n->face() = g, in->face() = g, g->halfedge() = far;
+        }
+    };
+
+    auto split_long_edges = [&]() {
+        candidates = edge_list;
+        while(!candidates.empty()) {
+            flags.assign(candidates.size(), 0);
+            parallel_for(candidates.size(), 1024, [&](size_t begin, size_t end) {
+                for(size_t i = begin; i < end; i++) {
+                    HalfedgeRef h = candidates[i]->halfedge();
+                    Vec3 d = h->vertex()->pos - h->twin()->vertex()->pos;
+                    flags[i] = d.norm_squared() > high2;
+                }
+            });
+
+            // Boundary faces are never changed by a split, so only inner faces are claimed
+            claimed.assign(faces.n_slots(), 0);
+            splits.clear();
+            next.clear();
+            for(size_t i = 0; i < candidates.size(); i++) {
+                if(!flags[i]) continue;
+                EdgeRef e = candidates[i];
+                FaceRef f0 = e->halfedge()->face(), f1 = e->halfedge()->twin()->face();
+                bool b0 = f0->is_boundary(), b1 = f1->is_boundary();
+                if(b0 && b1) continue;
+                if((!b0 && claimed[f0.index()]) || (!b1 && claimed[f1.index()])) {
+                    next.push_back(e);
+                    continue;
+                }
+                if(!b0) claimed[f0.index()] = 1;
+                if(!b1) claimed[f1.index()] = 1;
+
+                Split s;
+                s.e = e;
+                s.e2 = new_edge();
+                s.m = new_vertex();
+                FaceRef sides[2] = {f0, f1};
+                for(int j = 0; j < 2; j++) {
+                    s.far[j] = new_halfedge();
+                    s.inner[j] = !sides[j]->is_boundary();
+                    if(!s.inner[j]) continue;
+                    s.in[j] = new_halfedge();
+                    s.out[j] = new_halfedge();
+                    s.spoke[j] = new_edge();
+                    s.face[j] = new_face();
+                }
+                border.resize(vertices.n_slots(), 0);
+                border[s.m.index()] = b0 || b1;
+                splits.push_back(s);
+            }
+            if(splits.empty()) break;
+
+            parallel_for(splits.size(), 256, [&](size_t begin, size_t end) {
+                for(size_t i = begin; i < end; i++) split(splits[i]);
+            });
+
+            // Only the halves of split edges and the new edges across faces can be too long
+            for(const Split& s : splits) {
+                next.push_back(s.e);
+                next.push_back(s.e2);
+                for(int j = 0; j < 2; j++) {
+                    if(s.inner[j]) next.push_back(s.spoke[j]);
+                }
+            }
+            std::swap(candidates, next);
+        }
+    };
+
+    // Collapses are applied one at a time, since each one can change which of its
+    // neighbors may be collapsed next
+    Collapse_Scratch scratch;
+    auto collapse_short_edges = [&]() {
+        uint32_t n_slots = (uint32_t)edges.n_slots();
+        for(uint32_t i = 0; i < n_slots; i++) {
+            EdgeRef e = edges.at(i);
+            if(!edges.contains(e)) continue;
+            HalfedgeRef h = e->halfedge();
+            VertexRef a = h->vertex(), b = h->twin()->vertex();
+            if((a->pos - b->pos).norm_squared() >= low2) continue;
+
+            // Boundary vertices stay put, unless the edge itself is on the boundary
+            bool ba = border[a.index()], bb = border[b.index()];
+            Vec3 pos = (a->pos + b->pos) / 2.0f;
+            if(!e->on_boundary() && ba != bb) pos = ba ? a->pos : b->pos;
+
+            // Don't undo the splits by creating edges that are too long
+            bool too_long = false;
+            for(VertexRef v : {a, b}) {
+                HalfedgeRef g = v->halfedge();
+                do {
+                    too_long = too_long ||
+                               (g->twin()->vertex()->pos - pos).norm_squared() > high2;
+                    g = g->twin()->next();
+                } while(!too_long && g != v->halfedge());
+            }
+            if(too_long || !can_collapse(e, pos, scratch)) continue;
+            collapse_in_place(e, pos, scratch);
+            border[a.index()] = ba || bb;
+        }
+    };
+
+    std::vector<int> valence;
+    auto deviation = [&](VertexRef v, int change) {
+        uint32_t i = v.index();
+        return std::abs(valence[i] + change - (border[i] ? 4 : 6));
+    };
+
+    // Flips the edge between the triangles (a, b, c) and (b, a, d) so that it joins c and d
+    auto flip = [&](EdgeRef e) {
+        HalfedgeRef h = e->halfedge(), hn = h->next(), hp = hn->next();
+        HalfedgeRef t = h->twin(), tn = t->next(), tp = tn->next();
+        VertexRef a = h->vertex(), b = t->vertex(), c = hp->vertex(), d = tp->vertex();
+        FaceRef f0 = h->face(), f1 = t->face();
+
+        if(a->halfedge() == h) a->halfedge() = tn;
+        if(b->halfedge() == t) b->halfedge() = hn;
+        h->vertex() = d, t->vertex() = c;
+        h->next() = hp, hp->next() = tn, tn->next() = h;
+        t->next() = tp, tp->next() = hn, hn->next() = t;
+        tn->face() = f0, hn->face() = f1;
+        f0->halfedge() = h, f1->halfedge() = t;
+
+        valence[a.index()]--, valence[b.index()]--;
+        valence[c.index()]++, valence[d.index()]++;
+    };
+
+    // Flipping must bring the degrees closer to their targets without folding the faces
+    // over or joining vertices that are already neighbors
+    auto improves = [&](EdgeRef e) {
+        HalfedgeRef h = e->halfedge(), t = h->twin();
+        if(h->face()->is_boundary() || t->face()->is_boundary()) return false;
+        VertexRef a = h->vertex(), b = t->vertex();
+        VertexRef c = h->next()->next()->vertex(), d = t->next()->next()->vertex();
+        if(c == d) return false;
+        if(valence[a.index()] <= (border[a.index()] ? 2 : 3)) return false;
+        if(valence[b.index()] <= (border[b.index()] ? 2 : 3)) return false;
+
+        int before = deviation(a, 0) + deviation(b, 0) + deviation(c, 0) + deviation(d, 0);
+        int after = deviation(a, -1) + deviation(b, -1) + deviation(c, 1) + deviation(d, 1);
+        if(after >= before) return false;
+
+        Vec3 n = cross(b->pos - a->pos, c->pos - a->pos) + cross(a->pos - b->pos, d->pos - b->pos);
+        if(dot(cross(c->pos - d->pos, a->pos - d->pos), n) <= 0.0f) return false;
+        if(dot(cross(d->pos - c->pos, b->pos - c->pos), n) <= 0.0f) return false;
+
+        HalfedgeRef g = c->halfedge();
         do {
-            f->new_pos += h->vertex()->pos;
-            h = h->next();
-            count++;
-        } while (h != f->halfedge());
+            if(g->twin()->vertex() == d) return false;
+            g = g->twin()->next();
+        } while(g != c->halfedge());
+        return true;
+    };
+
+    auto flip_edges = [&]() {
+        // degree() counts faces, which is one less than the edges at a boundary vertex
+        valence.assign(vertices.n_slots(), 0);
+        parallel_for(vert_list.size(), 1024, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) {
+                uint32_t v = vert_list[i].index();
+                valence[v] = (int)vert_list[i]->degree() + border[v];
+            }
+        });
+
+        candidates = edge_list;
+        while(!candidates.empty()) {
+            flags.assign(candidates.size(), 0);
+            parallel_for(candidates.size(), 1024, [&](size_t begin, size_t end) {
+                for(size_t i = begin; i < end; i++) flags[i] = improves(candidates[i]);
+            });
+
+            claimed.assign(vertices.n_slots(), 0);
+            flips.clear();
+            next.clear();
+            for(size_t i = 0; i < candidates.size(); i++) {
+                if(!flags[i]) continue;
+                EdgeRef e = candidates[i];
+                HalfedgeRef h = e->halfedge(), t = h->twin();
+                uint32_t quad[4] = {h->vertex().index(), t->vertex().index(),
+                                    h->next()->next()->vertex().index(),
+                                    t->next()->next()->vertex().index()};
+                bool free = true;
+                for(uint32_t v : quad) free = free && !claimed[v];
+                if(!free) {
+                    next.push_back(e);
+                    continue;
+                }
+                for(uint32_t v : quad) claimed[v] = 1;
+                flips.push_back(e);
+            }
+            if(flips.empty()) break;
 
-        f->new_pos /= count;
-    }
+            parallel_for(flips.size(), 1024, [&](size_t begin, size_t end) {
+                for(size_t i = begin; i < end; i++) flip(flips[i]);
+            });
+            std::swap(candidates, next);
+        }
+    };
+
+    // Moves each interior vertex halfway to the centroid of its neighbors within its
+    // tangent plane, then back onto the original surface
+    std::vector<Vec3> relaxed;
+    auto relax = [&]() {
+        relaxed.resize(vert_list.size());
+        parallel_for(vert_list.size(), 256, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) {
+                VertexRef v = vert_list[i];
+                Vec3 p = v->pos;
+                relaxed[i] = p;
+                if(border[v.index()]) continue;
+
+                Vec3 centroid, n;
+                unsigned int count = 0;
+                HalfedgeRef h = v->halfedge();
+                do {
+                    Vec3 pj = h->next()->vertex()->pos, pk = h->next()->next()->vertex()->pos;
+                    centroid += pj;
+                    n += cross(pj - p, pk - p);
+                    count++;
+                    h = h->twin()->next();
+                } while(h != v->halfedge());
+                if(n.norm_squared() == 0.0f) continue;
+                n.normalize();
+
+                Vec3 d = centroid / (float)count - p;
+                Vec3 q = p + 0.5f * (d - dot(d, n) * n);
+
+                Ray out(q, n), in(q, -n);
+                out.dist_bounds.y = in.dist_bounds.y = target_length;
+                PT::Trace hit = PT::Trace::min(surface.hit(out), surface.hit(in));
+                relaxed[i] = hit.hit ? hit.position : q;
+            }
+        });
+        parallel_for(vert_list.size(), 1024, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) vert_list[i]->pos = relaxed[i];
+        });
+    };
+
+    for(unsigned int i = 0; i < iterations; i++) {
+        split_long_edges();
+        collapse_short_edges();
+        gather();
+        flip_edges();
+        relax();
+    }
+
+    // Global ops are validated in full, so there is no need to track the new elements
+    added.clear();
+    unchecked = true;
+    return true;
 }
 
 /*
-    Compute new vertex positions for a mesh that splits each polygon
-    into quads (by inserting a vertex at the face midpoint and each
-    of the edge midpoints).  The new vertex positions will be stored
-    in the members Vertex::new_pos, Edge::new_pos, and
-    Face::new_pos.  The values of the positions are based on
-    the Catmull-Clark rules for subdivision.
-
-    Note: this will only be called on meshes without boundary
+    Helper type for quadric simplification: the error quadric of a set of planes,
+    i.e. the symmetric 4x4 matrix Q such that [p 1] Q [p 1]^T is the sum of squared
+    distances from p to the planes. Only the upper triangle is stored, in double
+    precision so that quadrics summed over many faces stay accurate.
 */
-void Halfedge_Mesh::catmullclark_subdivide_positions() {
+struct Quadric {
+    Quadric() = default;
 
-    // The implementation for this routine should be
-    // a lot like Halfedge_Mesh:linear_subdivide_positions:(),
-    // except that the calculation of the positions themsevles is
-    // slightly more involved, using the Catmull-Clark subdivision
-    // rules. (These rules are outlined in the Developer Manual.)
+    // Plane through p with unit normal n, counted w times
+    Quadric(Vec3 n, Vec3 p, double w) {
+        double a = n.x, b = n.y, c = n.z, d = -dot(n, p);
+        q[0] = w * a * a, q[1] = w * a * b, q[2] = w * a * c, q[3] = w * a * d;
+        q[4] = w * b * b, q[5] = w * b * c, q[6] = w * b * d;
+        q[7] = w * c * c, q[8] = w * c * d;
+        q[9] = w * d * d;
+    }
 
-    // Faces
-    for (FaceRef f = faces_begin(); f != faces_end(); f++) {
-        int count = 0;
-        HalfedgeRef h = f->halfedge();
+    Quadric& operator+=(const Quadric& o) {
+        for(int i = 0; i < 10; i++) q[i] += o.q[i];
+        return *this;
+    }
+    Quadric operator+(const Quadric& o) const {
+        Quadric r = *this;
+        return r += o;
+    }
 
-        f->new_pos = Vec3();
-        do {
-            f->new_pos += h->vertex()->pos;
-            h = h->next();
-            count++;
-        } while (h != f->halfedge());
+    double error(Vec3 p) const {
+        double x = p.x, y = p.y, z = p.z;
+        double e = q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x +
+                   q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y + q[7] * z * z +
+                   2.0 * q[8] * z + q[9];
+        return std::max(e, 0.0);
+    }
+
+    // Solves for the point of minimum error; fails if the planes don't pin down a point
+    bool minimum(Vec3& p) const {
+        double a = q[0], b = q[1], c = q[2], d = q[4], e = q[5], f = q[7];
+        double c0 = d * f - e * e, c1 = c * e - b * f, c2 = b * e - c * d;
+        double det = a * c0 + b * c1 + c * c2;
+        double scale = std::max({std::abs(a), std::abs(d), std::abs(f)});
+        if(std::abs(det) <= 1e-9 * scale * scale * scale) return false;
 
-        f->new_pos /= count;
+        double x = q[3], y = q[6], z = q[8];
+        double inv = -1.0 / det;
+        p.x = (float)(inv * (c0 * x + c1 * y + c2 * z));
+        p.y = (float)(inv * (c1 * x + (a * f - c * c) * y + (b * c - a * e) * z));
+        p.z = (float)(inv * (c2 * x + (b * c - a * e) * y + (a * d - b * b) * z));
+        return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
     }
 
-    // Edges
-    for (EdgeRef e = edges_begin(); e != edges_end(); e++) {
-        HalfedgeRef h1 = e->halfedge();
-        VertexRef v1 = h1->vertex();
-        FaceRef f1 = h1->face();
+    double q[10] = {};
+};
 
-        HalfedgeRef h2 = h1->twin();
-        VertexRef v2 = h2->vertex();
-        FaceRef f2 = h2->face();
+/*
+    Helper type for quadric simplification: an entry in the collapse queue. Entries
+    are never removed from the queue; instead, each edge has a version number that is
+    bumped whenever its cost changes, and popped entries with an old version are either
+    skipped or re-queued with the edge's current cost.
+*/
+struct Edge_Record {
+    double cost;
+    uint32_t edge, version;
+};
 
-        e->new_pos = (v1->pos + v2->pos + f1->new_pos + f2->new_pos) / 4;
+bool operator>(const Edge_Record& r1, const Edge_Record& r2) {
+    if(r1.cost != r2.cost) {
+        return r1.cost > r2.cost;
     }
+    return r1.edge > r2.edge;
+}
 
-    // Vertices
-    for (VertexRef v = vertices_begin(); v != vertices_end(); v++) {
-        Vec3 face_pos_sum(0, 0, 0);
-        Vec3 edge_midpoint_sum(0, 0, 0);
-        int n = 0;
-        HalfedgeRef h = v->halfedge();
-        do {
-            face_pos_sum += h->face()->new_pos;
-            edge_midpoint_sum += (h->twin()->vertex()->pos + v->pos) / 2;
-            n++;
-            h = h->twin()->next();
-        } while (h != v->halfedge());
-
-        Vec3 q = face_pos_sum / n;
-        Vec3 r = edge_midpoint_sum / n;
-        v->new_pos = (q + 2 * r + (n - 3) * v->pos) / n;
+/* Picks where to put the vertex that results from collapsing the edge (a, b) */
+static Vec3 collapse_position(const Quadric& q, Vec3 a, Vec3 b, double& cost) {
+    Vec3 best;
+    if(q.minimum(best)) {
+        cost = q.error(best);
+        return best;
+    }
+    cost = std::numeric_limits<double>::infinity();
+    for(Vec3 p : {a, b, (a + b) / 2.0f}) {
+        double e = q.error(p);
+        if(e < cost) {
+            cost = e;
+            best = p;
+        }
     }
+    return best;
 }
 
 /*
-        This routine should increase the number of triangles in the mesh
-        using Loop subdivision. Note: this is will only be called on triangle meshes.
+    Checks whether collapsing the edge into a vertex at pos keeps the mesh manifold and
+    doesn't fold any of the remaining faces over. Used by simplify() and isotropic_remesh(),
+    which only collapse edges of triangle meshes.
 */
-void Halfedge_Mesh::loop_subdivide() {
-
-    // Compute new positions for all the vertices in the input mesh, using
-    // the Loop subdivision rule, and store them in Vertex::new_pos.
-    // -> At this point, we also want to mark each vertex as being a vertex of the
-    //    original mesh. Use Vertex::is_new for this.
-    // -> Next, compute the updated vertex positions associated with edges, and
-    //    store it in Edge::new_pos.
-    // -> Next, we're going to split every edge in the mesh, in any order.  For
-    //    future reference, we're also going to store some information about which
-    //    subdivided edges come from splitting an edge in the original mesh, and
-    //    which edges are new, by setting the flat Edge::is_new. Note that in this
-    //    loop, we only want to iterate over edges of the original mesh.
-    //    Otherwise, we'll end up splitting edges that we just split (and the
-    //    loop will never end!)
-    // -> Now flip any new edge that connects an old and new vertex.
-    // -> Finally, copy the new vertex positions into final Vertex::pos.
-
-    for (VertexRef v = vertices_begin(); v != vertices_end(); v++) {
-        v->is_new = false;
-
-        int n = 0;
-        Vec3 neighbor_sum(0, 0, 0);
-        HalfedgeRef h = v->halfedge();
+bool Halfedge_Mesh::can_collapse(EdgeRef e, Vec3 pos, Collapse_Scratch& scratch) {
+    HalfedgeRef h = e->halfedge(), t = h->twin();
+    FaceRef f0 = h->face(), f1 = t->face();
+    bool b0 = f0->is_boundary(), b1 = f1->is_boundary();
+    if(b0 && b1) return false;
+
+    // The vertices opposite the edge must keep at least a triangle's worth of edges
+    for(HalfedgeRef s : {h, t}) {
+        if(s->face()->is_boundary()) continue;
+        VertexRef opp = s->next()->next()->vertex();
+        unsigned int valence = 0;
+        bool border = false;
+        HalfedgeRef g = opp->halfedge();
         do {
-            VertexRef neighbor_v = h->twin()->vertex();
-            neighbor_sum += neighbor_v->pos;
-            n++;
-            h = h->twin()->next();
-        } while (h != v->halfedge());
-
-        float u = (n == 3) ? (3 / 16) : (3 / (8 * n));
-        v->new_pos = (1 - n * u) * v->pos + u * neighbor_sum;
-    }
-
-    for (EdgeRef e = edges_begin(); e != edges_end(); e++) {
-        e->is_new = false;
-
-        HalfedgeRef h = e->halfedge();
-        HalfedgeRef twin_h = h->twin();
-        VertexRef a = h->vertex();
-        VertexRef b = twin_h->vertex();
-        VertexRef c = h->next()->next()->vertex();
-        VertexRef d = twin_h->next()->next()->vertex();
+            valence++;
+            border = border || g->face()->is_boundary();
+            g = g->twin()->next();
+        } while(g != opp->halfedge());
+        if(valence <= (border ? 2u : 3u)) return false;
+    }
+
+    // Marks are compared against a per-check stamp, so they never need clearing
+    std::vector<uint32_t>& marks = scratch.marks;
+    if(marks.size() < vertices.n_slots()) marks.resize(vertices.n_slots(), 0);
+    uint32_t stamp = ++scratch.stamp;
+
+    // One walk around each endpoint checks that no remaining face flips, and
+    // gathers what the link condition needs: the endpoints may only share the
+    // neighbors opposite the edge, and an interior edge can't join two boundaries.
+    unsigned int shared = 0;
+    bool border[2] = {false, false};
+    VertexRef ends[2] = {h->vertex(), t->vertex()};
+    for(int i = 0; i < 2; i++) {
+        VertexRef v = ends[i];
+        HalfedgeRef g = v->halfedge();
+        do {
+            HalfedgeRef n = g->next();
+            uint32_t neighbor = n->vertex().index();
+            if(i == 0) {
+                marks[neighbor] = stamp;
+            } else if(marks[neighbor] == stamp) {
+                shared++;
+            }
 
-        e->new_pos = ((a->pos + b->pos) * 3 + c->pos + d->pos) / 8;
+            FaceRef f = g->face();
+            if(f->is_boundary()) {
+                border[i] = true;
+            } else if(f != f0 && f != f1) {
+                Vec3 p1 = n->vertex()->pos, p2 = n->next()->vertex()->pos;
+                Vec3 before = cross(p1 - v->pos, p2 - v->pos);
+                Vec3 after = cross(p1 - pos, p2 - pos);
+                if(dot(before, after) <= 0.0f) return false;
+            }
+            g = g->twin()->next();
+        } while(g != v->halfedge());
     }
+    if(!b0 && !b1 && border[0] && border[1]) return false;
+    return shared == (unsigned int)!b0 + (unsigned int)!b1;
+}
 
-    Size edge_count = n_edges();
-    EdgeRef current_e = edges_begin();
-    for (Size i = 0; i < edge_count; i++) {
-        EdgeRef next_e = current_e;
-        next_e++;
-
-        if (!current_e->is_new) {
-            Vec3 new_pos = current_e->new_pos;
-            VertexRef new_v = *(split_edge(current_e));
-            new_v->new_pos = new_pos;
-            new_v->is_new = true;
+/*
+    Collapses an edge that passed can_collapse() into its first vertex, moving it to pos.
+    Unlike collapse_edge(), this reuses the surrounding elements rather than rebuilding
+    the neighborhood, and erases the removed elements right away. The slots of the erased
+    edges are left in scratch.erased_edges. Returns the number of faces removed.
+*/
+int Halfedge_Mesh::collapse_in_place(EdgeRef e, Vec3 pos, Collapse_Scratch& scratch) {
+    HalfedgeRef h = e->halfedge(), t = h->twin();
+    VertexRef v0 = h->vertex(), v1 = t->vertex();
 
-            for (HalfedgeRef h = new_v->halfedge()->twin()->next(); h != new_v->halfedge(); h = h ->twin()->next()) {
-                h->edge()->is_new = true;
-            }
+    std::vector<HalfedgeRef>& ring = scratch.ring;
+    ring.clear();
+    HalfedgeRef g = v1->halfedge();
+    do {
+        ring.push_back(g);
+        g = g->twin()->next();
+    } while(g != v1->halfedge());
+
+    // Find the predecessors of boundary halfedges before anything is relinked
+    HalfedgeRef prev[2];
+    HalfedgeRef sides[2] = {h, t};
+    for(int i = 0; i < 2; i++) {
+        if(!sides[i]->face()->is_boundary()) continue;
+        g = sides[i];
+        while(g->twin()->next() != sides[i]) g = g->twin()->next();
+        prev[i] = g->twin();
+    }
+
+    scratch.erased_edges.clear();
+    int removed = 0;
+    HalfedgeRef keep;
+    for(int i = 0; i < 2; i++) {
+        HalfedgeRef s = sides[i], n = s->next();
+        FaceRef f = s->face();
+        if(f->is_boundary()) {
+            // Cut the edge out of the boundary loop
+            prev[i]->next() = n;
+            if(f->halfedge() == s) f->halfedge() = n;
+            keep = n;
+        } else {
+            // Close up the triangle by gluing its two remaining edges together
+            HalfedgeRef p = n->next();
+            HalfedgeRef on = n->twin(), op = p->twin();
+            VertexRef opp = p->vertex();
+            EdgeRef kept = p->edge();
+            on->twin() = op;
+            op->twin() = on;
+            on->edge() = kept;
+            kept->halfedge() = op;
+            if(opp->halfedge() == p) opp->halfedge() = on;
+            scratch.erased_edges.push_back(n->edge().index());
+            edges.erase(n->edge());
+            halfedges.erase(n);
+            halfedges.erase(p);
+            faces.erase(f);
+            keep = op;
+            removed++;
         }
-
-        current_e = next_e;
     }
 
-    for (EdgeRef e = edges_begin(); e != edges_end(); e++) {
-        if (e->is_new && e->halfedge()->vertex()->is_new != e->halfedge()->twin()->vertex()->is_new) {
-            flip_edge(e);
-        }
-    }
+    for(HalfedgeRef r : ring) r->vertex() = v0;
+    v0->halfedge() = keep;
+    v0->pos = pos;
 
-    for (VertexRef v = vertices_begin(); v != vertices_end(); v++) {
-        v->pos = v->new_pos;
-    }
+    halfedges.erase(h);
+    halfedges.erase(t);
+    scratch.erased_edges.push_back(e.index());
+    edges.erase(e);
+    vertices.erase(v1);
+    return removed;
 }
 
 /*
-    Isotropic remeshing. Note that this function returns success in a similar
-    manner to the local operations, except with only a boolean value.
-    (e.g. you may want to return false if this is not a triangle mesh)
+    Mesh simplification. Collapses edges in order of increasing quadric error until
+    at most target_faces faces remain, or until the next collapse would move the surface
+    by more than max_error. A target of zero removes three quarters of the faces, unless
+    only max_error is given. Non-triangular faces are triangulated first.
+    Returns false if no edge could be collapsed.
 */
-bool Halfedge_Mesh::isotropic_remesh() {
-
-    // Compute the mean edge length.
-    // Repeat the four main steps for 5 or 6 iterations
-    // -> Split edges much longer than the target length (being careful about
-    //    how the loop is written!)
-    // -> Collapse edges much shorter than the target length.  Here we need to
-    //    be EXTRA careful about advancing the loop, because many edges may have
-    //    been destroyed by a collapse (which ones?)
-    // -> Now flip each edge if it improves vertex degree
-    // -> Finally, apply some tangential smoothing to the vertex positions
-
-    // Note: if you erase elements in a local operation, they will not be actually deleted
-    // until do_erase or validate are called. This is to facilitate checking
-    // for dangling references to elements that will be erased.
-    // The rest of the codebase will automatically call validate() after each op,
-    // but here simply calling collapse_edge() will not erase the elements.
-    // You should use collapse_edge_erase() instead for the desired behavior.
-
-    return false;
-}
-
-/* Helper type for quadric simplification */
-struct Edge_Record {
-    Edge_Record() {
-    }
-    Edge_Record(std::unordered_map<Halfedge_Mesh::VertexRef, Mat4>& vertex_quadrics,
-                Halfedge_Mesh::EdgeRef e)
-        : edge(e) {
-
-        // Compute the combined quadric from the edge endpoints.
-        // -> Build the 3x3 linear system whose solution minimizes the quadric error
-        //    associated with these two endpoints.
-        // -> Use this system to solve for the optimal position, and store it in
-        //    Edge_Record::optimal.
-        // -> Also store the cost associated with collapsing this edge in
-        //    Edge_Record::cost.
-    }
-    Halfedge_Mesh::EdgeRef edge;
-    Vec3 optimal;
-    float cost;
-};
+bool Halfedge_Mesh::simplify(size_t target_faces, float max_error) {
 
-/* Comparison operator for Edge_Records so std::set will properly order them */
-bool operator<(const Edge_Record& r1, const Edge_Record& r2) {
-    if(r1.cost != r2.cost) {
-        return r1.cost < r2.cost;
+    for(FaceRef f = faces_begin(); f != faces_end(); f++) {
+        if(!f->is_boundary() && f->degree() != 3) {
+            triangulate();
+            break;
+        }
     }
-    Halfedge_Mesh::EdgeRef e1 = r1.edge;
-    Halfedge_Mesh::EdgeRef e2 = r2.edge;
-    return &*e1 < &*e2;
-}
 
-/** Helper type for quadric simplification
- *
- * A PQueue is a minimum-priority queue that
- * allows elements to be both inserted and removed from the
- * queue.  Together, one can easily change the priority of
- * an item by removing it, and re-inserting the same item
- * but with a different priority.  A priority queue, for
- * those who don't remember or haven't seen it before, is a
- * data structure that always keeps track of the item with
- * the smallest priority or "score," even as new elements
- * are inserted and removed.  Priority queues are often an
- * essential component of greedy algorithms, where one wants
- * to iteratively operate on the current "best" element.
- *
- * PQueue is templated on the type T of the object
- * being queued.  For this reason, T must define a comparison
- * operator of the form
- *
- *    bool operator<( const T& t1, const T& t2 )
- *
- * which returns true if and only if t1 is considered to have a
- * lower priority than t2.
- *
- * Basic use of a PQueue might look
- * something like this:
- *
- *    // initialize an empty queue
- *    PQueue<myItemType> queue;
- *
- *    // add some items (which we assume have been created
- *    // elsewhere, each of which has its priority stored as
- *    // some kind of internal member variable)
- *    queue.insert( item1 );
- *    queue.insert( item2 );
- *    queue.insert( item3 );
- *
- *    // get the highest priority item currently in the queue
- *    myItemType highestPriorityItem = queue.top();
- *
- *    // remove the highest priority item, automatically
- *    // promoting the next-highest priority item to the top
- *    queue.pop();
- *
- *    myItemType nextHighestPriorityItem = queue.top();
- *
- *    // Etc.
- *
- *    // We can also remove an item, making sure it is no
- *    // longer in the queue (note that this item may already
- *    // have been removed, if it was the 1st or 2nd-highest
- *    // priority item!)
- *    queue.remove( item2 );
- *
- */
-template<class T> struct PQueue {
-    void insert(const T& item) {
-        queue.insert(item);
-    }
-    void remove(const T& item) {
-        if(queue.find(item) != queue.end()) {
-            queue.erase(item);
+    std::vector<FaceRef> face_list;
+    std::vector<VertexRef> vert_list;
+    std::vector<EdgeRef> edge_list;
+    for(FaceRef f = faces_begin(); f != faces_end(); f++) {
+        if(!f->is_boundary()) face_list.push_back(f);
+    }
+    for(VertexRef v = vertices_begin(); v != vertices_end(); v++) vert_list.push_back(v);
+    for(EdgeRef e = edges_begin(); e != edges_end(); e++) edge_list.push_back(e);
+
+    size_t n_faces = face_list.size();
+    if(target_faces == 0 && max_error <= 0.0f) target_faces = n_faces / 4;
+    double max_cost = max_error > 0.0f ? (double)max_error * max_error
+                                       : std::numeric_limits<double>::infinity();
+
+    // The quadric of each face is the plane it lies in
+    std::vector<Quadric> face_quadrics(faces.n_slots());
+    parallel_for(face_list.size(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            HalfedgeRef h = face_list[i]->halfedge();
+            Vec3 p0 = h->vertex()->pos;
+            Vec3 n = cross(h->next()->vertex()->pos - p0, h->next()->next()->vertex()->pos - p0);
+            if(n.norm_squared() > 0.0f) face_quadrics[face_list[i].index()] = {n.unit(), p0, 1.0};
         }
-    }
-    const T& top(void) const {
-        return *(queue.begin());
-    }
-    void pop(void) {
-        queue.erase(queue.begin());
-    }
-    size_t size() {
-        return queue.size();
-    }
+    });
+
+    // The quadric of each vertex sums its faces, plus a plane through each boundary edge
+    // (perpendicular to its face) that keeps the border from shrinking
+    const double boundary_weight = 10.0;
+    std::vector<Quadric> vertex_quadrics(vertices.n_slots());
+    parallel_for(vert_list.size(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            Quadric& q = vertex_quadrics[vert_list[i].index()];
+            HalfedgeRef h = vert_list[i]->halfedge();
+            do {
+                if(!h->face()->is_boundary()) {
+                    q += face_quadrics[h->face().index()];
+                }
+                if(h->edge()->on_boundary()) {
+                    HalfedgeRef inside = h->face()->is_boundary() ? h->twin() : h;
+                    Vec3 dir = h->twin()->vertex()->pos - h->vertex()->pos;
+                    Vec3 n = cross(dir, inside->face()->normal());
+                    if(n.norm_squared() > 0.0f) {
+                        q += Quadric(n.unit(), h->vertex()->pos, boundary_weight);
+                    }
+                }
+                h = h->twin()->next();
+            } while(h != vert_list[i]->halfedge());
+        }
+    });
+
+    // The current cost of each edge, and where its collapse would put the merged vertex
+    std::vector<double> costs(edges.n_slots());
+    std::vector<Vec3> targets(edges.n_slots());
+    auto update_edge = [&](EdgeRef e) {
+        VertexRef a = e->halfedge()->vertex(), b = e->halfedge()->twin()->vertex();
+        uint32_t idx = e.index();
+        targets[idx] = collapse_position(vertex_quadrics[a.index()] + vertex_quadrics[b.index()],
+                                         a->pos, b->pos, costs[idx]);
+    };
+
+    // versions[e] counts changes to edge e (including its erasure), and queued[e] is the
+    // version of its newest queue entry, or no_entry once that entry has been consumed.
+    // Since merging quadrics mostly raises costs, an edge that is still queued is only
+    // re-queued right away if its cost drops; otherwise its old entry is re-queued with
+    // the new cost once it reaches the front. Edges without an entry (e.g. ones that
+    // could not be collapsed) are re-queued whenever they change.
+    const uint32_t no_entry = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> versions(edges.n_slots(), 0), queued(edges.n_slots(), 0);
+    std::vector<Edge_Record> records(edge_list.size());
+    parallel_for(edge_list.size(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            update_edge(edge_list[i]);
+            uint32_t idx = edge_list[i].index();
+            records[i] = {costs[idx], idx, 0};
+        }
+    });
+    std::priority_queue<Edge_Record, std::vector<Edge_Record>, std::greater<Edge_Record>> queue(
+        std::greater<Edge_Record>(), std::move(records));
+
+    Collapse_Scratch scratch;
+    bool collapsed = false;
+    while(n_faces > target_faces && !queue.empty()) {
+
+        Edge_Record rec = queue.top();
+        queue.pop();
+
+        uint32_t idx = rec.edge;
+        if(rec.version != queued[idx]) continue;
+        EdgeRef e = edges.at(idx);
+        if(rec.version != versions[idx]) {
+            if(edges.contains(e)) {
+                queue.push({costs[idx], idx, versions[idx]});
+                queued[idx] = versions[idx];
+            }
+            continue;
+        }
+        if(rec.cost > max_cost) break;
 
-    std::set<T> queue;
-};
+        VertexRef a = e->halfedge()->vertex(), b = e->halfedge()->twin()->vertex();
+        Vec3 pos = targets[idx];
+        if(!can_collapse(e, pos, scratch)) {
+            queued[idx] = no_entry;
+            continue;
+        }
 
-/*
-    Mesh simplification. Note that this function returns success in a similar
-    manner to the local operations, except with only a boolean value.
-    (e.g. you may want to return false if you can't simplify the mesh any
-    further without destroying it.)
-*/
-bool Halfedge_Mesh::simplify() {
-
-    std::unordered_map<VertexRef, Mat4> vertex_quadrics;
-    std::unordered_map<FaceRef, Mat4> face_quadrics;
-    std::unordered_map<EdgeRef, Edge_Record> edge_records;
-    PQueue<Edge_Record> edge_queue;
-
-    // Compute initial quadrics for each face by simply writing the plane equation
-    // for the face in homogeneous coordinates. These quadrics should be stored
-    // in face_quadrics
-    // -> Compute an initial quadric for each vertex as the sum of the quadrics
-    //    associated with the incident faces, storing it in vertex_quadrics
-    // -> Build a priority queue of edges according to their quadric error cost,
-    //    i.e., by building an Edge_Record for each edge and sticking it in the
-    //    queue. You may want to use the above PQueue<Edge_Record> for this.
-    // -> Until we reach the target edge budget, collapse the best edge. Remember
-    //    to remove from the queue any edge that touches the collapsing edge
-    //    BEFORE it gets collapsed, and add back into the queue any edge touching
-    //    the collapsed vertex AFTER it's been collapsed. Also remember to assign
-    //    a quadric to the collapsed vertex, and to pop the collapsed edge off the
-    //    top of the queue.
-
-    // Note: if you erase elements in a local operation, they will not be actually deleted
-    // until do_erase or validate are called. This is to facilitate checking
-    // for dangling references to elements that will be erased.
-    // The rest of the codebase will automatically call validate() after each op,
-    // but here simply calling collapse_edge() will not erase the elements.
-    // You should use collapse_edge_erase() instead for the desired behavior.
-
-    return false;
+        vertex_quadrics[a.index()] += vertex_quadrics[b.index()];
+        n_faces -= collapse_in_place(e, pos, scratch);
+        for(uint32_t i : scratch.erased_edges) versions[i]++;
+        collapsed = true;
+
+        // Only the edges around the merged vertex change cost
+        HalfedgeRef h = a->halfedge();
+        do {
+            EdgeRef f = h->edge();
+            uint32_t i = f.index();
+            double old_cost = costs[i];
+            update_edge(f);
+            versions[i]++;
+            if(queued[i] == no_entry || costs[i] < old_cost) {
+                queue.push({costs[i], i, versions[i]});
+                queued[i] = versions[i];
+            }
+            h = h->twin()->next();
+        } while(h != a->halfedge());
+    }
+
+    unchecked = true;
+    return collapsed;
 }
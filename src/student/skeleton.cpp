@@ -1,10 +1,11 @@
 
 #include "../scene/skeleton.h"
-#include "../util/rand.h"
+#include "../util/thread_pool.h"
 
-#define ITERATION (100)
-#define TIMESTEP_MAX (0.1)
-#define TIMESTEP_MIN (0.001)
+#define IK_MAX_ITERATIONS (50)
+#define IK_TOLERANCE (1e-4f)
+#define IK_MIN_IMPROVEMENT (1e-3f)
+#define IK_MIN_STEP (1e-3f)
 
 Vec3 closest_on_line_segment(Vec3 start, Vec3 end, Vec3 point) {
 
@@ -89,7 +90,7 @@ Vec3 Skeleton::end_of(Joint* j) {
     // Return the bind position of the endpoint of joint j in object space.
     // This should take into account Skeleton::base_pos.
 
-    return base_pos + j->joint_to_bind() * j->extent;
+    return joint_to_bind(j) * j->extent;
 }
 
 Vec3 Skeleton::posed_end_of(Joint* j) {
@@ -99,7 +100,7 @@ Vec3 Skeleton::posed_end_of(Joint* j) {
     // Return the posed position of the endpoint of joint j in object space.
     // This should take into account Skeleton::base_pos.
 
-    return base_pos + j->joint_to_posed() * j->extent;
+    return joint_to_posed(j) * j->extent;
 }
 
 Mat4 Skeleton::joint_to_bind(const Joint* j) const {
@@ -109,7 +110,9 @@ Mat4 Skeleton::joint_to_bind(const Joint* j) const {
     // Return a matrix transforming points in joint j's space to object space in
     // bind position. This should take into account Skeleton::base_pos.
 
-    return Mat4::translate(base_pos) * j->joint_to_bind();
+    // Joints in the skeleton read the cached transform; an erased joint walks its chain
+    update_fk();
+    return Mat4::translate(base_pos) * (in_fk(j) ? fk.bind[j->fk_index] : j->joint_to_bind());
 }
 
 Mat4 Skeleton::joint_to_posed(const Joint* j) const {
@@ -119,11 +122,11 @@ Mat4 Skeleton::joint_to_posed(const Joint* j) const {
     // Return a matrix transforming points in joint j's space to object space with
     // poses. This should take into account Skeleton::base_pos.
 
-    return Mat4::translate(base_pos) * j->joint_to_posed();
+    update_fk();
+    return Mat4::translate(base_pos) * (in_fk(j) ? fk.posed[j->fk_index] : j->joint_to_posed());
 }
 
-void Skeleton::find_joints(const GL::Mesh& mesh,
-                           std::unordered_map<unsigned int, std::vector<Joint*>>& map) {
+void Skeleton::find_joints(const GL::Mesh& mesh, Influences& influences) {
 
     // TODO(Animation): Task 3
 
@@ -132,130 +135,276 @@ void Skeleton::find_joints(const GL::Mesh& mesh,
     // if it is within Joint::radius distance of the bone's line segment in bind position.
 
     const std::vector<GL::Mesh::Vert>& verts = mesh.verts();
-    (void)verts;
 
-    // For each i in [0, verts.size()), map[i] should contain the list of joints that
-    // effect vertex i. Note that i is NOT Vert::id! i is the index in verts.
+    // Row i of influences should list the joints that effect vertex i. Note that i is
+    // NOT Vert::id! i is the index in verts.
+
+    // Each joint effects the capsule of its radius around the bone
+    struct Capsule {
+        Mat4 bind_to_joint;
+        Vec3 extent;
+        float radius;
+        BBox box;
+    };
+
+    update_fk();
+    influences = Influences();
+    influences.joints = fk.joints;
+
+    std::vector<Capsule> capsules;
+    for (size_t p = 0; p < fk.joints.size(); p++) {
+        const Joint* j = fk.joints[p];
+        Mat4 to_bind = Mat4::translate(base_pos) * fk.bind[p];
+        Capsule capsule = {to_bind.inverse(), j->extent, j->radius, BBox()};
+        capsule.box.enclose(to_bind * Vec3());
+        capsule.box.enclose(to_bind * j->extent);
+        capsule.box.min -= Vec3(j->radius);
+        capsule.box.max += Vec3(j->radius);
+        capsules.push_back(capsule);
+    }
 
-    for (unsigned i = 0; i < verts.size(); i++) {
-        map[i];
+    // Bin the capsules into a uniform grid over the mesh, so each vertex only tests the
+    // joints whose bounds overlap its cell
+    BBox bounds;
+    for (const GL::Mesh::Vert& v : verts) {
+        bounds.enclose(v.pos);
+    }
+    const int res = std::clamp((int)std::cbrt(verts.size() / 64.0f), 1, 32);
+    Vec3 scale;
+    for (int a = 0; a < 3; a++) {
+        scale[a] = res / std::max(bounds.max[a] - bounds.min[a], EPS_F);
+    }
+    auto cell_of = [&](Vec3 pos, int a) {
+        return std::clamp((int)((pos[a] - bounds.min[a]) * scale[a]), 0, res - 1);
+    };
+
+    std::vector<unsigned int> cell_start(res * res * res + 1, 0);
+    std::vector<unsigned int> cell_joints;
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t p = 0; p < capsules.size(); p++) {
+            const BBox& box = capsules[p].box;
+            if (capsules[p].radius <= 0 || box.max.x < bounds.min.x ||
+                box.max.y < bounds.min.y || box.max.z < bounds.min.z ||
+                box.min.x > bounds.max.x || box.min.y > bounds.max.y ||
+                box.min.z > bounds.max.z) {
+                continue;
+            }
+            for (int z = cell_of(box.min, 2); z <= cell_of(box.max, 2); z++) {
+                for (int y = cell_of(box.min, 1); y <= cell_of(box.max, 1); y++) {
+                    for (int x = cell_of(box.min, 0); x <= cell_of(box.max, 0); x++) {
+                        int cell = (z * res + y) * res + x;
+                        if (pass == 0) {
+                            cell_start[cell + 1]++;
+                        } else {
+                            cell_joints[cell_start[cell]++] = (unsigned int)p;
+                        }
+                    }
+                }
+            }
+        }
+        if (pass == 0) {
+            for (size_t c = 1; c < cell_start.size(); c++) {
+                cell_start[c] += cell_start[c - 1];
+            }
+            cell_joints.resize(cell_start.back());
+        } else {
+            // Filling advanced each start to the next cell's, so shift them back
+            for (size_t c = cell_start.size() - 1; c > 0; c--) {
+                cell_start[c] = cell_start[c - 1];
+            }
+            cell_start[0] = 0;
+        }
     }
 
-    for_joints([&](Joint* j) {
-        // What vertices does joint j effect?
-        for (unsigned i = 0; i < verts.size(); i++) {
-            Vec3 pos_joint = joint_to_bind(j).inverse() * verts[i].pos;
-            Vec3 closest = closest_on_line_segment(Vec3(), j->extent, pos_joint);
-            float distance = (pos_joint - closest).norm();
-            if (distance < j->radius) {
-                map[i].push_back(j);
+    // Test each vertex against its cell's capsules, gathering each chunk's rows
+    // separately, then pack the rows together once their sizes are known
+    const size_t grain = 4096;
+    std::vector<std::vector<unsigned int>> chunk_rows((verts.size() + grain - 1) / grain);
+    influences.offsets.assign(verts.size() + 1, 0);
+
+    parallel_for(verts.size(), grain, [&](size_t begin, size_t end) {
+        std::vector<unsigned int>& rows = chunk_rows[begin / grain];
+        for (size_t i = begin; i < end; i++) {
+            Vec3 pos = verts[i].pos;
+            int cell = (cell_of(pos, 2) * res + cell_of(pos, 1)) * res + cell_of(pos, 0);
+
+            size_t row_start = rows.size();
+            for (unsigned int c = cell_start[cell]; c < cell_start[cell + 1]; c++) {
+                const Capsule& capsule = capsules[cell_joints[c]];
+                Vec3 pos_joint = capsule.bind_to_joint * pos;
+                Vec3 closest = closest_on_line_segment(Vec3(), capsule.extent, pos_joint);
+                float distance = (pos_joint - closest).norm();
+                if (distance < capsule.radius) {
+                    rows.push_back(cell_joints[c]);
+                }
             }
+            influences.offsets[i + 1] = (unsigned int)(rows.size() - row_start);
         }
     });
+
+    for (size_t i = 1; i < influences.offsets.size(); i++) {
+        influences.offsets[i] += influences.offsets[i - 1];
+    }
+    influences.index.resize(influences.offsets.back());
+    for (size_t c = 0; c < chunk_rows.size(); c++) {
+        std::copy(chunk_rows[c].begin(), chunk_rows[c].end(),
+                  influences.index.begin() + influences.offsets[c * grain]);
+    }
 }
 
-void Skeleton::skin(const GL::Mesh& input, GL::Mesh& output,
-                    const std::unordered_map<unsigned int, std::vector<Joint*>>& map) {
+void Skeleton::bind_skin(const GL::Mesh& mesh, const Influences& influences,
+                         Skin_Weights& weights) {
 
-    // TODO(Animation): Task 3
+    // Compute the weight of each joint that effects a vertex, in bind position. influences
+    // was computed by find_joints, hence gives for each vertex index the list of bones the
+    // vertex should be effected by. A vertex is weighted by the inverse of its distance
+    // to each bone; only its strongest max_influences bones are kept.
 
-    // Apply bone poses & weights to the vertices of the input (bind position) mesh
-    // and store the result in the output mesh. See the task description for details.
-    // map was computed by find_joints, hence gives a mapping from vertex index to
-    // the list of bones the vertex should be effected by.
+    constexpr unsigned int max_influences = Skin_Weights::max_influences;
 
-    // Currently, this just copies the input to the output without modification.
+    weights = Skin_Weights();
+    weights.palette = influences.joints;
+    for (Joint* j : weights.palette) {
+        weights.bind_to_joint.push_back(joint_to_bind(j).inverse());
+    }
 
-    std::vector<GL::Mesh::Vert> verts = input.verts();
-    for(size_t i = 0; i < verts.size(); i++) {
+    const std::vector<GL::Mesh::Vert>& verts = mesh.verts();
+    for (unsigned int k = 0; k < max_influences; k++) {
+        weights.index[k].assign(verts.size(), 0);
+        weights.weight[k].assign(verts.size(), 0.0f);
+    }
 
-        // Skin vertex i. Note that its position is given in object bind space.
-        const std::vector<Joint *> &joints = map.at(i);
+    parallel_for(verts.size(), 1024, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
 
-        if (!joints.empty()) {
-            Vec3 new_pos;
-            Vec3 new_norm;
+            // Strongest joints so far, by decreasing weight
+            std::pair<float, unsigned int> best[max_influences] = {};
             float total_weight = 0;
 
-            for (size_t j = 0; j < joints.size(); j++) {
-                Mat4 mat_bind_to_joint = joint_to_bind(joints[j]).inverse();
-                Mat4 mat_joint_to_posed = joint_to_posed(joints[j]);
-
-                Vec3 pos_joint = mat_bind_to_joint * verts[i].pos;
-                Vec3 pos_pose = mat_joint_to_posed * pos_joint;
-
-                Vec3 norm_pose = verts[i].norm;
-                Joint *current = joints[j];
-                while (true) {
-                    norm_pose = Mat4::euler(current->pose) * norm_pose;
-
-                    if (current->is_root()) {
-                        break;
-                    }
-                    current = current->parent;
-                }
-                norm_pose.normalize();
-
-                // Closest point in joint space.
-                Vec3 closest = closest_on_line_segment(Vec3(), joints[j]->extent, pos_joint);
+            for (unsigned int k = influences.offsets[i]; k < influences.offsets[i + 1]; k++) {
+                unsigned int p = influences.index[k];
+                Joint* j = weights.palette[p];
+                Vec3 pos_joint = weights.bind_to_joint[p] * verts[i].pos;
+                Vec3 closest = closest_on_line_segment(Vec3(), j->extent, pos_joint);
 
                 float distance = (pos_joint - closest).norm();
                 if (distance == 0) {
                     distance = EPS_F;
                 }
+                std::pair<float, unsigned int> joint_weight = {1 / distance, p};
 
-                float weight = 1 / distance;
+                for (unsigned int k = 0; k < max_influences; k++) {
+                    if (joint_weight.first > best[k].first) {
+                        std::swap(joint_weight, best[k]);
+                    }
+                }
+            }
 
-                new_pos += weight * pos_pose;
-                new_norm += weight * norm_pose;
-                total_weight += weight;
+            for (unsigned int k = 0; k < max_influences; k++) {
+                total_weight += best[k].first;
             }
+            if (total_weight == 0) continue;
 
-            verts[i].pos = new_pos / total_weight;
-            verts[i].norm = (new_norm / total_weight).unit();
+            for (unsigned int k = 0; k < max_influences; k++) {
+                weights.index[k][i] = best[k].second;
+                weights.weight[k][i] = best[k].first / total_weight;
+            }
         }
-    }
-
-    std::vector<GL::Mesh::Index> idxs = input.indices();
-    output.recreate(std::move(verts), std::move(idxs));
+    });
 }
 
-void Joint::compute_gradient(Vec3 target, Vec3 current) {
+void Skeleton::skin(const GL::Mesh& input, GL::Mesh& output, const Skin_Weights& weights) {
 
-    // TODO(Animation): Task 2
+    // TODO(Animation): Task 3
 
-    // Computes the gradient of IK energy for this joint and, should be called
-    // recursively upward in the heirarchy. Each call should storing the result
-    // in the angle_gradient for this joint.
+    // Apply bone poses & weights to the vertices of the input (bind position) mesh
+    // and store the result in the output mesh. See the task description for details.
+    // weights was computed by bind_skin from the same input mesh.
+
+    constexpr unsigned int max_influences = Skin_Weights::max_influences;
+
+    // One skinning matrix per joint, taking bind position to joint space to posed
+    update_fk();
+    Mat4 base_t = Mat4::translate(base_pos);
+    std::vector<Mat4> palette(weights.palette.size());
+    for (size_t p = 0; p < palette.size(); p++) {
+        const Joint* j = weights.palette[p];
+        Mat4 to_posed = in_fk(j) ? base_t * fk.posed[j->fk_index] : joint_to_posed(j);
+        palette[p] = to_posed * weights.bind_to_joint[p];
+    }
 
-    // Target is the position of the IK handle in skeleton space.
-    // Current is the end position of the IK'd joint in skeleton space.
+    // Skin straight into the output's buffers, which only need to be refilled when the
+    // input changes
+    const std::vector<GL::Mesh::Vert>& in = input.verts();
+    std::vector<GL::Mesh::Vert> verts = std::move(output.edit_verts());
+    std::vector<GL::Mesh::Index> idxs = std::move(output.edit_indices());
+    if (verts.size() != in.size() || idxs.size() != input.indices().size()) {
+        verts = in;
+        idxs = input.indices();
+    }
 
-    // Precompute (p_theta - q).
-    Vec3 factor = current - target;
+    parallel_for(in.size(), 4096, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
 
-    Mat4 to_skeleton = joint_to_posed();
+            // Vertex i is given in object bind space
+            const GL::Mesh::Vert& bind = in[i];
+            GL::Mesh::Vert& posed = verts[i];
 
-    // Axes of rotation.
-    Vec3 r1 = to_skeleton * Vec3(0, 0, 1);
-    Vec3 r2 = to_skeleton * Vec3(0, 1, 0);
-    Vec3 r3 = to_skeleton * Vec3(1, 0, 0);
+            if (weights.weight[0][i] == 0) {
+                posed = bind;
+                continue;
+            }
 
-    // Base of the joint.
-    Vec3 base = to_skeleton * Vec3();
+            // Blend the skinning matrices, then transform the vertex once
+            Mat4 blend = palette[weights.index[0][i]] * weights.weight[0][i];
+            for (unsigned int k = 1; k < max_influences; k++) {
+                float weight = weights.weight[k][i];
+                if (weight == 0) break;
+                blend += palette[weights.index[k][i]] * weight;
+            }
 
-    Vec3 p = current - base;
+            Vec3 p = bind.pos, n = bind.norm;
+            posed.pos = (blend[0] * p.x + blend[1] * p.y + blend[2] * p.z + blend[3]).xyz();
+            posed.norm = (blend[0] * n.x + blend[1] * n.y + blend[2] * n.z).xyz().unit();
+            posed.id = bind.id;
+        }
+    });
 
-    Vec3 j1 = cross(r1, p);
-    Vec3 j2 = cross(r2, p);
-    Vec3 j3 = cross(r3, p);
+    output.recreate(std::move(verts), std::move(idxs));
+}
 
-    angle_gradient[0] = dot(j1, factor);
-    angle_gradient[1] = dot(j2, factor);
-    angle_gradient[2] = dot(j3, factor);
+// Wraps each limited angle of pose into [-180, 180) and clamps it to the joint's range
+static Vec3 limit_pose(const Joint* j, Vec3 pose) {
+    for (int a = 0; a < 3; a++) {
+        if (j->pose_min[a] > -180.0f || j->pose_max[a] < 180.0f) {
+            float angle = std::remainder(pose[a], 360.0f);
+            pose[a] = std::clamp(angle, j->pose_min[a], j->pose_max[a]);
+        }
+    }
+    return pose;
+}
 
-    if (!is_root()) {
-        parent->compute_gradient(target, current);
+// Solves A x = b in place for a symmetric positive definite n by n matrix A, leaving x in b
+static void cholesky_solve(std::vector<float>& A, std::vector<float>& b, size_t n) {
+    for (size_t c = 0; c < n; c++) {
+        for (size_t k = 0; k < c; k++) {
+            A[c * n + c] -= A[c * n + k] * A[c * n + k];
+        }
+        A[c * n + c] = std::sqrt(std::max(A[c * n + c], EPS_F));
+        for (size_t r = c + 1; r < n; r++) {
+            for (size_t k = 0; k < c; k++) {
+                A[r * n + c] -= A[r * n + k] * A[c * n + k];
+            }
+            A[r * n + c] /= A[c * n + c];
+        }
+    }
+    for (size_t r = 0; r < n; r++) {
+        for (size_t k = 0; k < r; k++) b[r] -= A[r * n + k] * b[k];
+        b[r] /= A[r * n + r];
+    }
+    for (size_t r = n; r-- > 0;) {
+        for (size_t k = r + 1; k < n; k++) b[r] -= A[k * n + r] * b[k];
+        b[r] /= A[r * n + r];
     }
 }
 
@@ -263,29 +412,164 @@ void Skeleton::step_ik(std::vector<IK_Handle*> active_handles) {
 
     // TODO(Animation): Task 2
 
-    // Do several iterations of Jacobian Transpose gradient descent for IK
+    // Move the poses of the joints above each handle so that the handle's joint reaches
+    // toward its target, using damped least squares.
+
+    // Every chain runs up to a root, so handles under different roots are independent and
+    // handles under the same root are solved together as one system.
+    update_fk();
+
+    std::unordered_map<const Joint*, std::vector<IK_Handle*>> by_root;
+    for (IK_Handle* handle : active_handles) {
+        const Joint* root = handle->joint;
+        while (!root->is_root()) root = root->parent;
+        by_root[root].push_back(handle);
+    }
+
+    std::vector<int> local(fk.joints.size(), -1);
+
+    for (auto& [root, handles] : by_root) {
+        (void)root;
+
+        // The joints on any of the chains, parent-before-child, and each handle's chain
+        std::vector<unsigned int> joints;
+        std::vector<std::vector<unsigned int>> chains(handles.size());
+        for (size_t h = 0; h < handles.size(); h++) {
+            for (const Joint* j = handles[h]->joint; j; j = j->parent) {
+                if (local[j->fk_index] < 0) {
+                    local[j->fk_index] = 0;
+                    joints.push_back(j->fk_index);
+                }
+            }
+        }
+        std::sort(joints.begin(), joints.end());
+        float scale = 0.0f;
+        for (size_t k = 0; k < joints.size(); k++) {
+            local[joints[k]] = (int)k;
+            scale += fk.joints[joints[k]]->extent.norm();
+        }
+        for (size_t h = 0; h < handles.size(); h++) {
+            for (const Joint* j = handles[h]->joint; j; j = j->parent) {
+                chains[h].push_back(local[j->fk_index]);
+            }
+        }
+        scale = std::max(scale, EPS_F);
 
-    for (std::vector<IK_Handle*>::iterator i = active_handles.begin(); i != active_handles.end(); i++) {
-        IK_Handle *ik_handle = *i;
-        Vec3 target = ik_handle->target;
+        const size_t n = joints.size(), m = 3 * handles.size();
+        std::vector<Vec3> pose(n), trial(n);
+        std::vector<Mat4> frame(n), posed(n);
+        for (size_t k = 0; k < n; k++) {
+            pose[k] = fk.joints[joints[k]]->pose;
+        }
 
-        for (int j = 0; j < ITERATION; j++) {
-            Joint *joint = ik_handle->joint;
+        // Forward kinematics over just these joints, which include all of their parents.
+        // Returns the squared distance from the handles to their targets.
+        std::vector<float> error(m);
+        auto solve_fk = [&](const std::vector<Vec3>& angles) {
+            for (size_t k = 0; k < n; k++) {
+                int p = fk.parent[joints[k]];
+                frame[k] = p < 0 ? Mat4::I
+                                 : posed[local[p]] * Mat4::translate(fk.joints[p]->extent);
+                posed[k] = frame[k] * Mat4::euler(angles[k]);
+            }
+            float total = 0.0f;
+            for (size_t h = 0; h < handles.size(); h++) {
+                const Joint* j = handles[h]->joint;
+                Vec3 e = handles[h]->target - posed[chains[h][0]] * j->extent;
+                error[3 * h] = e.x;
+                error[3 * h + 1] = e.y;
+                error[3 * h + 2] = e.z;
+                total += e.norm_squared();
+            }
+            return total;
+        };
 
-            Vec3 current = joint->joint_to_posed() * joint->extent;
-            joint->compute_gradient(target, current);
+        float err = solve_fk(pose);
+        float damping = 0.1f * scale;
+        const float tolerance = IK_TOLERANCE * scale;
 
-            // Random timstep per loop.
-            float timestep = RNG::unit() * (TIMESTEP_MAX - TIMESTEP_MIN) + TIMESTEP_MIN;
+        std::vector<float> jacobian(m * 3 * n), system(m * m), step(m);
+        for (int iter = 0; iter < IK_MAX_ITERATIONS; iter++) {
 
-            while (true) {
-                joint->pose -= timestep * joint->angle_gradient;
+            float worst = 0.0f;
+            for (size_t h = 0; h < handles.size(); h++) {
+                worst = std::max(worst, Vec3(error[3 * h], error[3 * h + 1],
+                                             error[3 * h + 2]).norm());
+            }
+            if (worst < tolerance) break;
+
+            // Each angle turns the chain below it about its axis, through the joint's base;
+            // the z rotation is applied first, then y, then x
+            std::fill(jacobian.begin(), jacobian.end(), 0.0f);
+            for (size_t h = 0; h < handles.size(); h++) {
+                Vec3 end = posed[chains[h][0]] * handles[h]->joint->extent;
+                for (unsigned int k : chains[h]) {
+                    Vec3 base = posed[k] * Vec3();
+                    Mat4 after_z = frame[k] * Mat4::rotate(pose[k].z, Vec3(0.0f, 0.0f, 1.0f));
+                    Vec3 axes[3] = {posed[k].rotate(Vec3(1.0f, 0.0f, 0.0f)),
+                                    after_z.rotate(Vec3(0.0f, 1.0f, 0.0f)),
+                                    frame[k].rotate(Vec3(0.0f, 0.0f, 1.0f))};
+                    for (int a = 0; a < 3; a++) {
+                        Vec3 d = cross(axes[a], end - base);
+                        for (int r = 0; r < 3; r++) {
+                            jacobian[(3 * h + r) * 3 * n + 3 * k + a] = d[r];
+                        }
+                    }
+                }
+            }
 
-                if (joint->is_root()) {
-                    break;
+            // J J^T + damping^2 I is only as large as the number of handle coordinates
+            for (size_t r = 0; r < m; r++) {
+                for (size_t c = 0; c <= r; c++) {
+                    float dot = 0.0f;
+                    for (size_t k = 0; k < 3 * n; k++) {
+                        dot += jacobian[r * 3 * n + k] * jacobian[c * 3 * n + k];
+                    }
+                    system[r * m + c] = system[c * m + r] = dot;
+                }
+                system[r * m + r] += damping * damping;
+            }
+            step = error;
+            cholesky_solve(system, step, m);
+
+            float largest = 0.0f;
+            for (size_t k = 0; k < n; k++) {
+                Vec3 delta;
+                for (int a = 0; a < 3; a++) {
+                    for (size_t r = 0; r < m; r++) {
+                        delta[a] += jacobian[r * 3 * n + 3 * k + a] * step[r];
+                    }
                 }
-                joint = joint->parent;
+                delta = Degrees(delta);
+                largest = std::max({largest, std::abs(delta.x), std::abs(delta.y),
+                                    std::abs(delta.z)});
+                trial[k] = limit_pose(fk.joints[joints[k]], pose[k] + delta);
+            }
+
+            // Targets out of reach settle where the step vanishes
+            if (largest < IK_MIN_STEP) break;
+
+            // Accept steps that help and trust the linearization more; otherwise damp
+            // harder and retry from the same pose
+            float trial_err = solve_fk(trial);
+            if (trial_err < err) {
+                bool stalled = err - trial_err < IK_MIN_IMPROVEMENT * err;
+                std::swap(pose, trial);
+                err = trial_err;
+                damping = std::max(damping * 0.5f, 1e-3f * scale);
+                if (stalled) break;
+            } else {
+                damping *= 4.0f;
+                err = solve_fk(pose);
             }
         }
+
+        for (size_t k = 0; k < n; k++) {
+            fk.joints[joints[k]]->pose = pose[k];
+            local[joints[k]] = -1;
+        }
     }
+
+    fk.dirty = true;
+    update_fk();
 }
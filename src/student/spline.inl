@@ -14,18 +14,71 @@ T Spline<T>::cubic_unit_spline(float time, const T& position0, const T& position
     // Note that Spline is parameterized on type T, which allows us to create splines over
     // any type that supports the * and + operators.
 
+    float h00, h10, h01, h11;
+    hermite_basis(time, h00, h10, h01, h11);
+
+    T res = h00 * position0 + h10 * tangent0 + h01 * position1 + h11 * tangent1;
+
+    return res;
+}
+
+template<typename T>
+void Spline<T>::hermite_basis(float time, float& h00, float& h10, float& h01, float& h11) {
+
     float t = time;
     float sqr_t = t * t;
     float cube_t = sqr_t * t;
 
-    float h00 = 2 *cube_t - 3 * sqr_t + 1;
-    float h10 = cube_t - 2 * sqr_t + t;
-    float h01 = -2 * cube_t + 3 * sqr_t;
-    float h11 = cube_t - sqr_t;
+    h00 = 2 * cube_t - 3 * sqr_t + 1;
+    h10 = cube_t - 2 * sqr_t + t;
+    h01 = -2 * cube_t + 3 * sqr_t;
+    h11 = cube_t - sqr_t;
+}
+
+template<typename T>
+typename Spline<T>::Segment
+Spline<T>::segment(typename std::map<float, T>::const_iterator iterator_k2) const {
 
-    T res = h00 * position0 + h10 * tangent0 + h01 * position1 + h11 * tangent1;
+    typename std::map<float, T>::const_iterator iterator_k1 = std::prev(iterator_k2);
+    std::pair<float, T> k1 = *iterator_k1, k2 = *iterator_k2;
 
-    return res;
+    // Precompute delta t and delta p.
+    float delta_time = k2.first - k1.first;
+    T delta_position = k2.second - k1.second;
+
+    std::pair<float, T> k0;
+    if (iterator_k1 == control_points.begin()) {
+        // Suppose we don’t have a knot "two to the left" (k0).
+        // Then we will define a "virtual" knot k0 = k1 - (k2 - k1).
+
+        k0.first = k1.first - delta_time;
+        k0.second = k1.second - delta_position;
+    } else {
+        k0 = *std::prev(iterator_k1);
+    }
+
+    typename std::map<float, T>::const_iterator iterator_k3 = std::next(iterator_k2);
+    std::pair<float, T> k3;
+    if (iterator_k3 == control_points.end()) {
+        // Likewise, if we don’t have a knot "two to the right" (k3),
+        // then we will "mirror" the difference to get a "virtual" knot k3 = k2 + (k2 - k1).
+
+        k3.first = k2.first + delta_time;
+        k3.second = k2.second + delta_position;
+    } else {
+        k3 = *iterator_k3;
+    }
+
+    // At this point, we have four valid knot values (whether "real" or "virtual"),
+    // and can compute our tangents and positions as usual.
+    Segment s;
+    s.start = k1.first;
+    s.length = delta_time;
+    s.position0 = k1.second;
+    s.position1 = k2.second;
+    s.tangent0 = (k2.second - k0.second) / (k2.first - k0.first);
+    s.tangent1 = (k3.second - k1.second) / (k3.first - k1.first);
+    return s;
 }
 
 template<typename T> T Spline<T>::at(float time) const {
@@ -43,6 +96,13 @@ template<typename T> T Spline<T>::at(float time) const {
     // If there are no knots at all in the spline,
     // interpolation should return the default value for the interpolated type.
     // This value can be computed by simply calling the constructor for the type: T().
+
+    // Baked frames were computed by this same function
+    T value = T();
+    if (baked.get(time, value)) {
+        return value;
+    }
+
     if (!any()) {
         return T();
     }
@@ -69,45 +129,84 @@ template<typename T> T Spline<T>::at(float time) const {
     }
 
     // Any query time between the first and last knot will have at least one knot "to the left" (k1) and one "to the right" (k2).
-    typename std::map<float, T>::const_iterator iterator_k1 = control_points.lower_bound(time), iterator_k2 = iterator_k1--;
-    std::pair<float, T> k1 = *iterator_k1, k2 = *iterator_k2;
+    Segment seg = segment(control_points.lower_bound(time));
+    float normalized_time = (time - seg.start) / seg.length;
 
-    // Precompute delta t and delta p.
-    float delta_time = k2.first - k1.first;
-    T delta_position = k2.second - k1.second;
-
-    typename std::map<float, T>::const_iterator iterator_k0 = control_points.end();
-    std::pair<float, T> k0;
-    if (iterator_k1 == control_points.begin()) {
-        // Suppose we don’t have a knot "two to the left" (k0).
-        // Then we will define a "virtual" knot k0 = k1 - (k2 - k1).
+    return cubic_unit_spline(normalized_time, seg.position0, seg.position1, seg.tangent0,
+                             seg.tangent1);
+}
 
-        k0.first = k1.first - delta_time;
-        k0.second = k1.second - delta_position;
-    } else {
-        iterator_k0 = iterator_k1;
-        iterator_k0--;
-        k0 = *iterator_k0;
-    }
+template<typename T>
+void Spline<T>::at_many(const std::vector<float>& times, std::vector<T>& out) const {
 
-    typename std::map<float, T>::const_iterator iterator_k3 = iterator_k2;
-    iterator_k3++;
-    std::pair<float, T> k3;
-    if (iterator_k3 == control_points.end()) {
-        // Likewise, if we don’t have a knot "two to the right" (k3),
-        // then we will "mirror" the difference to get a "virtual" knot k3 = k2 + (k2 - k1).
+    // Evaluates exactly what at() would for each time, but sorted times visit each knot
+    // once, and the knots and tangents of a segment are set up once for all of its times.
 
-        k3.first = k2.first + delta_time;
-        k3.second = k2.second + delta_position;
-    } else {
-        k3 = *iterator_k3;
+    out.resize(times.size());
+    if (control_points.size() < 2) {
+        T value = any() ? control_points.begin()->second : T();
+        std::fill(out.begin(), out.end(), value);
+        return;
     }
 
-    // At this point, we have four valid knot values (whether "real" or "virtual"),
-    // and can compute our tangents and positions as usual.
-    T tangent0 = (k2.second - k0.second) / (k2.first - k0.first);
-    T tangent1 = (k3.second - k1.second) / (k3.first - k1.first);
-    float normalized_time = (time - k1.first) / delta_time;
-
-    return cubic_unit_spline(normalized_time, k1.second, k2.second, tangent0, tangent1);
+    typename std::map<float, T>::const_iterator first = control_points.begin();
+    typename std::map<float, T>::const_iterator last = std::prev(control_points.end());
+
+    // The segment (k1, k2] that the current run of times falls in
+    typename std::map<float, T>::const_iterator iterator_k2 = std::next(first);
+    Segment seg;
+    bool ready = false;
+
+    // The Hermite basis for a block of times is computed in its own loop over plain
+    // floats, which the compiler can vectorize, before being applied to the knots
+    constexpr size_t block = 64;
+    float h00[block], h10[block], h01[block], h11[block];
+
+    size_t i = 0;
+    while (i < times.size()) {
+        float time = times[i];
+
+        // Same edge cases as at()
+        if (time >= last->first) {
+            out[i++] = last->second;
+            continue;
+        }
+        if (time <= first->first) {
+            out[i++] = first->second;
+            continue;
+        }
+
+        // Walk forward to the segment containing time, only searching when times go back
+        if (time <= std::prev(iterator_k2)->first) {
+            iterator_k2 = control_points.lower_bound(time);
+            ready = false;
+        }
+        while (iterator_k2->first < time) {
+            iterator_k2++;
+            ready = false;
+        }
+
+        if (!ready) {
+            seg = segment(iterator_k2);
+            ready = true;
+        }
+
+        // Every following time inside this segment shares its knots and tangents
+        size_t end = i + 1;
+        float seg_end = iterator_k2->first;
+        while (end < times.size() && end - i < block && times[end] > seg.start &&
+               times[end] <= seg_end && times[end] < last->first) {
+            end++;
+        }
+
+        for (size_t j = i; j < end; j++) {
+            hermite_basis((times[j] - seg.start) / seg.length, h00[j - i], h10[j - i],
+                          h01[j - i], h11[j - i]);
+        }
+        for (size_t j = i; j < end; j++) {
+            out[j] = h00[j - i] * seg.position0 + h10[j - i] * seg.tangent0 +
+                     h01[j - i] * seg.position1 + h11[j - i] * seg.tangent1;
+        }
+        i = end;
+    }
 }
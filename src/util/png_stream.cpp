@@ -0,0 +1,127 @@
+#include "png_stream.h"
+
+#include <vector>
+
+static uint32_t crc32(uint32_t crc, const unsigned char* data, size_t size) {
+
+    static uint32_t table[256] = {};
+    static bool init = false;
+    if(!init) {
+        for(uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for(int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        init = true;
+    }
+
+    crc = ~crc;
+    for(size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void put_u32(std::vector<unsigned char>& buf, uint32_t v) {
+    buf.push_back((unsigned char)(v >> 24));
+    buf.push_back((unsigned char)(v >> 16));
+    buf.push_back((unsigned char)(v >> 8));
+    buf.push_back((unsigned char)v);
+}
+
+void PNG_Stream::chunk(const char type[4], const unsigned char* data, size_t size) {
+
+    std::vector<unsigned char> head;
+    put_u32(head, (uint32_t)size);
+    head.insert(head.end(), type, type + 4);
+
+    uint32_t crc = crc32(0, head.data() + 4, 4);
+    crc = crc32(crc, data, size);
+
+    std::vector<unsigned char> tail;
+    put_u32(tail, crc);
+
+    out.write((const char*)head.data(), head.size());
+    out.write((const char*)data, size);
+    out.write((const char*)tail.data(), tail.size());
+}
+
+std::string PNG_Stream::open(std::string file, size_t _w, size_t _h) {
+
+    w = _w;
+    h = _h;
+    rows_written = 0;
+    adler_a = 1;
+    adler_b = 0;
+
+    out.open(file, std::ios::binary | std::ios::trunc);
+    if(!out.is_open()) return "Failed to open " + file + " for writing!";
+
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    out.write((const char*)signature, sizeof(signature));
+
+    // 8-bit RGBA, no interlacing
+    std::vector<unsigned char> ihdr;
+    put_u32(ihdr, (uint32_t)w);
+    put_u32(ihdr, (uint32_t)h);
+    ihdr.insert(ihdr.end(), {8, 6, 0, 0, 0});
+    chunk("IHDR", ihdr.data(), ihdr.size());
+
+    // zlib header: deflate with a 32K window, no preset dictionary
+    static const unsigned char zlib_header[2] = {0x78, 0x01};
+    chunk("IDAT", zlib_header, sizeof(zlib_header));
+
+    if(!out.good()) return "Failed to write " + file + "!";
+    return {};
+}
+
+std::string PNG_Stream::write_rows(const unsigned char* rgba, size_t rows) {
+
+    if(rows_written + rows > h) return "Too many rows written to PNG stream!";
+
+    // Each scanline is prefixed with filter type 0 (none)
+    size_t line = 4 * w + 1;
+    std::vector<unsigned char> raw;
+    raw.reserve(line * rows);
+    for(size_t j = 0; j < rows; j++) {
+        raw.push_back(0);
+        raw.insert(raw.end(), rgba + j * 4 * w, rgba + (j + 1) * 4 * w);
+    }
+
+    for(unsigned char c : raw) {
+        adler_a = (adler_a + c) % 65521u;
+        adler_b = (adler_b + adler_a) % 65521u;
+    }
+
+    // Split into non-final stored blocks of at most 65535 bytes
+    std::vector<unsigned char> data;
+    data.reserve(raw.size() + 5 * (raw.size() / 65535 + 1));
+    for(size_t i = 0; i < raw.size(); i += 65535) {
+        size_t len = std::min(raw.size() - i, (size_t)65535);
+        data.push_back(0);
+        data.push_back((unsigned char)len);
+        data.push_back((unsigned char)(len >> 8));
+        data.push_back((unsigned char)~len);
+        data.push_back((unsigned char)(~len >> 8));
+        data.insert(data.end(), raw.begin() + i, raw.begin() + i + len);
+    }
+    chunk("IDAT", data.data(), data.size());
+
+    rows_written += rows;
+    if(!out.good()) return "Failed to write PNG rows!";
+    return {};
+}
+
+std::string PNG_Stream::close() {
+
+    if(rows_written != h) return "PNG stream closed before all rows were written!";
+
+    // Empty final stored block followed by the zlib checksum
+    std::vector<unsigned char> data = {1, 0, 0, 0xff, 0xff};
+    put_u32(data, (adler_b << 16) | adler_a);
+    chunk("IDAT", data.data(), data.size());
+    chunk("IEND", nullptr, 0);
+
+    bool ok = out.good();
+    out.close();
+    if(!ok) return "Failed to finish writing PNG!";
+    return {};
+}
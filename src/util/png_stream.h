@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+// Writes an 8-bit RGBA PNG a few rows at a time, so an image never has to be held in memory
+// all at once. Rows are given top to bottom. The image data uses stored (uncompressed)
+// deflate blocks, as stb_image_write can only compress a whole image in one go.
+class PNG_Stream {
+public:
+    PNG_Stream() = default;
+    ~PNG_Stream() = default;
+
+    PNG_Stream(const PNG_Stream& src) = delete;
+    PNG_Stream& operator=(const PNG_Stream& src) = delete;
+
+    std::string open(std::string file, size_t w, size_t h);
+    std::string write_rows(const unsigned char* rgba, size_t rows);
+    std::string close();
+
+private:
+    void chunk(const char type[4], const unsigned char* data, size_t size);
+
+    std::ofstream out;
+    size_t w = 0, h = 0, rows_written = 0;
+    uint32_t adler_a = 1, adler_b = 0;
+};
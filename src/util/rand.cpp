@@ -32,4 +32,9 @@ void seed() {
     rng.seed(seed);
 }
 
+void seed(unsigned int base, unsigned int stream, unsigned int substream) {
+    std::seed_seq seq{base, stream, substream};
+    rng.seed(seq);
+}
+
 } // namespace RNG
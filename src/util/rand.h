@@ -16,4 +16,7 @@ bool coin_flip(float p = 0.5f);
 
 // Seed the current thread's PRNG
 void seed();
+
+// Deterministically seed the current thread's PRNG for the given stream of a base seed
+void seed(unsigned int base, unsigned int stream, unsigned int substream = 0);
 } // namespace RNG
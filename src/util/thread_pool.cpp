@@ -2,6 +2,9 @@
 #include "thread_pool.h"
 #include "../util/rand.h"
 
+#include <algorithm>
+#include <memory>
+
 Thread_Pool::Thread_Pool(size_t threads) {
     start(threads);
 }
@@ -70,3 +73,112 @@ void Thread_Pool::stop() {
     std::queue<std::function<void()>> empty;
     std::swap(tasks, empty);
 }
+
+// The helpers that parallel_for shares work with, started on first use and kept for the
+// rest of the process. A call posts its job, works through chunks itself, and then waits
+// only for the chunks that helpers had already claimed. Since every claimed chunk is being
+// run by some thread, nested calls (even from inside a helper) cannot deadlock.
+namespace {
+
+struct Parallel_Job {
+    size_t n, grain, chunks;
+    const std::function<void(size_t, size_t)>* f;
+    std::atomic<size_t> next{0}, done{0};
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    // Runs chunks until none are left to claim
+    void work() {
+        for(;;) {
+            size_t c = next.fetch_add(1);
+            if(c >= chunks) return;
+            size_t begin = c * grain;
+            (*f)(begin, std::min(begin + grain, n));
+            if(done.fetch_add(1) + 1 == chunks) {
+                std::unique_lock<std::mutex> lock(mutex);
+                finished.notify_all();
+            }
+        }
+    }
+};
+
+class Parallel_Helpers {
+public:
+    Parallel_Helpers(size_t threads) {
+        for(size_t i = 0; i < threads; i++) {
+            workers.emplace_back([this] {
+                RNG::seed();
+                for(;;) {
+                    std::shared_ptr<Parallel_Job> job;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        condition.wait(lock, [this] { return stop || !jobs.empty(); });
+                        if(stop) return;
+                        job = jobs.back();
+                    }
+                    job->work();
+                    remove(job);
+                }
+            });
+        }
+    }
+    ~Parallel_Helpers() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stop = true;
+        }
+        condition.notify_all();
+        for(std::thread& worker : workers) worker.join();
+    }
+
+    void post(const std::shared_ptr<Parallel_Job>& job) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobs.push_back(job);
+        }
+        condition.notify_all();
+    }
+    void remove(const std::shared_ptr<Parallel_Job>& job) {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto entry = std::find(jobs.begin(), jobs.end(), job);
+        if(entry != jobs.end()) jobs.erase(entry);
+    }
+
+private:
+    bool stop = false;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<std::thread> workers;
+    std::vector<std::shared_ptr<Parallel_Job>> jobs;
+};
+
+} // namespace
+
+void parallel_for(size_t n, size_t grain, const std::function<void(size_t, size_t)>& f) {
+
+    if(n == 0) return;
+    grain = std::max(grain, size_t(1));
+
+    static const size_t hw_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    size_t chunks = (n + grain - 1) / grain;
+
+    if(hw_threads <= 1 || chunks <= 1) {
+        f(0, n);
+        return;
+    }
+
+    static Parallel_Helpers helpers(hw_threads - 1);
+
+    auto job = std::make_shared<Parallel_Job>();
+    job->n = n;
+    job->grain = grain;
+    job->chunks = chunks;
+    job->f = &f;
+
+    helpers.post(job);
+    job->work();
+    helpers.remove(job);
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->finished.wait(lock, [&job] { return job->done.load() == job->chunks; });
+}
@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <condition_variable>
 #include <functional>
 #include <future>
@@ -48,3 +49,9 @@ private:
     std::vector<std::thread> workers;
     std::queue<std::function<void()>> tasks;
 };
+
+// Calls f(begin, end) over [0, n) in chunks of at most grain items, spread across all
+// hardware threads (the calling one and helpers kept alive between calls, so that short
+// loops are cheap to parallelize). Returns once every chunk has completed.
+// Unlike Thread_Pool::enqueue, this is safe to call from inside a pool task.
+void parallel_for(size_t n, size_t grain, const std::function<void(size_t, size_t)>& f);